@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-rate current sense sampling. The producer (DMA reader task on the
+// board, the fake clock on native) pushes raw samples into a lock-free ring;
+// the control loop is the only consumer. With several channels the inputs
+// are converted round-robin and every sample is tagged with its channel.
+
+// Starts continuous sampling of count pins at sampleRateHz each, falls back
+// to one analogRead() per pin and loop if the continuous driver can't be
+// started
+void adcSamplerBegin(const uint8_t *pins, uint8_t count, uint32_t sampleRateHz);
+
+// Producer side
+bool adcSamplerPush(uint8_t channel, uint16_t sample);
+
+// Consumer side: pops up to max tagged samples, returns how many were copied
+size_t adcSamplerRead(uint16_t *out, size_t max);
+
+// The ADC delivers 12 bits, the channel rides in the top four
+static inline uint8_t adcSampleChannel(uint16_t tagged) { return tagged >> 12; }
+static inline uint16_t adcSampleValue(uint16_t tagged) { return tagged & 0x0FFF; }
+
+// Called once per loop() when running without DMA: takes a single sample per
+// pin every CONTROL_TASK_PERIOD_MS, or ADC_STANDBY_INTERVAL in standby
+void adcSamplerPoll();
+
+// Standby: the continuous stream keeps the clocks up and the chip out of
+// light sleep, so while every console is off the control loop pauses it and
+// the stream's producer polls the pins at the slower standby rate instead.
+// The ring never gets a second producer.
+void adcSamplerSetStandby(bool standby);
+bool adcSamplerStandby();
+
+// Time until adcSamplerPoll() has work again, UINT32_MAX while the stream delivers
+uint32_t adcSamplerIdleMs(uint32_t nowMs);
+
+bool adcSamplerContinuous();
+// Per channel rate samples arrive at right now: the stream's, or the nominal
+// poll rate without it and in standby
+uint32_t adcSamplerRate();
+uint32_t adcSamplerDropped();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Raw ADC trace capture. Samples are packed into small self-describing frames
+// that survive being interleaved with log text on the serial link:
+//
+//   A5 5A | ver u8 | count u8 | first u32 | rate u16 | count x u16 | crc16
+//
+// All fields little-endian. `first` is the index of the first sample since
+// the capture started, so sample i is at (first + i) / rate seconds. The
+// CRC-16/CCITT covers everything from `ver` to the last sample.
+
+constexpr uint8_t ADC_TRACE_SYNC0 = 0xA5;
+constexpr uint8_t ADC_TRACE_SYNC1 = 0x5A;
+constexpr uint8_t ADC_TRACE_VERSION = 1;
+constexpr uint8_t ADC_TRACE_MAX_SAMPLES = 64;
+constexpr size_t ADC_TRACE_HEADER_SIZE = 10;
+constexpr size_t ADC_TRACE_MAX_FRAME = ADC_TRACE_HEADER_SIZE + ADC_TRACE_MAX_SAMPLES * 2 + 2;
+
+struct AdcTraceFrame
+{
+  uint32_t firstIndex;
+  uint16_t rateHz;
+  uint8_t count;
+  uint16_t samples[ADC_TRACE_MAX_SAMPLES];
+};
+
+using AdcTraceSink = void (*)(const uint8_t *frame, size_t length);
+
+// Encodes a frame, returns its length (0 if out is too small)
+size_t adcTraceEncode(const AdcTraceFrame &frame, uint8_t *out, size_t capacity);
+
+// Looks for the next valid frame in data. Returns true and fills frame when
+// one was found. consumed is how many bytes the caller can drop either way.
+bool adcTraceDecode(const uint8_t *data, size_t length, AdcTraceFrame &frame, size_t &consumed);
+
+// Capture of one sampler channel on the device
+void adcTraceStart(AdcTraceSink sink, uint32_t durationMs, uint8_t channel = 0);
+void adcTraceStop();
+bool adcTraceActive();
+void adcTraceFeed(uint8_t channel, uint16_t sample, uint32_t nowMs);
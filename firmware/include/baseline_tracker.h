@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Automatic baseline calibration. While the console has been off for a while
+// an EWMA of the raw samples is kept and the baseline is nudged towards it
+// by at most one ADC count per BASELINE_STEP_INTERVAL.
+struct BaselineTracker
+{
+  int32_t ewma = 0; // 16.16 fixed point
+  bool primed = false;
+  bool wasPowered = true;
+  uint32_t offSince = 0;
+  uint32_t lastStepMs = 0;
+};
+
+// Feed one sample, returns true when baseline was moved
+bool baselineTrackerUpdate(BaselineTracker &tracker, int sample, bool powered, uint32_t nowMs, int &baseline);
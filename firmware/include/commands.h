@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+// Result flags returned by the command handlers so the caller decides what to
+// republish
+enum CommandResult : uint8_t
+{
+  CommandNone = 0,
+  CommandStateChanged = 1 << 0,
+  CommandNameChanged = 1 << 1,
+  CommandRepublishHA = 1 << 2,
+};
+
+// Fields the set and set/msgpack commands read, kept by the payload filter
+static constexpr char SET_COMMAND_FILTER[] = R"({"color":true,"customColor":true,"brightness":true,"name":true,"autoCalibrate":true,"thresholdOffset":true,"effect":true,"pixels":true,"segments":true,"encoding":true})";
+
+// channel picks the console; board-wide settings (brightness, effect, name,
+// layout) apply whichever channel's topic they came in on
+uint8_t applyLightCommand(JsonVariantConst doc, uint8_t channel = 0);
+uint8_t applySetCommand(JsonVariantConst doc, uint8_t channel = 0);
+uint8_t applyOffsetCommand(int offset, uint8_t channel = 0);
+uint8_t applyCaptureCommand(JsonVariantConst doc);
+void runIdentify(uint8_t channel = 0);
+
+// Control task side of MQTT commands: set up the dispatcher and run whatever
+// the network task queued
+void commandsBegin(const char *topicPrefix);
+void commandsPoll();
+void commandsStatsToJson(JsonObject out);
@@ -1,20 +1,97 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // LED Config
-constexpr uint8_t NUM_PIXELS = 15;
+constexpr uint8_t NUM_PIXELS = 15;               // Default, the count and segments are set at runtime
+constexpr uint16_t LED_MAX_PIXELS = 600;
+constexpr uint8_t LED_MAX_SEGMENTS = 8;
+constexpr double LED_GAMMA = 2.2;
+constexpr unsigned long LED_FRAME_INTERVAL = 10;  // Refresh rate while dithering or animating
+constexpr unsigned long LED_DITHER_SETTLE = 2000; // A static frame stops dithering after this (ms)
+
+// Effect Config
+constexpr uint32_t EFFECT_BREATH_PERIOD = 4000;  // One full breath (ms)
+constexpr uint32_t EFFECT_CHASE_STEP = 80;       // Time the chase head spends per pixel (ms)
+constexpr uint32_t EFFECT_RAINBOW_PERIOD = 6000; // One full hue rotation (ms)
+
+// Consoles watched by one board, each with its own current sense input (see
+// pins.h), threshold, LED zone and color. Override with -D CONSOLE_CHANNELS=N
+#ifndef CONSOLE_CHANNELS
+#define CONSOLE_CHANNELS 1
+#endif
 
 // Current Sense Config
 const int CURRENT_THRESHOLD = 1600;
 const int CURRENT_THRESHOLD_OFFSET = 100;
+constexpr uint32_t ADC_SAMPLE_RATE_HZ = 1000; // Per channel
+constexpr size_t ADC_RING_SIZE = 1024;        // Power of two, ~1 s of samples per channel
+constexpr int CALIBRATION_SAMPLES = 64;
+constexpr uint16_t POWER_RMS_WINDOW = 64; // Samples, ~3 mains cycles at 1 kHz
+
+// ADC standby (every console off), lets the chip light sleep between samples
+constexpr unsigned long ADC_STANDBY_DELAY = 60000; // Off this long before continuous sampling pauses, 0 never
+constexpr unsigned long ADC_STANDBY_INTERVAL = 7;  // Sample period (ms), off the mains period so the phase walks
+
+// Automatic baseline tracking (while the console is off)
+constexpr bool AUTO_CALIBRATE_DEFAULT = false;
+// 4096 samples per time constant: ~4 s at 1 kHz, but ~29 s once sampling
+// drops to ADC_STANDBY_INTERVAL, where the tracker spends most of its time
+constexpr uint8_t BASELINE_EWMA_SHIFT = 12;
+constexpr unsigned long BASELINE_SETTLE_TIME = 30000;          // 30 seconds after power off
+constexpr unsigned long BASELINE_STEP_INTERVAL = 10000;        // Max drift 1 count per 10 s
+constexpr int BASELINE_PERSIST_DELTA = 8;                      // Counts before writing NVS
+constexpr unsigned long BASELINE_PERSIST_INTERVAL = 3600000;   // At most once an hour
+constexpr unsigned long BASELINE_PUBLISH_INTERVAL = 60000;     // At most once a minute
 
 // Encoder Config
 constexpr int ENCODER_STEPS_PER_CLICK = 4;
+constexpr uint8_t ENCODER_CHANNEL = 0;            // Console channel whose color the encoder picks
+constexpr unsigned long ENCODER_ACCEL_SLOW = 150; // Brightness detents further apart step by 1 (ms)
+constexpr unsigned long ENCODER_ACCEL_FAST = 15;  // Detents this close step by ENCODER_ACCEL_MAX_STEP
+constexpr uint8_t ENCODER_ACCEL_MAX_STEP = 16;
+
+// Input Config
+constexpr size_t INPUT_QUEUE_SIZE = 64;      // Power of two, raw edges waiting per consumer
+constexpr unsigned long INPUT_DEBOUNCE = 20; // A button level must hold this long (ms)
 
 // Timing Config
 constexpr unsigned long LONG_PRESS_THRESHOLD = 2000; // 2 seconds
-constexpr unsigned long POWER_OFF_DELAY = 1000;      // 1 second
+constexpr unsigned long POWER_OFF_DELAY = 300;       // 300 ms
+constexpr unsigned long LOOP_DIAG_INTERVAL = 60000;  // 1 minute
+constexpr unsigned long STATE_PUBLISH_COALESCE = 150; // Batch state changes before publishing
+
+// Task Config
+constexpr uint32_t CONTROL_TASK_PERIOD_MS = 5; // Polling period when sampling without DMA
+constexpr uint32_t CONTROL_TASK_STACK = 6144;
+constexpr uint8_t CONTROL_TASK_PRIORITY = 3;   // Above loop() (1), below WiFi/lwIP
+
+// Sleep Config, both tasks block until an event or their next deadline
+constexpr uint32_t CONTROL_IDLE_MAX = 1000;    // Longest control task sleep with nothing due
+constexpr uint32_t NETWORK_ACTIVE_PERIOD = 10; // While connecting, in the portal or downloading
+constexpr uint32_t NETWORK_IDLE_PERIOD = 50;   // Otherwise, also bounds MQTT receive latency
+
+// MQTT Connect Config
+constexpr unsigned long MQTT_RETRY_INTERVAL = 5000; // Between failed connection attempts
+constexpr unsigned long MQTT_DNS_TIMEOUT = 5000;
+constexpr unsigned long MQTT_TCP_TIMEOUT = 5000;
+constexpr uint8_t MQTT_CONNACK_TIMEOUT_S = 2; // PubSubClient socket timeout, bounds the CONNACK wait
+
+// Firmware Update Config
+constexpr size_t OTA_CHUNK_SIZE = 1024;
+constexpr uint8_t OTA_CHUNKS_PER_LOOP = 4;            // Bounds the time one network loop spends on OTA
+constexpr unsigned long OTA_STALL_TIMEOUT = 15000;    // Abort when no data arrives for this long
+constexpr unsigned long OTA_PROGRESS_INTERVAL = 1000; // Between progress messages
+constexpr unsigned long OTA_REBOOT_DELAY = 1000;      // Lets the outcome reach the broker
+constexpr uint16_t OTA_HTTP_TIMEOUT = 5000;
+
+// Settings Config
+constexpr unsigned long SETTINGS_COMMIT_DELAY = 2000;      // Idle time before writing NVS
+constexpr unsigned long SETTINGS_COMMIT_MAX_DELAY = 10000; // Upper bound while still changing
 
 // HA Device Config
 constexpr const char *HA_DEVICE_MANUFACTURER = "Kostecki";
 constexpr const char *HA_DEVICE_MODEL = "Console LED Trigger";
-constexpr const char *HA_DEVICE_FW_VERSION = "1.0.0";
\ No newline at end of file
+constexpr const char *HA_DEVICE_FW_VERSION = "1.0.0";
+constexpr const char *HA_STATUS_TOPIC = "homeassistant/status"; // HA birth message
\ No newline at end of file
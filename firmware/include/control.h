@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Sensing, input and LED control. Runs on top of hal.h so it builds for both
+// the board and the native host target.
+void controlSetup();
+void controlLoop();
+
+// How long the control task can sleep before something is due
+uint32_t controlIdleMs();
+
+// Averages the channel's next CALIBRATION_SAMPLES ADC samples into a new baseline
+void startCalibration(uint8_t channel);
+
+// Per-channel settings. Channel 0 keeps the names from before there were
+// channels; the others get the channel number appended ("th_base1").
+enum class ChannelKey : uint8_t
+{
+  Baseline = 0,
+  Offset,
+  ColorMode,
+  ColorIndex,
+  CustomColor,
+  Count
+};
+
+const char *channelKey(uint8_t channel, ChannelKey key);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+#include <framebuffer.h>
+
+// Procedural effects, drawn per pixel into a segment of the framebuffer on
+// top of the current color. Solid just fills it.
+enum class Effect : uint8_t
+{
+  Solid = 0,
+  Breathing,
+  Chase,
+  Gradient,
+  Rainbow,
+  Count
+};
+
+const char *effectName(Effect effect);
+bool effectFromName(const char *name, Effect &effect);
+
+// Draws one frame of effect for base color at nowMs over a pixel range
+void effectRender(Effect effect, const Rgb16 &base, uint32_t nowMs, uint16_t start, uint16_t length);
+// Changes from frame to frame even with a steady base color
+bool effectAnimated(Effect effect);
+
+// Frame cost, recorded by the LED tick
+void effectFrameRecord(uint32_t cycles, bool shown);
+// n, shown, avg_us and max_us since the last call
+void effectFrameStatsToJson(JsonObject obj);
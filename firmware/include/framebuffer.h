@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// Logical LED frame in 16-bit linear light, kept apart from the strip.
+// 24-bit colors are gamma decoded on the way in; brightness is applied and
+// the frame is temporally dithered down to 8 bits only on the way out, so
+// fades stay smooth at low brightness.
+struct Rgb16
+{
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+};
+
+inline bool operator==(const Rgb16 &a, const Rgb16 &b) { return a.r == b.r && a.g == b.g && a.b == b.b; }
+inline bool operator!=(const Rgb16 &a, const Rgb16 &b) { return !(a == b); }
+
+Rgb16 rgb16FromColor(uint32_t color);
+// frac is the position between from and to in 1/65536ths
+Rgb16 rgb16Lerp(const Rgb16 &from, const Rgb16 &to, uint16_t frac);
+
+// Statically sized for LED_MAX_PIXELS, count is what's on the strip now
+void fbBegin(uint16_t count);
+uint16_t fbPixelCount();
+
+void fbSet(uint16_t index, const Rgb16 &color);
+void fbFill(const Rgb16 &color);
+void fbFillRange(uint16_t start, uint16_t length, const Rgb16 &color);
+Rgb16 fbGet(uint16_t index);
+
+void fbSetBrightness(uint8_t brightness);
+uint8_t fbBrightness();
+
+// Converts a range to strip colors and hands over the pixels that changed,
+// true if any did. dithered is set when a pixel there sits between two
+// 8-bit levels and needs regular refreshes. The caller shows the strip.
+bool fbRender(uint16_t start, uint16_t length, bool &dithered);
+
+// Whole strip, shown if the output changed; true when it did
+bool fbShow();
+bool fbDithering(); // As of the last fbShow()
+
+// With dithering off levels are rounded instead, for frames that have stopped
+// changing and would otherwise be refreshed forever
+void fbDitherEnable(bool enabled);
+bool fbDitherEnabled();
+
+// Frame, last output and dither error
+constexpr uint8_t FB_BYTES_PER_PIXEL = sizeof(Rgb16) + sizeof(uint32_t) + 3;
+uint32_t fbMemoryUsed();
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Home Assistant discovery messages, generated at build time by
+// scripts/generate_ha_discovery.py. Topics and payloads are templates with
+// {node}, {mac} and {name} (the device name, JSON escaped) left for the
+// device to fill in. Per-channel entries are
+// sent once for each console channel, with {ch} (topic level "ch<n>/"),
+// {chid} (id suffix "_ch<n>") and {chn} (name suffix " <n+1>") empty for
+// channel 0.
+struct HaDiscoveryEntry
+{
+  const char *topic;
+  const char *payload;
+  bool perChannel;
+};
+
+extern const HaDiscoveryEntry haDiscoveryEntries[];
+extern const uint8_t HA_DISCOVERY_COUNT;
+extern const uint32_t HA_DISCOVERY_HASH; // FNV-1a over all templates
+
+// Config topics of removed entities, cleared with an empty retained message
+extern const char *const haDiscoveryRetired[];
+extern const uint8_t HA_DISCOVERY_RETIRED_COUNT;
+
+// Device name for {name}, "Console-<mac>" until set. Owned by the network
+// task, which publishes discovery.
+void haDiscoverySetName(const char *name);
+
+// Expands the placeholders, returns the length (0 if it didn't fit)
+size_t haDiscoveryExpand(const char *tmpl, char *out, size_t len, uint8_t channel = 0);
+
+// Template hash mixed with this device's node id, name and channel count,
+// stored in NVS once sent
+uint32_t haDiscoveryHash();
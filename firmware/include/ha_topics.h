@@ -1,36 +1,49 @@
-#include <utils.h>
+#pragma once
+
+#include <stdint.h>
+
+// MQTT topics are built once by haTopicsBegin() into static buffers, so
+// the publish and dispatch paths never touch the heap. Topics that take a
+// channel belong to one console; channel 0 has the plain device topics, the
+// others live under console/<node>/ch<n>/.
+void haTopicsBegin(const char *macSuffix);
 
 // Core identifiers
-static inline String haNodeId() { return "board-" + toLower(getMacSuffix()); }
-static inline String haObjectId() { return haNodeId() + "-light"; }
+const char *haMacSuffix(); // "A1B2C3"
+const char *haNodeId();    // "board-a1b2c3"
+const char *haObjectId();
+const char *haDeviceId(); // "console_board-a1b2c3"
+
+// Device topics (console/<node>/...)
+const char *haCmdPrefix(); // "console/<node>/", commands are matched on what follows
+const char *haDeviceStateTopic();
+const char *haSetCmdTopic(uint8_t channel = 0);
+// MessagePack twins of the two above, for the dashboard and tools
+const char *haDeviceStateMsgPackTopic();
+const char *haSetMsgPackCmdTopic(uint8_t channel = 0);
+const char *haFwUpdateCmdTopic();
+const char *haFwStatusTopic(); // Download progress and outcome
+const char *haCaptureCmdTopic();
 
 // Light (main controllable entity)
-static inline String haConfigTopic() { return "homeassistant/light/" + haNodeId() + "/config"; }
-static inline String haCmdTopic() { return "console/" + haNodeId() + "/ha/set"; }
-static inline String haStateTopic() { return "console/" + haNodeId() + "/ha/state"; }
-static inline String haAvailTopic() { return "console/" + haNodeId() + "/status"; }
+const char *haCmdTopic(uint8_t channel = 0);
+const char *haStateTopic(uint8_t channel = 0);
+const char *haAvailTopic();
 
 // Number (Offset)
-static inline String haNumberOffsetConfigTopic() { return "homeassistant/number/" + haNodeId() + "/offset/config"; }
-static inline String haOffsetCmdTopic() { return "console/" + haNodeId() + "/offset/set"; }
-static inline String haOffsetStateTopic() { return "console/" + haNodeId() + "/offset/state"; }
+const char *haOffsetCmdTopic(uint8_t channel = 0);
+const char *haOffsetStateTopic(uint8_t channel = 0);
 
 // Sensors (read-only)
-static inline String haSensorBaselineConfigTopic() { return "homeassistant/sensor/" + haNodeId() + "/threshold/config"; }
-static inline String haBaseStateTopic() { return "console/" + haNodeId() + "/threshold/state"; }
-
-static inline String haSensorOnConfigTopic() { return "homeassistant/sensor/" + haNodeId() + "/th_on/config"; }
-static inline String haThOnStateTopic() { return "console/" + haNodeId() + "/th_on/state"; }
+const char *haBaseStateTopic(uint8_t channel = 0);
+const char *haThOnStateTopic(uint8_t channel = 0);
+const char *haThOffStateTopic(uint8_t channel = 0);
 
-static inline String haSensorOffConfigTopic() { return "homeassistant/sensor/" + haNodeId() + "/th_off/config"; }
-static inline String haThOffStateTopic() { return "console/" + haNodeId() + "/th_off/state"; }
+// Diagnostics (loop timing histograms)
+const char *haDiagLoopTopic();
+const char *haDiagAdcTopic();
 
 // Buttons (stateless actions)
-static inline String haIdentifyConfigTopic() { return "homeassistant/button/" + haNodeId() + "/identify/config"; }
-static inline String haIdentifyCmdTopic() { return "console/" + haNodeId() + "/identify"; }
-
-static inline String haRebootConfigTopic() { return "homeassistant/button/" + haNodeId() + "/reboot/config"; }
-static inline String haRebootCmdTopic() { return "console/" + haNodeId() + "/reboot"; }
-
-static inline String haCalibrateConfigTopic() { return "homeassistant/button/" + haNodeId() + "/calibrate/config"; }
-static inline String haCalibrateCmdTopic() { return "console/" + haNodeId() + "/calibrate"; }
\ No newline at end of file
+const char *haIdentifyCmdTopic(uint8_t channel = 0);
+const char *haRebootCmdTopic();
+const char *haCalibrateCmdTopic(uint8_t channel = 0);
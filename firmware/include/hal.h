@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin hardware layer under the control loop. hal_esp32.cpp backs it with
+// the Arduino core, src/native/hal_native.cpp with fakes for host builds.
+
+void halBegin();
+
+// Clock
+uint32_t halMillis();
+uint32_t halMicros();
+uint32_t halCycles(); // Free-running CPU cycle counter, wraps
+uint32_t halCyclesPerMicro();
+
+// ADC
+int halAdcRead(uint8_t pin);
+// Starts continuous round-robin sampling of count pins at sampleRateHz each,
+// feeding adcSamplerPush() with the pin's index; false if unsupported
+bool halAdcStreamBegin(const uint8_t *pins, uint8_t count, uint32_t sampleRateHz);
+// Stops and restarts the conversions of a running stream. While paused the
+// stream's own producer polls each pin every pollIntervalMs instead, once
+// the samples converted before the pause have been pushed.
+void halAdcStreamPause(bool paused, uint32_t pollIntervalMs = 0);
+
+// GPIO (true = pin reads HIGH)
+bool halGpioRead(uint8_t pin);
+
+// Encoder detents and button edges are reported from their interrupts with
+// inputIsrTurn() and inputIsrPin() (input_events.h), set up by halBegin()
+
+// While armed, any input pin going LOW wakes the chip from light sleep. The
+// first input interrupt disarms it again.
+void halInputWakeArm(bool armed);
+
+// Task wake-ups: halWaitForWake() blocks the calling task until halWakeTask()
+// is called for it, from any task or interrupt, or timeoutMs passes. A wake
+// that comes before the wait isn't lost.
+void halWakeRegister(uint8_t task);
+void halWaitForWake(uint32_t timeoutMs);
+void halWakeTask(uint8_t task);
+
+// Frequency scaling, plus automatic light sleep whenever every task is
+// blocked and no driver holds the clocks up (the continuous ADC does)
+void halPowerBegin();
+bool halLightSleepAvailable();
+
+// Pixel output, count is at most LED_MAX_PIXELS
+void halPixelsBegin(uint16_t count);
+void halPixelsSet(uint16_t index, uint32_t color);
+void halPixelsShow();
+
+// NVS
+bool halNvsHasKey(const char *key);
+int32_t halNvsGetInt(const char *key, int32_t defaultValue);
+void halNvsPutInt(const char *key, int32_t value);
+uint8_t halNvsGetUChar(const char *key, uint8_t defaultValue);
+void halNvsPutUChar(const char *key, uint8_t value);
+size_t halNvsGetString(const char *key, char *buf, size_t len);
+void halNvsPutString(const char *key, const char *value);
+
+// MQTT
+bool halMqttConnected();
+bool halMqttPublish(const char *topic, const uint8_t *payload, size_t length, bool retain);
+
+// Firmware download, read without blocking
+bool halHttpBegin(const char *url, int32_t &contentLength); // false on connect or HTTP error
+int32_t halHttpRead(uint8_t *buf, size_t len);               // 0 when nothing arrived yet, -1 once closed
+void halHttpEnd();
+
+// Firmware flashing
+bool halOtaBegin(size_t size);
+bool halOtaWrite(const uint8_t *data, size_t len);
+bool halOtaEnd(); // false unless the whole image was written and validated
+void halOtaAbort();
+void halRestart();
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// Encoder and button input. The pin interrupts push timestamped raw edges
+// into lock-free rings, so nothing is lost while a consumer is busy, and the
+// buttons are debounced afterwards from those timestamps without waiting.
+// Each input belongs to one consumer: the WiFi reset button to loop(), the
+// encoder and the other buttons to the control task.
+
+enum class InputSource : uint8_t
+{
+  Encoder = 0,
+  EncoderButton,
+  CalibrateButton,
+  WifiReset,
+  Count
+};
+
+enum class InputType : uint8_t
+{
+  Turn, // One detent, value is -1 or +1
+  Press,
+  Release
+};
+
+enum class InputConsumer : uint8_t
+{
+  Control = 0,
+  Network,
+  Count
+};
+
+struct InputEvent
+{
+  InputSource source;
+  InputType type;
+  int8_t value;
+  uint32_t timeMs;     // When it happened, not when it was read
+  uint32_t intervalMs; // Turns: since the previous detent the same way, UINT32_MAX if none
+};
+
+// Takes the buttons' current levels as their idle state
+void inputBegin();
+
+// Interrupt side, called by the HAL on every encoder detent and button edge
+void inputIsrTurn(int8_t direction, uint32_t timeMs);
+void inputIsrPin(uint8_t pin, bool high, uint32_t timeMs);
+
+// Consumer side: next debounced event in the order they happened, false
+// when there is none yet
+bool inputPoll(InputConsumer consumer, InputEvent &event);
+
+// Time until a bouncing button settles, UINT32_MAX if none is
+uint32_t inputIdleMs(InputConsumer consumer, uint32_t nowMs);
+
+// Steps one detent is worth, more the faster the encoder turns
+uint8_t inputAccelStep(uint32_t intervalMs);
+
+uint32_t inputDropped();
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+#include <effects.h>
+
+// Strip layout: how many pixels are attached and how they split into
+// segments, e.g. "0-59:rainbow,60-179@1". Set at runtime over /set and kept
+// in NVS. "@n" makes a segment part of console channel n's zone (default 0).
+// A segment without its own effect follows the global one; pixels outside
+// every segment stay dark. An empty layout splits the strip evenly, one
+// segment per channel.
+struct LedSegment
+{
+  uint16_t start;
+  uint16_t length;
+  Effect effect;
+  bool ownEffect;
+  uint8_t channel;
+};
+
+constexpr size_t LED_LAYOUT_TEXT_LEN = 128;
+
+// Loads the layout and sizes the framebuffer and output for it
+void segmentsBegin();
+// layout nullptr keeps the current one. Invalid combinations change nothing.
+bool segmentsConfigure(uint16_t pixelCount, const char *layout);
+bool segmentsParse(const char *layout, uint16_t pixelCount, LedSegment *out, uint8_t &count);
+
+uint16_t segmentsPixelCount();
+uint8_t segmentsCount();
+const LedSegment &segmentAt(uint8_t index);
+const char *segmentsLayout();
+
+// Bumped on every change, so the renderer knows to redraw everything
+uint32_t segmentsGeneration();
+
+// pixels, segments and framebuffer bytes for the configured length
+void segmentsToJson(JsonObject obj);
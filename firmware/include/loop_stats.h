@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+// Per-stage loop timing. Each stage is timed with the CPU cycle counter and
+// binned into a log2 histogram, so recording costs a couple of instructions.
+enum class LoopTask : uint8_t
+{
+  Network = 0,
+  Control,
+  Count
+};
+
+// Stages up to Ota run in the network task, the rest in the control task
+enum class LoopStage : uint8_t
+{
+  Wifi = 0,
+  NetInit,
+  Mqtt,
+  Ota,
+  Input,
+  Adc,
+  Led,
+  Count
+};
+
+// Call at the top of each task iteration, then loopStatsMark() after each
+// stage. Marks for the same stage within one iteration are summed.
+void loopStatsBegin(LoopTask task);
+void loopStatsMark(LoopStage stage);
+void loopStatsEnd(LoopTask task);
+
+// p50/p99/max (µs) and sample count per stage plus each task's iteration
+void loopStatsToJson(JsonDocument &doc);
+void loopStatsReset();
+
+const char *loopStageName(uint8_t stage);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+// Table-driven MQTT command dispatch. Topics are matched on the suffix after
+// the device prefix ("console/<node>/"); the payload is only parsed once a
+// handler has been found, and only as far as the handler asks for. Commands
+// marked per channel are also matched under "ch<n>/" for console channels
+// other than 0.
+enum class MqttPayload : uint8_t
+{
+  None, // Button presses, payload ignored
+  Int,    // Plain decimal number
+  Json,   // Parsed through the handler's filter
+  MsgPack // Same, from MessagePack
+};
+
+struct MqttMessage
+{
+  JsonVariantConst json;
+  int32_t value;
+  uint8_t channel;
+};
+
+struct MqttCommand
+{
+  const char *suffix;
+  MqttPayload payload;
+  const char *filter; // JSON filter for MqttPayload::Json, nullptr keeps everything
+  void (*handler)(const MqttMessage &msg);
+  bool perChannel;
+};
+
+static constexpr uint8_t MQTT_DISPATCH_MAX_COMMANDS = 8;
+
+// One dispatcher per task that handles commands
+struct MqttDispatcher
+{
+  const char *prefix = "";
+  size_t prefixLen = 0;
+  const MqttCommand *commands = nullptr;
+  uint8_t count = 0;
+
+  JsonDocument filters[MQTT_DISPATCH_MAX_COMMANDS];
+  uint32_t calls[MQTT_DISPATCH_MAX_COMMANDS] = {};
+  uint32_t maxCycles[MQTT_DISPATCH_MAX_COMMANDS] = {};
+  uint32_t rejected = 0;
+};
+
+// Table must outlive the dispatcher (normally a static const array)
+void mqttDispatchBegin(MqttDispatcher &d, const char *prefix, const MqttCommand *commands, uint8_t count);
+
+// True if the topic belongs to one of this dispatcher's commands
+bool mqttDispatchHandles(const MqttDispatcher &d, const char *topic);
+
+// Returns false when the topic is unknown or the payload doesn't parse
+bool mqttDispatch(MqttDispatcher &d, const char *topic, const uint8_t *payload, size_t length);
+
+// Per-command call count and max handling time (µs), plus rejected messages.
+// Several dispatchers can write into the same object.
+void mqttDispatchStatsToJson(const MqttDispatcher &d, JsonObject out);
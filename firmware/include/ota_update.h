@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// Firmware update over HTTP, driven a few chunks at a time from the network
+// loop. The image is hashed while it's written and progress and outcome go
+// to the fw-update/status topic.
+enum class OtaState : uint8_t
+{
+  Idle,
+  Downloading,
+  Rebooting,
+  Failed
+};
+
+// sha256Hex is optional; when given the image must match it to be booted
+bool otaUpdateStart(const char *url, const char *sha256Hex);
+void otaUpdateLoop();
+
+OtaState otaUpdateState();
@@ -1,7 +1,10 @@
 #pragma once
 
-// Current Sensing
-constexpr uint8_t CURRENT_SENSE_PIN = 0;
+#include <stdint.h>
+
+// Current Sensing, one ADC1 input per console channel
+constexpr uint8_t CURRENT_SENSE_PINS[] = {0, 2, 4};
+constexpr uint8_t CURRENT_SENSE_PIN = CURRENT_SENSE_PINS[0];
 constexpr uint8_t POWER_CALIBRATE_PIN = 1;
 
 // LED
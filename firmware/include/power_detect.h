@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <config.h>
+#include <power_filter.h>
+
+// Filter stage in front of the hysteresis, selectable at build time, e.g.
+// -D 'POWER_FILTER=IirFilter<4>' or -D 'POWER_FILTER=MedianFilter<5>'
+#ifndef POWER_FILTER
+#define POWER_FILTER RmsFilter<POWER_RMS_WINDOW>
+#endif
+
+using PowerFilter = POWER_FILTER;
+
+// Console power detection: filtered level, hysteresis around the calibrated
+// baseline and a delay before reporting OFF
+struct PowerDetector
+{
+  PowerFilter filter;
+  bool powered = false;
+  uint32_t powerOffTime = 0;
+  int level = 0;
+};
+
+// Feed one ADC sample, returns the (possibly updated) power state
+bool powerDetectUpdate(PowerDetector &det, int adc, int threshold, int offset, uint32_t nowMs);
+
+// Level the detector has to fall below to report OFF
+static inline int powerOffThreshold(int threshold, int offset)
+{
+  return PowerFilter::offLevel(threshold, offset);
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+
+// Filter stages for the power detector. Each takes one raw ADC sample and the
+// calibrated baseline and returns a level on the same scale as the
+// thresholds, in constant time per sample. offLevel() gives the level the
+// filter has to drop below before the console counts as off.
+
+// Integer square root, fixed 16 iterations
+static inline uint32_t isqrt32(uint32_t v)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > v)
+    bit >>= 2;
+  while (bit)
+  {
+    if (v >= root + bit)
+    {
+      v -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+// RMS of the deviation from the baseline over the last N samples, reported as
+// baseline + rms so an AC-coupled signal crosses TH_ON when its amplitude does.
+// The level never drops below the baseline, so OFF is at half the offset.
+template <uint16_t N>
+class RmsFilter
+{
+public:
+  static int offLevel(int threshold, int offset) { return threshold + offset / 2; }
+
+  int update(int sample, int baseline)
+  {
+    if (baseline != lastBaseline)
+      reset(baseline);
+
+    int32_t dev = sample - baseline;
+    uint32_t sq = (uint32_t)(dev * dev);
+
+    sum -= window[pos];
+    sum += sq;
+    window[pos] = sq;
+    pos = (pos + 1) % N;
+    if (filled < N)
+      filled++;
+
+    return baseline + (int)isqrt32((uint32_t)(sum / filled));
+  }
+
+  void reset(int baseline)
+  {
+    for (uint16_t i = 0; i < N; ++i)
+      window[i] = 0;
+    sum = 0;
+    pos = 0;
+    filled = 0;
+    lastBaseline = baseline;
+  }
+
+private:
+  uint32_t window[N] = {};
+  uint64_t sum = 0;
+  uint16_t pos = 0;
+  uint16_t filled = 0;
+  int lastBaseline = 0;
+};
+
+// Single-pole low-pass in 16.16 fixed point: y += (x - y) / 2^SHIFT
+template <uint8_t SHIFT>
+class IirFilter
+{
+public:
+  static int offLevel(int threshold, int offset) { return threshold - offset; }
+  int update(int sample, int)
+  {
+    if (!primed)
+    {
+      acc = (int32_t)sample << 16;
+      primed = true;
+    }
+    acc += (((int32_t)sample << 16) - acc) >> SHIFT;
+    return (int)(acc >> 16);
+  }
+
+  void reset(int) { primed = false; }
+
+private:
+  int32_t acc = 0;
+  bool primed = false;
+};
+
+// Median of the last N samples (N small and odd), rejects single spikes
+template <uint8_t N>
+class MedianFilter
+{
+  static_assert(N % 2 == 1, "MedianFilter needs an odd window");
+
+public:
+  static int offLevel(int threshold, int offset) { return threshold - offset; }
+  int update(int sample, int)
+  {
+    window[pos] = (int16_t)sample;
+    pos = (pos + 1) % N;
+    if (filled < N)
+      filled++;
+
+    int16_t sorted[N];
+    for (uint8_t i = 0; i < filled; ++i)
+    {
+      int16_t v = window[i];
+      uint8_t j = i;
+      for (; j > 0 && sorted[j - 1] > v; --j)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = v;
+    }
+    return sorted[filled / 2];
+  }
+
+  void reset(int)
+  {
+    pos = 0;
+    filled = 0;
+  }
+
+private:
+  int16_t window[N] = {};
+  uint8_t pos = 0;
+  uint8_t filled = 0;
+};
+
+// Raw sample, i.e. the original single-sample hysteresis
+class PassthroughFilter
+{
+public:
+  static int offLevel(int threshold, int offset) { return threshold - offset; }
+  int update(int sample, int) { return sample; }
+  void reset(int) {}
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+#include <loop_stats.h>
+
+// Both tasks sleep between events instead of polling. A task blocks in
+// schedulerWait() until its next deadline or until schedulerWake() is called
+// for it: by an input interrupt, a finished ADC frame, a message from the
+// other task or a WiFi event. While both are blocked the chip is free to
+// enter light sleep (halPowerBegin()).
+enum class WakeReason : uint8_t
+{
+  Timer = 0,
+  Input,
+  Adc,
+  Message,
+  Network,
+  Count
+};
+
+// Once, from the task itself, before anything can wake it
+void schedulerBegin(LoopTask task);
+
+// Safe from interrupts and from either task
+void schedulerWake(LoopTask task, WakeReason reason);
+
+// Blocks for up to timeoutMs unless a wake is already pending, returns the
+// first reason it was woken for
+WakeReason schedulerWait(LoopTask task, uint32_t timeoutMs);
+
+// Wake counts per reason and time asleep since the last reset
+void schedulerToJson(JsonDocument &doc);
+void schedulerReset();
@@ -1,4 +1,6 @@
 #pragma once
+
+#ifdef ARDUINO
 #include <Arduino.h>
 #include <HardwareSerial.h>
 
@@ -49,3 +51,34 @@ void SerialBegin(unsigned long baud);
 // Use in YOUR files to make every Serial.* print go to both ports.
 #define Serial DebugSerial
 #define Serial0 DebugSerial
+
+#else
+#include <stdint.h>
+#include <stdio.h>
+
+// Native build: the same print API, written to stdout
+class SerialMirror
+{
+public:
+  size_t write(const uint8_t *buf, size_t len) { return fwrite(buf, 1, len, stdout); }
+  void print(const char *s) { fputs(s, stdout); }
+  void print(char c) { fputc(c, stdout); }
+  void print(int v) { ::printf("%d", v); }
+  void print(unsigned v) { ::printf("%u", v); }
+  void print(long v) { ::printf("%ld", v); }
+  void print(unsigned long v) { ::printf("%lu", v); }
+  template <typename T>
+  void println(T v)
+  {
+    print(v);
+    println();
+  }
+  void println() { fputc('\n', stdout); }
+  template <typename... Args>
+  void printf(const char *fmt, Args... args) { ::printf(fmt, args...); }
+};
+
+extern SerialMirror DebugSerial;
+
+#define Serial DebugSerial
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Write-back cache in front of NVS. Puts only update RAM and mark the key
+// dirty; settingsLoop() commits once writes have been idle for
+// SETTINGS_COMMIT_DELAY (or SETTINGS_COMMIT_MAX_DELAY after the first pending
+// write). Call settingsCommit() before rebooting or flashing.
+//
+// The cache belongs to the control task. Other tasks must not touch it
+// directly. They call settingsRequestCommit() and wait for
+// settingsCommitPending() to clear.
+
+bool settingsHasKey(const char *key);
+int32_t settingsGetInt(const char *key, int32_t defaultValue);
+uint8_t settingsGetUChar(const char *key, uint8_t defaultValue);
+size_t settingsGetString(const char *key, char *buf, size_t len);
+
+void settingsPutInt(const char *key, int32_t value);
+void settingsPutUChar(const char *key, uint8_t value);
+void settingsPutString(const char *key, const char *value);
+
+void settingsLoop();
+uint32_t settingsIdleMs(uint32_t nowMs); // Until the next commit is due, UINT32_MAX if nothing is dirty
+void settingsCommit();
+
+void settingsRequestCommit();
+bool settingsCommitPending();
+
+// Puts requested vs. flash writes actually made
+uint32_t settingsWritesRequested();
+uint32_t settingsWritesCommitted();
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental SHA-256, fed chunk by chunk as firmware is downloaded
+struct Sha256
+{
+  uint32_t state[8];
+  uint64_t length = 0; // Bytes hashed so far
+  uint8_t block[64];
+  uint8_t blockLen = 0;
+};
+
+constexpr size_t SHA256_DIGEST_LEN = 32;
+
+void sha256Begin(Sha256 &ctx);
+void sha256Update(Sha256 &ctx, const uint8_t *data, size_t len);
+void sha256Finish(Sha256 &ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+
+// Parses 64 hex characters, false if malformed
+bool sha256FromHex(const char *hex, uint8_t digest[SHA256_DIGEST_LEN]);
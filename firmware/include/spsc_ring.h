@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring. One side may only push,
+// the other only pop; N must be a power of two.
+template <typename T, size_t N>
+class SpscRing
+{
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+  bool push(const T &value)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N)
+      return false;
+
+    items[h & (N - 1)] = value;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+
+    value = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T items[N];
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+};
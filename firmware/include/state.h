@@ -1,7 +1,10 @@
 #pragma once
 
-#include <Adafruit_NeoPixel.h>
-#include <Preferences.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <config.h>
 
 enum class ColorMode : uint8_t
 {
@@ -9,24 +12,63 @@ enum class ColorMode : uint8_t
   Custom = 1
 };
 
-extern Adafruit_NeoPixel strip;
-extern Preferences prefs;
+enum class Effect : uint8_t;
+
+// Encodings of console/<node>/state, JSON unless a board is switched over
+enum class StateEncoding : uint8_t
+{
+  Json = 1 << 0,
+  MsgPack = 1 << 1,
+  Both = Json | MsgPack
+};
+
+// Valid encodings are 1..STATE_ENCODING_MAX
+constexpr uint8_t STATE_ENCODING_MAX = static_cast<uint8_t>(StateEncoding::Both);
+
+inline bool stateEncodingHas(StateEncoding encoding, StateEncoding part)
+{
+  return static_cast<uint8_t>(encoding) & static_cast<uint8_t>(part);
+}
 
-extern uint8_t currentColorIndex;
-extern uint32_t customColor;
-extern ColorMode colorMode;
+constexpr size_t DEVICE_NAME_MAX_LEN = 32;
+
+// One watched console: its power sensing and the color of its LED zone
+struct ChannelState
+{
+  bool ledEnabled;
+  ColorMode colorMode;
+  uint8_t colorIndex;
+  uint32_t customColor;
+  int threshold;
+  int thresholdOffset;
+  int adcLevel; // Last filtered current sense level, for telemetry
+};
+
+extern ChannelState channels[CONSOLE_CHANNELS];
+
+// Brightness, effect and the rest apply to the whole board
 extern uint8_t currentBrightness;
-extern bool ledEnabled;
+extern Effect currentEffect;
+extern bool inBrightnessMode;
 extern time_t bootTime;
-extern String deviceName;
-extern int currentThreshold;
-extern int currentThresholdOffset;
+extern char deviceName[DEVICE_NAME_MAX_LEN + 1];
+extern bool autoCalibrate;
+extern StateEncoding stateEncoding;
 
 // From colors.h
 extern const uint32_t colors[];
 extern const uint8_t NUM_COLORS;
 
-// LED helpers
-void updateLED(bool force = false);
-void fadeToColor(uint32_t targetColor, uint8_t steps = 50, uint16_t delayMs = 25);
-void blinkConfirm(uint32_t color, int times);
\ No newline at end of file
+// Palette or custom color of a channel
+uint32_t channelColor(const ChannelState &channel);
+
+// LED helpers, each channel animates its own zone
+void updateLED(uint8_t channel, bool force = false);
+void updateAllLEDs(bool force = false);
+void fadeToColor(uint8_t channel, uint32_t targetColor, uint8_t steps = 50, uint16_t delayMs = 25);
+void blinkConfirm(uint8_t channel, uint32_t color, int times);
+void blinkSequence(uint8_t channel, uint32_t color, uint32_t baseColor, int times, uint16_t fadeMs, uint16_t holdMs);
+void ledTick();
+uint32_t ledIdleMs(uint32_t nowMs); // Until the next frame is due, UINT32_MAX while nothing moves
+void ledSetBrightness(uint8_t brightness);
+bool ledAnimating();
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+#include <state_publish.h>
+
+// Payloads of the retained state topics, kept apart from the MQTT client so
+// host tools build exactly the documents the board publishes. The MessagePack
+// state is the same document as the JSON one.
+
+// console/<node>/state
+void stateToJson(const StateSnapshot &s, JsonDocument &doc);
+// Home Assistant light state of one channel
+void lightStateToJson(const StateSnapshot &s, uint8_t channel, JsonDocument &doc);
+
+// "json", "msgpack" or "both"
+const char *stateEncodingName(StateEncoding encoding);
+bool stateEncodingFromName(const char *name, StateEncoding &encoding);
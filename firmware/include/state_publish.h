@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <state.h>
+#include <effects.h>
+
+// Coalesced, delta-based state publishing. Change paths in the control task
+// call statePublishMark(); after STATE_PUBLISH_COALESCE ms statePublishLoop()
+// snapshots the state and queues it for the network task, where
+// statePublishDrain() republishes only the topics whose fields differ from
+// what was last sent. Channel fields are compared per channel, so one
+// console turning on only republishes its own light and threshold topics.
+enum StateField : uint16_t
+{
+  FieldEnabled = 1 << 0,
+  FieldBrightness = 1 << 1,
+  FieldColor = 1 << 2,
+  FieldName = 1 << 3,
+  FieldBaseline = 1 << 4,
+  FieldOffset = 1 << 5,
+  FieldAutoCalibrate = 1 << 6,
+  FieldBootTime = 1 << 7,
+  FieldEffect = 1 << 8,
+  FieldEncoding = 1 << 9,
+  FieldAll = 0x3FF
+};
+
+// FieldEnabled, FieldColor, FieldBaseline and FieldOffset
+struct ChannelSnapshot
+{
+  bool enabled;
+  ColorMode colorMode;
+  uint8_t colorIndex;
+  uint32_t customColor;
+  int baseline;
+  int offset;
+  int level; // Reported, but never a reason to publish on its own
+};
+
+struct StateSnapshot
+{
+  ChannelSnapshot channels[CONSOLE_CHANNELS];
+  uint8_t brightness;
+  Effect effect;
+  char name[DEVICE_NAME_MAX_LEN + 1];
+  bool autoCalibrate;
+  StateEncoding encoding;
+  time_t bootTime;
+  uint16_t forced;
+};
+
+// Topics that depend on each field group
+constexpr uint16_t DEVICE_STATE_FIELDS = FieldAll;
+constexpr uint16_t LIGHT_STATE_FIELDS = FieldEnabled | FieldBrightness | FieldColor | FieldEffect;
+constexpr uint16_t THRESHOLD_FIELDS = FieldBaseline | FieldOffset;
+
+// Fields that differ from what was last published, plus the forced ones.
+// Each channel's fields include the board-wide ones.
+struct StateDelta
+{
+  uint16_t boardFields;
+  uint16_t channelFields[CONSOLE_CHANNELS];
+  uint16_t anyChannelFields;
+};
+
+StateDelta stateDelta(const StateSnapshot &latest, const StateSnapshot &published, uint16_t forced);
+
+// Control task: forceFields are republished even if unchanged (e.g. to snap
+// HA back)
+void statePublishMark(uint16_t forceFields = 0);
+void statePublishLoop();
+uint32_t statePublishIdleMs(uint32_t nowMs); // Until marked changes go out, UINT32_MAX if none
+
+// Network task: republish everything on the next drain, after (re)connecting
+void statePublishAll();
+void statePublishDrain();
+
+// Retained messages sent so far
+uint32_t statePublishCount();
+
+// Payloads, built by the network layer. clearUnused also empties the retained
+// state topic of the encoding the board isn't using.
+void publishState(const StateSnapshot &s, bool clearUnused);
+void publishHALightState(const StateSnapshot &s, uint8_t channel);
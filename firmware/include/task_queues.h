@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <adc_trace.h>
+#include <state.h>
+
+// Bounded queues between the control task (sensing, input, LEDs) and the
+// network task (WiFi, MQTT, OTA). Each queue has exactly one producer and
+// one consumer; a full queue drops the new item and counts it.
+
+static constexpr size_t CONTROL_COMMAND_TOPIC_MAX = 64;
+static constexpr size_t CONTROL_COMMAND_PAYLOAD_MAX = 1024; // Any payload that fits MQTT_MAX_PACKET_SIZE
+
+// MQTT command for the control task (network -> control)
+struct ControlCommand
+{
+  char topic[CONTROL_COMMAND_TOPIC_MAX];
+  uint16_t length;
+  uint8_t payload[CONTROL_COMMAND_PAYLOAD_MAX];
+};
+
+bool controlCommandPush(const char *topic, const uint8_t *payload, size_t length);
+bool controlCommandPop(ControlCommand &out);
+
+// Encoded ADC trace frame for MQTT (control -> network)
+struct TraceFrameMessage
+{
+  uint16_t length;
+  uint8_t data[ADC_TRACE_MAX_FRAME];
+};
+
+bool traceFramePush(const uint8_t *frame, size_t length);
+bool traceFramePop(TraceFrameMessage &out);
+
+// New device name for Home Assistant discovery (control -> network)
+struct DiscoveryNameMessage
+{
+  char name[DEVICE_NAME_MAX_LEN + 1];
+};
+
+bool discoveryNamePush(const char *name);
+bool discoveryNamePop(DiscoveryNameMessage &out);
+
+uint32_t taskQueuesDropped();
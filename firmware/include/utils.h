@@ -1,17 +1,21 @@
 #pragma once
 
+#include <stdint.h>
+#include <time.h>
+
+#ifdef ARDUINO
 #include <Arduino.h>
 
 String getMacSuffix();
 time_t getSyncedUnixTime(uint32_t timeoutMs = 5000);
-
-// ADC-related
-int readAdcAverage(uint8_t pin, int samples = 64);
+String toLower(String s);
+#endif
 
 // Color-related
 enum class ColorMode : uint8_t;
 const char *colorModeToString(ColorMode mode);
-uint8_t lerpColorComponent(uint8_t from, uint8_t to, uint8_t step, uint8_t maxStep);
 void rgbFrom24(uint32_t color, uint8_t &r, uint8_t &g, uint8_t &b);
+int clampInt(int value, int lo, int hi);
 
-String toLower(String s);
\ No newline at end of file
+// Time left until dueMs, 0 once it has passed
+uint32_t msUntil(uint32_t dueMs, uint32_t nowMs);
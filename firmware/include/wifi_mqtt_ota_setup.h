@@ -1,14 +1,20 @@
 #pragma once
 
-#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#include <Preferences.h>
+// Forward declared so the control loop can include this on the native target
+class String;
+class Preferences;
+
+extern Preferences prefs;
 
 void wifiKickoff(const String &apName, Preferences &prefs);
 void wifiProcess(Preferences &prefs);
 bool wifiIsConnected();
 void maybeInitNetServices(Preferences &prefs);
 void handleMqttLoop();
-void publishState();
-void publishHAState();
-void reopenConfigPortal(const String &apName);
\ No newline at end of file
+void reopenConfigPortal(const String &apName);
+
+// How long loop() can sleep before the network needs servicing again
+uint32_t networkIdleMs();
@@ -13,7 +13,7 @@ with open(input_file, newline="") as f:
         r, g, b = map(int, row[:3])
         name = row[3] if len(row) > 3 else ""
         comment = f" // {name}" if name else ""
-        rows.append(f"    Adafruit_NeoPixel::Color({r}, {g}, {b}),{comment}")
+        rows.append(f"    0x{r:02X}{g:02X}{b:02X},{comment}")
 
 # Header: declarations only
 hdr = textwrap.dedent(
@@ -29,7 +29,6 @@ hdr = textwrap.dedent(
 # CPP: single definition with array contents
 cpp = "\n".join(
     [
-        "#include <Adafruit_NeoPixel.h>",
         '#include "colors.h"',
         "",
         "const uint32_t colors[] = {",
@@ -0,0 +1,251 @@
+import json, os, re, sys
+
+config_path = "firmware/include/config.h"
+loop_stats_path = "firmware/src/loop_stats.cpp"
+effects_path = "firmware/src/effects.cpp"
+cpp_path = "firmware/src/ha_discovery_data.cpp"
+
+# {node}, {mac} and {name} are filled in on the device, see ha_discovery.cpp. Per
+# channel entities also get {ch} (topic level), {chid} (id suffix) and {chn}
+# (name suffix), all empty for channel 0.
+NODE = "{node}"
+CH = "{ch}"
+CHID = "{chid}"
+CHN = "{chn}"
+DEVICE = {"ids": [f"console_{NODE}"]}
+
+
+# Device details come from config.h so there is one place to bump the version
+def read_config_string(name):
+    with open(config_path) as f:
+        match = re.search(rf'{name}\s*=\s*"([^"]*)"', f.read())
+    if not match:
+        raise SystemExit(f"{name} not found in {config_path}")
+    return match.group(1)
+
+
+def read_loop_stages():
+    with open(loop_stats_path) as f:
+        match = re.search(r"STAGE_NAMES\[[^\]]*\]\s*=\s*\{([^}]*)\}", f.read())
+    if not match:
+        raise SystemExit(f"STAGE_NAMES not found in {loop_stats_path}")
+    return re.findall(r'"([^"]+)"', match.group(1))
+
+
+def read_effects():
+    with open(effects_path) as f:
+        match = re.search(r"EFFECT_NAMES\[[^\]]*\]\s*=\s*\{([^}]*)\}", f.read())
+    if not match:
+        raise SystemExit(f"EFFECT_NAMES not found in {effects_path}")
+    return re.findall(r'"([^"]+)"', match.group(1))
+
+
+def config_topic(component, object_id=None, suffix=""):
+    if object_id:
+        return f"homeassistant/{component}/{NODE}/{object_id}{suffix}/config"
+    return f"homeassistant/{component}/{NODE}{suffix}/config"
+
+
+def state_topic(suffix):
+    return f"console/{NODE}/{suffix}"
+
+
+# (topic, payload, per_channel)
+entities = []
+
+# Light (main controllable entity), one per console channel
+entities.append(
+    (
+        config_topic("light", suffix=CHID),
+        {
+            "name": f"Console LED Strip{CHN}",
+            "uniq_id": f"{NODE}{CHID}",
+            "cmd_t": state_topic(f"{CH}ha/set"),
+            "stat_t": state_topic(f"{CH}ha/state"),
+            "avty_t": state_topic("status"),
+            "pl_avail": "1",
+            "pl_not_avail": "0",
+            "schema": "json",
+            "color_mode": True,
+            "optimistic": False,
+            "icon": "mdi:led-strip",
+            "supported_color_modes": ["rgb"],
+            "effect": True,
+            "effect_list": read_effects(),
+            "device": {
+                **DEVICE,
+                "name": "{name}",
+                "mf": read_config_string("HA_DEVICE_MANUFACTURER"),
+                "mdl": read_config_string("HA_DEVICE_MODEL"),
+                "sw": read_config_string("HA_DEVICE_FW_VERSION"),
+            },
+        },
+        True,
+    )
+)
+
+# Buttons (stateless actions)
+for object_id, name, icon, per_channel in [
+    ("identify", "Identify", "mdi:magnify", True),
+    ("reboot", "Reboot", "mdi:reload", False),
+    ("calibrate", "Start Calibration", "mdi:lightning-bolt", True),
+]:
+    ch, chid, chn = (CH, CHID, CHN) if per_channel else ("", "", "")
+    entities.append(
+        (
+            config_topic("button", object_id, chid),
+            {
+                "name": f"{name}{chn}",
+                "uniq_id": f"{NODE}_{object_id}{chid}",
+                "cmd_t": state_topic(f"{ch}{object_id}"),
+                "payload_press": "1",
+                "icon": icon,
+                "device": DEVICE,
+            },
+            per_channel,
+        )
+    )
+
+# Number (Offset)
+entities.append(
+    (
+        config_topic("number", "offset", CHID),
+        {
+            "name": f"Threshold offset{CHN}",
+            "uniq_id": f"{NODE}_offset{CHID}",
+            "cmd_t": state_topic(f"{CH}offset/set"),
+            "stat_t": state_topic(f"{CH}offset/state"),
+            "mode": "box",
+            "min": 0,
+            "max": 5000,
+            "step": 1,
+            "entity_category": "config",
+            "icon": "mdi:arrow-expand-horizontal",
+            "device": DEVICE,
+        },
+        True,
+    )
+)
+
+# Sensors (read-only)
+for object_id, name in [
+    ("threshold", "Baseline"),
+    ("th_on", "Threshold (on)"),
+    ("th_off", "Threshold (off)"),
+]:
+    entities.append(
+        (
+            config_topic("sensor", object_id, CHID),
+            {
+                "name": f"{name}{CHN}",
+                "uniq_id": f"{NODE}_{object_id}{CHID}",
+                "stat_t": state_topic(f"{CH}{object_id}/state"),
+                "entity_category": "diagnostic",
+                "device": DEVICE,
+            },
+            True,
+        )
+    )
+
+# Loop timing (p99 per stage, read from the diagnostics topic)
+for stage in read_loop_stages():
+    entities.append(
+        (
+            config_topic("sensor", f"loop_{stage}"),
+            {
+                "name": f"Loop {stage} p99",
+                "uniq_id": f"{NODE}_loop_{stage}",
+                "stat_t": state_topic("diag/loop"),
+                "val_tpl": f"{{{{ value_json.{stage}.p99 | default(0) }}}}",
+                "unit_of_meas": "µs",
+                "entity_category": "diagnostic",
+                "device": DEVICE,
+            },
+            False,
+        )
+    )
+
+# LED frame cost (render plus output, averaged over the diagnostics window)
+entities.append(
+    (
+        config_topic("sensor", "led_frame"),
+        {
+            "name": "LED frame avg",
+            "uniq_id": f"{NODE}_led_frame",
+            "stat_t": state_topic("diag/loop"),
+            "val_tpl": "{{ value_json.frame.avg_us | default(0) }}",
+            "unit_of_meas": "µs",
+            "entity_category": "diagnostic",
+            "device": DEVICE,
+        },
+        False,
+    )
+)
+
+# Entities the firmware no longer has. Their retained configs are cleared on
+# the broker so Home Assistant drops them from existing installs.
+retired = [
+    config_topic("sensor", "loop_buttons"),
+    config_topic("sensor", "loop_encoder"),
+]
+
+
+def fnv1a(data, h=0x811C9DC5):
+    for byte in data:
+        h ^= byte
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def c_string(text):
+    out = text.replace("\\", "\\\\").replace('"', '\\"')
+    return f'"{out}"'
+
+
+rows = []
+digest = 0x811C9DC5
+for topic, payload, per_channel in entities:
+    body = json.dumps(payload, separators=(",", ":"), ensure_ascii=False)
+    digest = fnv1a(topic.encode() + b"\0" + body.encode() + b"\0" + bytes([per_channel]), digest)
+    flag = "true" if per_channel else "false"
+    rows.append(f"    {{{c_string(topic)},\n     {c_string(body)},\n     {flag}}},")
+
+retired_rows = []
+for topic in retired:
+    digest = fnv1a(topic.encode() + b"\0", digest)
+    retired_rows.append(f"    {c_string(topic)},")
+
+cpp = "\n".join(
+    [
+        "// Generated by firmware/scripts/generate_ha_discovery.py, do not edit",
+        '#include "ha_discovery.h"',
+        "",
+        "const HaDiscoveryEntry haDiscoveryEntries[] = {",
+        *rows,
+        "};",
+        "",
+        "const uint8_t HA_DISCOVERY_COUNT = sizeof(haDiscoveryEntries) / sizeof(haDiscoveryEntries[0]);",
+        "",
+        "const char *const haDiscoveryRetired[] = {",
+        *retired_rows,
+        "};",
+        "",
+        "const uint8_t HA_DISCOVERY_RETIRED_COUNT = sizeof(haDiscoveryRetired) / sizeof(haDiscoveryRetired[0]);",
+        f"const uint32_t HA_DISCOVERY_HASH = 0x{digest:08X};",
+        "",
+    ]
+)
+
+# --check only compares, for CI: the checked-in file must match the sources
+if "--check" in sys.argv[1:]:
+    current = open(cpp_path).read() if os.path.exists(cpp_path) else ""
+    if current != cpp:
+        raise SystemExit(f"{cpp_path} is out of date, run {sys.argv[0]} and commit the result")
+    print(f"{cpp_path} is up to date.")
+    sys.exit(0)
+
+os.makedirs(os.path.dirname(cpp_path), exist_ok=True)
+with open(cpp_path, "w") as f:
+    f.write(cpp)
+
+print(f"Wrote {cpp_path} with {len(rows)} discovery messages.")
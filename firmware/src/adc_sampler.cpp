@@ -0,0 +1,103 @@
+#include <adc_sampler.h>
+#include <spsc_ring.h>
+#include <config.h>
+#include <hal.h>
+#include <serial_mux.h>
+#include <utils.h>
+
+static_assert(CONSOLE_CHANNELS >= 1 && CONSOLE_CHANNELS <= 16, "channel must fit in the sample tag");
+
+// Room for ADC_RING_SIZE samples per channel, rounded up to a power of two
+static constexpr size_t ringSize(size_t n)
+{
+  return n >= (size_t)ADC_RING_SIZE * CONSOLE_CHANNELS ? n : ringSize(n * 2);
+}
+
+static SpscRing<uint16_t, ringSize(ADC_RING_SIZE)> ring;
+static std::atomic<uint32_t> dropped{0};
+static uint8_t samplePins[CONSOLE_CHANNELS] = {};
+static uint8_t pinCount = 0;
+static uint32_t sampleRate = 0;
+static bool continuous = false;
+static std::atomic<bool> standby{false};
+static uint32_t lastPoll = 0;
+
+void adcSamplerBegin(const uint8_t *pins, uint8_t count, uint32_t sampleRateHz)
+{
+  pinCount = count < CONSOLE_CHANNELS ? count : CONSOLE_CHANNELS;
+  for (uint8_t i = 0; i < pinCount; ++i)
+    samplePins[i] = pins[i];
+  sampleRate = sampleRateHz;
+  continuous = halAdcStreamBegin(samplePins, pinCount, sampleRateHz);
+
+  Serial.println();
+  if (continuous)
+    Serial.printf("ADC sampling %u channel(s) at %lu Hz each (continuous)\n", pinCount, (unsigned long)sampleRateHz);
+  else
+    Serial.println("Continuous ADC unavailable. Sampling once per loop");
+}
+
+bool adcSamplerPush(uint8_t channel, uint16_t sample)
+{
+  if (ring.push((uint16_t)(channel << 12 | (sample & 0x0FFF))))
+    return true;
+
+  dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return false;
+}
+
+size_t adcSamplerRead(uint16_t *out, size_t max)
+{
+  size_t n = 0;
+  while (n < max && ring.pop(out[n]))
+    n++;
+  return n;
+}
+
+// Without the stream, samples are taken at this period
+static uint32_t pollInterval()
+{
+  return standby.load() ? ADC_STANDBY_INTERVAL : CONTROL_TASK_PERIOD_MS;
+}
+
+void adcSamplerPoll()
+{
+  if (continuous)
+    return;
+
+  uint32_t now = halMillis();
+  if (now - lastPoll < pollInterval())
+    return;
+  lastPoll = now;
+
+  for (uint8_t i = 0; i < pinCount; ++i)
+    adcSamplerPush(i, halAdcRead(samplePins[i]));
+}
+
+void adcSamplerSetStandby(bool on)
+{
+  if (on == standby.load())
+    return;
+
+  standby.store(on);
+  lastPoll = halMillis() - ADC_STANDBY_INTERVAL;
+  if (continuous)
+    halAdcStreamPause(on, ADC_STANDBY_INTERVAL);
+  Serial.println(on ? "ADC standby: consoles off, polling slowly" : "ADC standby left");
+}
+
+bool adcSamplerStandby() { return standby.load(); }
+
+uint32_t adcSamplerIdleMs(uint32_t nowMs)
+{
+  return continuous ? UINT32_MAX : msUntil(lastPoll + pollInterval(), nowMs);
+}
+
+bool adcSamplerContinuous() { return continuous; }
+
+uint32_t adcSamplerRate()
+{
+  return continuous && !standby.load() ? sampleRate : 1000 / pollInterval();
+}
+
+uint32_t adcSamplerDropped() { return dropped.load(std::memory_order_relaxed); }
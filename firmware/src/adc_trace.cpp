@@ -0,0 +1,90 @@
+#include <adc_trace.h>
+
+static uint16_t crc16(const uint8_t *data, size_t length)
+{
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; ++i)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t b = 0; b < 8; ++b)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static inline void putU16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static inline uint16_t getU16(const uint8_t *p)
+{
+  return p[0] | (uint16_t)p[1] << 8;
+}
+
+size_t adcTraceEncode(const AdcTraceFrame &frame, uint8_t *out, size_t capacity)
+{
+  size_t length = ADC_TRACE_HEADER_SIZE + frame.count * 2 + 2;
+  if (frame.count > ADC_TRACE_MAX_SAMPLES || capacity < length)
+    return 0;
+
+  out[0] = ADC_TRACE_SYNC0;
+  out[1] = ADC_TRACE_SYNC1;
+  out[2] = ADC_TRACE_VERSION;
+  out[3] = frame.count;
+  putU16(out + 4, frame.firstIndex & 0xFFFF);
+  putU16(out + 6, frame.firstIndex >> 16);
+  putU16(out + 8, frame.rateHz);
+  for (uint8_t i = 0; i < frame.count; ++i)
+    putU16(out + ADC_TRACE_HEADER_SIZE + i * 2, frame.samples[i]);
+
+  putU16(out + length - 2, crc16(out + 2, length - 4));
+  return length;
+}
+
+bool adcTraceDecode(const uint8_t *data, size_t length, AdcTraceFrame &frame, size_t &consumed)
+{
+  size_t pos = 0;
+  while (pos + 1 < length)
+  {
+    if (data[pos] != ADC_TRACE_SYNC0 || data[pos + 1] != ADC_TRACE_SYNC1)
+    {
+      pos++;
+      continue;
+    }
+
+    if (pos + ADC_TRACE_HEADER_SIZE > length)
+      break;
+
+    const uint8_t *p = data + pos;
+    uint8_t count = p[3];
+    size_t frameLength = ADC_TRACE_HEADER_SIZE + count * 2 + 2;
+    if (p[2] != ADC_TRACE_VERSION || count > ADC_TRACE_MAX_SAMPLES)
+    {
+      pos++;
+      continue;
+    }
+
+    if (pos + frameLength > length)
+      break;
+
+    if (crc16(p + 2, frameLength - 4) != getU16(p + frameLength - 2))
+    {
+      pos++;
+      continue;
+    }
+
+    frame.count = count;
+    frame.firstIndex = getU16(p + 4) | (uint32_t)getU16(p + 6) << 16;
+    frame.rateHz = getU16(p + 8);
+    for (uint8_t i = 0; i < count; ++i)
+      frame.samples[i] = getU16(p + ADC_TRACE_HEADER_SIZE + i * 2);
+
+    consumed = pos + frameLength;
+    return true;
+  }
+
+  consumed = pos;
+  return false;
+}
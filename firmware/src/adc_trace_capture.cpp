@@ -0,0 +1,110 @@
+#include <adc_trace.h>
+#include <adc_sampler.h>
+#include <config.h>
+#include <serial_mux.h>
+
+// Capture state
+static AdcTraceSink traceSink = nullptr;
+static AdcTraceFrame traceFrame;
+static uint32_t traceIndex = 0;
+static uint32_t traceStartMs = 0;
+static uint32_t traceDurationMs = 0;
+static uint32_t traceDroppedBase = 0;
+static uint8_t traceChannel = 0;
+static bool traceStarted = false;
+
+static void flushFrame()
+{
+  if (traceFrame.count == 0)
+    return;
+
+  uint8_t buf[ADC_TRACE_MAX_FRAME];
+  size_t length = adcTraceEncode(traceFrame, buf, sizeof(buf));
+  if (length && traceSink)
+    traceSink(buf, length);
+
+  traceFrame.firstIndex = traceIndex;
+  traceFrame.count = 0;
+}
+
+void adcTraceStart(AdcTraceSink sink, uint32_t durationMs, uint8_t channel)
+{
+  adcTraceStop();
+
+  traceSink = sink;
+  traceChannel = channel;
+  traceDurationMs = durationMs;
+  traceIndex = 0;
+  traceStarted = false;
+  traceDroppedBase = adcSamplerDropped();
+
+  traceFrame.firstIndex = 0;
+  traceFrame.rateHz = (uint16_t)adcSamplerRate();
+  traceFrame.count = 0;
+
+  Serial.printf("ADC trace capture of channel %u started for %lu ms\n", channel, (unsigned long)durationMs);
+}
+
+void adcTraceStop()
+{
+  if (!traceSink)
+    return;
+
+  flushFrame();
+  traceSink = nullptr;
+  Serial.printf("ADC trace capture stopped after %lu samples\n", (unsigned long)traceIndex);
+}
+
+bool adcTraceActive()
+{
+  return traceSink != nullptr;
+}
+
+void adcTraceFeed(uint8_t channel, uint16_t sample, uint32_t nowMs)
+{
+  if (!traceSink || channel != traceChannel)
+    return;
+
+  if (!traceStarted)
+  {
+    traceStartMs = nowMs;
+    traceStarted = true;
+  }
+
+  if (nowMs - traceStartMs >= traceDurationMs)
+  {
+    adcTraceStop();
+    return;
+  }
+
+  // Polled samples (no stream, or standby) only come at a nominal rate, so
+  // their frames are pinned to the clock. A rate change starts a new frame.
+  uint16_t rate = (uint16_t)adcSamplerRate();
+  bool polled = !adcSamplerContinuous() || adcSamplerStandby();
+  if (rate != traceFrame.rateHz || (polled && traceFrame.count == 0))
+  {
+    flushFrame();
+    uint32_t atClock = (uint64_t)(nowMs - traceStartMs) * rate / 1000;
+    if (rate != traceFrame.rateHz || atClock > traceIndex)
+      traceIndex = atClock;
+    traceFrame.rateHz = rate;
+    traceFrame.firstIndex = traceIndex;
+  }
+
+  // Keep the timeline intact across samples the ring had to drop. Drops hit
+  // whole round-robin sweeps, so this channel lost its share of them.
+  uint32_t dropped = adcSamplerDropped();
+  if (dropped != traceDroppedBase)
+  {
+    flushFrame();
+    traceIndex += (dropped - traceDroppedBase + CONSOLE_CHANNELS - 1) / CONSOLE_CHANNELS;
+    traceDroppedBase = dropped;
+    traceFrame.firstIndex = traceIndex;
+  }
+
+  traceFrame.samples[traceFrame.count++] = sample;
+  traceIndex++;
+
+  if (traceFrame.count == ADC_TRACE_MAX_SAMPLES)
+    flushFrame();
+}
@@ -0,0 +1,46 @@
+#include <baseline_tracker.h>
+#include <config.h>
+
+bool baselineTrackerUpdate(BaselineTracker &tracker, int sample, bool powered, uint32_t nowMs, int &baseline)
+{
+  if (powered)
+  {
+    tracker.wasPowered = true;
+    tracker.primed = false;
+    return false;
+  }
+
+  if (tracker.wasPowered)
+  {
+    tracker.wasPowered = false;
+    tracker.offSince = nowMs;
+  }
+
+  // Let the sensor settle after the console turns off
+  if (nowMs - tracker.offSince < BASELINE_SETTLE_TIME)
+    return false;
+
+  if (!tracker.primed)
+  {
+    tracker.ewma = (int32_t)sample << 16;
+    tracker.primed = true;
+    tracker.lastStepMs = nowMs;
+    return false;
+  }
+
+  tracker.ewma += (((int32_t)sample << 16) - tracker.ewma) >> BASELINE_EWMA_SHIFT;
+
+  if (nowMs - tracker.lastStepMs < BASELINE_STEP_INTERVAL)
+    return false;
+  tracker.lastStepMs = nowMs;
+
+  int target = (tracker.ewma + 0x8000) >> 16;
+  if (target > baseline)
+    baseline++;
+  else if (target < baseline)
+    baseline--;
+  else
+    return false;
+
+  return true;
+}
@@ -1,15 +1,14 @@
-#include <Adafruit_NeoPixel.h>
 #include "colors.h"
 
 const uint32_t colors[] = {
-    Adafruit_NeoPixel::Color(255, 0, 0), // Red
-    Adafruit_NeoPixel::Color(0, 255, 0), // Green
-    Adafruit_NeoPixel::Color(0, 0, 255), // Blue
-    Adafruit_NeoPixel::Color(255, 255, 0), // Yellow
-    Adafruit_NeoPixel::Color(255, 0, 255), // Magenta
-    Adafruit_NeoPixel::Color(0, 255, 255), // Cyan
-    Adafruit_NeoPixel::Color(21, 184, 134), // Teal
-    Adafruit_NeoPixel::Color(255, 255, 255), // White
+    0xFF0000, // Red
+    0x00FF00, // Green
+    0x0000FF, // Blue
+    0xFFFF00, // Yellow
+    0xFF00FF, // Magenta
+    0x00FFFF, // Cyan
+    0x15B886, // Teal
+    0xFFFFFF, // White
 };
 
 const uint8_t NUM_COLORS = sizeof(colors) / sizeof(colors[0]);
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <commands.h>
+#include <control.h>
+#include <mqtt_dispatch.h>
+#include <state_publish.h>
+#include <state_json.h>
+#include <effects.h>
+#include <led_segments.h>
+#include <task_queues.h>
+#include <state.h>
+#include <hal.h>
+#include <pins.h>
+#include <config.h>
+#include <utils.h>
+#include <adc_trace.h>
+#include <settings.h>
+#include <serial_mux.h>
+
+uint8_t applyOffsetCommand(int offset, uint8_t channel)
+{
+  Serial.printf("[MQTT] HA requested offset: %d (channel %u)\n", offset, channel);
+
+  ChannelState &ch = channels[channel];
+  if (offset == ch.thresholdOffset)
+    return CommandNone;
+
+  ch.thresholdOffset = offset;
+  settingsPutInt(channelKey(channel, ChannelKey::Offset), ch.thresholdOffset);
+  return CommandStateChanged;
+}
+
+static void applyPaletteColor(uint8_t channel, uint8_t index)
+{
+  ChannelState &ch = channels[channel];
+  ch.colorMode = ColorMode::Palette;
+  ch.colorIndex = index;
+  settingsPutUChar(channelKey(channel, ChannelKey::ColorMode), static_cast<uint8_t>(ch.colorMode));
+  settingsPutUChar(channelKey(channel, ChannelKey::ColorIndex), ch.colorIndex);
+  updateLED(channel, true);
+}
+
+// hex is "RRGGBB", stored as given
+static void applyCustomColor(uint8_t channel, const char *hex)
+{
+  ChannelState &ch = channels[channel];
+  ch.colorMode = ColorMode::Custom;
+  ch.customColor = (uint32_t)strtoul(hex, nullptr, 16) & 0xFFFFFF;
+  settingsPutUChar(channelKey(channel, ChannelKey::ColorMode), static_cast<uint8_t>(ch.colorMode));
+  settingsPutString(channelKey(channel, ChannelKey::CustomColor), hex);
+  updateLED(channel, true);
+}
+
+static uint8_t applyEffect(const char *name)
+{
+  Effect effect;
+  if (!effectFromName(name, effect))
+  {
+    Serial.printf("[MQTT] Unknown effect: %s\n", name);
+    return CommandNone;
+  }
+
+  if (effect == currentEffect)
+    return CommandNone;
+
+  currentEffect = effect;
+  settingsPutUChar("effect", static_cast<uint8_t>(currentEffect));
+  updateAllLEDs(false);
+
+  Serial.printf("[MQTT] Received effect: %s\n", name);
+  return CommandStateChanged;
+}
+
+uint8_t applyLightCommand(JsonVariantConst doc, uint8_t channel)
+{
+  uint8_t result = CommandNone;
+
+  if (doc["state"].is<const char *>())
+  {
+    Serial.println("HA sent state ON/OFF — ignoring (device power is console-driven).");
+    // Immediately republish real state so HA UI snaps back
+    result |= CommandRepublishHA;
+  }
+
+  if (doc["brightness"].is<int>())
+  {
+    int b = clampInt(doc["brightness"].as<int>(), 0, 255);
+    if (b != currentBrightness)
+    {
+      currentBrightness = b;
+      ledSetBrightness(currentBrightness);
+      updateAllLEDs(false);
+      settingsPutUChar("brightness", currentBrightness);
+      result |= CommandStateChanged;
+    }
+  }
+
+  if (doc["color"].is<JsonObjectConst>())
+  {
+    auto cobj = doc["color"].as<JsonObjectConst>();
+    if (cobj["r"].is<int>() && cobj["g"].is<int>() && cobj["b"].is<int>())
+    {
+      uint8_t r = clampInt(cobj["r"].as<int>(), 0, 255);
+      uint8_t g = clampInt(cobj["g"].as<int>(), 0, 255);
+      uint8_t b = clampInt(cobj["b"].as<int>(), 0, 255);
+
+      char hex[7];
+      snprintf(hex, sizeof(hex), "%02X%02X%02X", r, g, b);
+      applyCustomColor(channel, hex);
+      result |= CommandStateChanged;
+    }
+  }
+
+  if (doc["effect"].is<const char *>())
+    result |= applyEffect(doc["effect"].as<const char *>());
+
+  return result;
+}
+
+uint8_t applySetCommand(JsonVariantConst doc, uint8_t channel)
+{
+  Serial.printf("Received set command (channel %u)\n", channel);
+  uint8_t result = CommandNone;
+
+  if (doc["color"].is<int>())
+  {
+    int colorIndex = doc["color"];
+    if (colorIndex >= 0 && colorIndex < NUM_COLORS)
+    {
+      result |= CommandStateChanged;
+      applyPaletteColor(channel, colorIndex);
+
+      Serial.print("[MQTT] Received color index: ");
+      Serial.println(colorIndex);
+    }
+    else if (colorIndex == -1 && doc["customColor"].is<const char *>())
+    {
+      const char *hex = doc["customColor"].as<const char *>();
+      if (hex[0] == '#')
+        hex++;
+      applyCustomColor(channel, hex);
+
+      Serial.print("[MQTT] Received custom color: #");
+      Serial.println(hex);
+
+      result |= CommandStateChanged;
+    }
+  }
+
+  if (doc["brightness"].is<int>())
+  {
+    int brightness = clampInt(doc["brightness"].as<int>(), 0, 255);
+    currentBrightness = brightness;
+    settingsPutUChar("brightness", currentBrightness);
+    ledSetBrightness(currentBrightness);
+    updateAllLEDs(false);
+
+    Serial.print("[MQTT] Received brightness: ");
+    Serial.println(brightness);
+
+    result |= CommandStateChanged;
+  }
+
+  if (doc["effect"].is<const char *>())
+    result |= applyEffect(doc["effect"].as<const char *>());
+
+  if (doc["pixels"].is<int>() || doc["segments"].is<const char *>())
+  {
+    int pixels = doc["pixels"] | (int)segmentsPixelCount();
+    const char *layout = doc["segments"].is<const char *>() ? doc["segments"].as<const char *>() : nullptr;
+    Serial.printf("[MQTT] Received LED layout: %d pixels\n", pixels);
+
+    if (pixels >= 1 && pixels <= LED_MAX_PIXELS && segmentsConfigure((uint16_t)pixels, layout))
+      result |= CommandStateChanged;
+  }
+
+  if (doc["name"].is<const char *>())
+  {
+    snprintf(deviceName, sizeof(deviceName), "%s", doc["name"].as<const char *>());
+    settingsPutString("name", deviceName);
+
+    Serial.print("[MQTT] Received device name: ");
+    Serial.println(deviceName);
+
+    result |= CommandStateChanged | CommandNameChanged;
+  }
+
+  if (doc["autoCalibrate"].is<bool>())
+  {
+    autoCalibrate = doc["autoCalibrate"].as<bool>();
+    settingsPutUChar("auto_cal", autoCalibrate);
+
+    Serial.print("[MQTT] Received auto calibration: ");
+    Serial.println(autoCalibrate ? "on" : "off");
+
+    result |= CommandStateChanged;
+  }
+
+  if (doc["thresholdOffset"].is<int>())
+  {
+    result |= applyOffsetCommand(doc["thresholdOffset"].as<int>(), channel);
+  }
+
+  if (doc["encoding"].is<const char *>())
+  {
+    StateEncoding encoding;
+    if (!stateEncodingFromName(doc["encoding"].as<const char *>(), encoding))
+      Serial.printf("[MQTT] Unknown state encoding: %s\n", doc["encoding"].as<const char *>());
+    else if (encoding != stateEncoding)
+    {
+      stateEncoding = encoding;
+      settingsPutUChar("encoding", static_cast<uint8_t>(stateEncoding));
+      Serial.printf("[MQTT] Received state encoding: %s\n", stateEncodingName(stateEncoding));
+      result |= CommandStateChanged;
+    }
+  }
+
+  return result;
+}
+
+void runIdentify(uint8_t channel)
+{
+  blinkSequence(channel, 0xFFFFFF, channelColor(channels[channel]), 3, 150, 100);
+}
+
+static void serialTraceSink(const uint8_t *frame, size_t length)
+{
+  Serial.write(frame, length);
+}
+
+// MQTT is the network task's business, hand the frame over
+static void mqttTraceSink(const uint8_t *frame, size_t length)
+{
+  traceFramePush(frame, length);
+}
+
+uint8_t applyCaptureCommand(JsonVariantConst doc)
+{
+  uint32_t seconds = doc["seconds"] | 10;
+  if (seconds == 0)
+  {
+    adcTraceStop();
+    return CommandNone;
+  }
+
+  const char *sink = doc["sink"] | "serial";
+  uint8_t channel = doc["channel"] | 0;
+  if (channel >= CONSOLE_CHANNELS)
+    return CommandNone;
+  Serial.printf("[MQTT] Received ADC capture request: %lus of channel %u to %s\n", (unsigned long)seconds, channel, sink);
+
+  adcTraceStart(strcmp(sink, "mqtt") == 0 ? mqttTraceSink : serialTraceSink, seconds * 1000, channel);
+  return CommandNone;
+}
+
+// Commands handled on the control task, queued there by the network task
+static MqttDispatcher controlDispatcher;
+
+static void republishState(uint8_t result)
+{
+  if (result & CommandStateChanged)
+    statePublishMark();
+  if (result & CommandRepublishHA)
+    statePublishMark(FieldEnabled);
+  if (result & CommandNameChanged)
+    discoveryNamePush(deviceName);
+}
+
+static void onOffsetCommand(const MqttMessage &msg)
+{
+  republishState(applyOffsetCommand(msg.value, msg.channel));
+}
+
+static void onLightCommand(const MqttMessage &msg)
+{
+  republishState(applyLightCommand(msg.json, msg.channel));
+}
+
+static void onSetCommand(const MqttMessage &msg)
+{
+  republishState(applySetCommand(msg.json, msg.channel));
+}
+
+static void onIdentifyCommand(const MqttMessage &msg)
+{
+  Serial.println();
+  Serial.printf("[MQTT] Received identify command (channel %u)\n", msg.channel);
+
+  runIdentify(msg.channel);
+}
+
+static void onCaptureCommand(const MqttMessage &msg)
+{
+  applyCaptureCommand(msg.json);
+}
+
+static void onCalibrateCommand(const MqttMessage &msg)
+{
+  Serial.println();
+  Serial.printf("[MQTT] Received calibration request (channel %u)\n", msg.channel);
+
+  startCalibration(msg.channel);
+}
+
+// Suffixes after console/<node>/ (or console/<node>/ch<n>/ for the per
+// channel ones), see ha_topics.cpp
+static const MqttCommand CONTROL_COMMANDS[] = {
+    {"ha/set", MqttPayload::Json, R"({"state":true,"brightness":true,"color":true,"effect":true})", onLightCommand, true},
+    {"offset/set", MqttPayload::Int, nullptr, onOffsetCommand, true},
+    {"set", MqttPayload::Json, SET_COMMAND_FILTER, onSetCommand, true},
+    {"set/msgpack", MqttPayload::MsgPack, SET_COMMAND_FILTER, onSetCommand, true},
+    {"identify", MqttPayload::None, nullptr, onIdentifyCommand, true},
+    {"capture", MqttPayload::Json, R"({"seconds":true,"sink":true,"channel":true})", onCaptureCommand, false},
+    {"calibrate", MqttPayload::None, nullptr, onCalibrateCommand, true},
+};
+
+void commandsBegin(const char *topicPrefix)
+{
+  mqttDispatchBegin(controlDispatcher, topicPrefix, CONTROL_COMMANDS, sizeof(CONTROL_COMMANDS) / sizeof(CONTROL_COMMANDS[0]));
+}
+
+void commandsPoll()
+{
+  static ControlCommand cmd;
+  while (controlCommandPop(cmd))
+    mqttDispatch(controlDispatcher, cmd.topic, cmd.payload, cmd.length);
+}
+
+void commandsStatsToJson(JsonObject out)
+{
+  mqttDispatchStatsToJson(controlDispatcher, out);
+}
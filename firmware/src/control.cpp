@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <control.h>
+#include <commands.h>
+#include <power_detect.h>
+#include <adc_sampler.h>
+#include <adc_trace.h>
+#include <input_events.h>
+#include <baseline_tracker.h>
+#include <loop_stats.h>
+#include <state.h>
+#include <hal.h>
+#include <pins.h>
+#include <config.h>
+#include <utils.h>
+#include <ha_topics.h>
+#include <settings.h>
+#include <state_publish.h>
+#include <state_json.h>
+#include <effects.h>
+#include <led_segments.h>
+#include <serial_mux.h>
+
+static_assert(CONSOLE_CHANNELS <= sizeof(CURRENT_SENSE_PINS) / sizeof(CURRENT_SENSE_PINS[0]),
+              "pins.h needs a current sense pin per channel");
+
+ChannelState channels[CONSOLE_CHANNELS];
+bool inBrightnessMode = false;
+
+// Current brightness
+uint8_t currentBrightness = 128;
+
+// Effect drawn over the color while the strip is on
+Effect currentEffect = Effect::Solid;
+
+char deviceName[DEVICE_NAME_MAX_LEN + 1] = "";
+time_t bootTime = 0;
+
+// Automatic baseline tracking
+bool autoCalibrate = AUTO_CALIBRATE_DEFAULT;
+
+// Encoding of the retained device state
+StateEncoding stateEncoding = StateEncoding::Json;
+
+// Detection state behind each channel
+struct ChannelControl
+{
+  PowerDetector powerDetector;
+  bool lastLedEnabled;
+
+  // Non-blocking calibration: fed from the sample stream
+  int calibrationRemaining;
+  long calibrationSum;
+
+  BaselineTracker baselineTracker;
+  int storedBaseline;
+  int publishedBaseline;
+  uint32_t lastBaselinePersist;
+  uint32_t lastBaselinePublish;
+};
+
+static ChannelControl control[CONSOLE_CHANNELS];
+
+// Encoder button, from debounced press/release events
+static bool encoderButtonHeld = false;
+static bool longPressShown = false;
+static uint32_t encoderPressTime = 0;
+
+// Last time anything needed the full sample rate
+static uint32_t lastActiveMs = 0;
+
+static const char *const CHANNEL_KEY_NAMES[] = {"th_base", "th_offset", "color_mode", "color_index", "custom_color"};
+static_assert(sizeof(CHANNEL_KEY_NAMES) / sizeof(CHANNEL_KEY_NAMES[0]) == static_cast<uint8_t>(ChannelKey::Count),
+              "a name per channel key");
+
+// The settings cache keeps the key pointers, so these live for good
+static char channelKeys[CONSOLE_CHANNELS][static_cast<uint8_t>(ChannelKey::Count)][16];
+
+const char *channelKey(uint8_t channel, ChannelKey key)
+{
+  char *name = channelKeys[channel][static_cast<uint8_t>(key)];
+  if (!name[0])
+  {
+    if (channel == 0)
+      snprintf(name, sizeof(channelKeys[0][0]), "%s", CHANNEL_KEY_NAMES[static_cast<uint8_t>(key)]);
+    else
+      snprintf(name, sizeof(channelKeys[0][0]), "%s%u", CHANNEL_KEY_NAMES[static_cast<uint8_t>(key)], channel);
+  }
+  return name;
+}
+
+static void loadChannel(uint8_t ch)
+{
+  ChannelState &channel = channels[ch];
+  ChannelControl &ctl = control[ch];
+
+  // Load calibrated threshold if available
+  channel.threshold = settingsGetInt(channelKey(ch, ChannelKey::Baseline), CURRENT_THRESHOLD);
+  channel.thresholdOffset = settingsGetInt(channelKey(ch, ChannelKey::Offset), CURRENT_THRESHOLD_OFFSET);
+  ctl = ChannelControl();
+  ctl.storedBaseline = channel.threshold;
+  ctl.publishedBaseline = channel.threshold;
+  Serial.println();
+  Serial.printf("Channel %u current threshold: %d, offset: %d\n", ch, channel.threshold, channel.thresholdOffset);
+
+  // Read saved color from NVS (quiet on first boot)
+  channel.colorMode = static_cast<ColorMode>(settingsGetUChar(channelKey(ch, ChannelKey::ColorMode), 0));
+  channel.colorIndex = settingsGetUChar(channelKey(ch, ChannelKey::ColorIndex), 0);
+  channel.customColor = 0x000000;
+  if (settingsHasKey(channelKey(ch, ChannelKey::CustomColor)))
+  {
+    char hex[8] = "";
+    settingsGetString(channelKey(ch, ChannelKey::CustomColor), hex, sizeof(hex)); // may be "RRGGBB" or "#RRGGBB"
+    const char *digits = hex[0] == '#' ? hex + 1 : hex;
+
+    channel.customColor = (uint32_t)strtoul(digits, nullptr, 16) & 0xFFFFFF;
+  }
+
+  if (channel.colorMode == ColorMode::Custom)
+  {
+    Serial.printf("Channel %u color mode: %s, custom color: #%06X\n", ch, colorModeToString(channel.colorMode),
+                  (unsigned)channel.customColor);
+  }
+  else
+  {
+    // Clamp palette index defensively
+    if (channel.colorIndex >= NUM_COLORS)
+    {
+      channel.colorIndex = 0;
+      settingsPutUChar(channelKey(ch, ChannelKey::ColorIndex), channel.colorIndex);
+    }
+    Serial.printf("Channel %u color mode: %s, color index: %u\n", ch, colorModeToString(channel.colorMode),
+                  channel.colorIndex);
+  }
+
+  channel.ledEnabled = false;
+  channel.adcLevel = 0;
+}
+
+void controlSetup()
+{
+  adcSamplerBegin(CURRENT_SENSE_PINS, CONSOLE_CHANNELS, ADC_SAMPLE_RATE_HZ);
+
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    loadChannel(ch);
+
+  autoCalibrate = settingsGetUChar("auto_cal", AUTO_CALIBRATE_DEFAULT);
+  Serial.print("Auto calibration: ");
+  Serial.println(autoCalibrate ? "on" : "off");
+
+  uint8_t encoding = settingsGetUChar("encoding", static_cast<uint8_t>(StateEncoding::Json));
+  stateEncoding = encoding >= 1 && encoding <= STATE_ENCODING_MAX ? static_cast<StateEncoding>(encoding) : StateEncoding::Json;
+  Serial.print("State encoding: ");
+  Serial.println(stateEncodingName(stateEncoding));
+
+  // Read saved brightness from NVS
+  currentBrightness = settingsGetUChar("brightness", 128);
+  Serial.print("Current brightness: ");
+  Serial.println(currentBrightness);
+
+  uint8_t effect = settingsGetUChar("effect", 0);
+  currentEffect = effect < static_cast<uint8_t>(Effect::Count) ? static_cast<Effect>(effect) : Effect::Solid;
+  Serial.print("Effect: ");
+  Serial.println(effectName(currentEffect));
+
+  segmentsBegin();
+  Serial.println();
+
+  ledSetBrightness(currentBrightness);
+  updateAllLEDs(false);
+
+  commandsBegin(haCmdPrefix());
+  statePublishMark();
+}
+
+void startCalibration(uint8_t channel)
+{
+  control[channel].calibrationSum = 0;
+  control[channel].calibrationRemaining = CALIBRATION_SAMPLES;
+}
+
+static void finishCalibration(uint8_t ch)
+{
+  ChannelState &channel = channels[ch];
+  ChannelControl &ctl = control[ch];
+
+  channel.threshold = (int)(ctl.calibrationSum / CALIBRATION_SAMPLES);
+  settingsPutInt(channelKey(ch, ChannelKey::Baseline), channel.threshold);
+  ctl.storedBaseline = channel.threshold;
+  ctl.lastBaselinePersist = halMillis();
+  Serial.printf("Channel %u calibrated baseline saved: %d\n", ch, channel.threshold);
+  Serial.printf("TH_ON / TH_OFF: %d / %d\n", channel.threshold + channel.thresholdOffset,
+                powerOffThreshold(channel.threshold, channel.thresholdOffset));
+  Serial.println();
+
+  blinkConfirm(ch, 0xFFFFFF, 2);
+
+  statePublishMark();
+}
+
+// Persist and publish the tracked baseline, both rate limited
+static void handleBaselineDrift(uint8_t ch, uint32_t now)
+{
+  ChannelState &channel = channels[ch];
+  ChannelControl &ctl = control[ch];
+
+  int drift = channel.threshold - ctl.storedBaseline;
+  if ((drift >= BASELINE_PERSIST_DELTA || drift <= -BASELINE_PERSIST_DELTA) &&
+      now - ctl.lastBaselinePersist >= BASELINE_PERSIST_INTERVAL)
+  {
+    settingsPutInt(channelKey(ch, ChannelKey::Baseline), channel.threshold);
+    ctl.storedBaseline = channel.threshold;
+    ctl.lastBaselinePersist = now;
+    Serial.printf("Channel %u tracked baseline saved: %d\n", ch, channel.threshold);
+  }
+
+  if (channel.threshold != ctl.publishedBaseline && now - ctl.lastBaselinePublish >= BASELINE_PUBLISH_INTERVAL)
+  {
+    ctl.publishedBaseline = channel.threshold;
+    ctl.lastBaselinePublish = now;
+    statePublishMark();
+  }
+}
+
+static void feedSample(uint8_t ch, int adc, uint32_t now)
+{
+  ChannelState &channel = channels[ch];
+  ChannelControl &ctl = control[ch];
+
+  // In standby a sample past the on level brings the full rate back at once,
+  // the detector makes the actual call. RMS style filters react to swings
+  // either side of the baseline.
+  if (adcSamplerStandby())
+  {
+    bool crossed = adc >= channel.threshold + channel.thresholdOffset;
+    if (powerOffThreshold(channel.threshold, channel.thresholdOffset) > channel.threshold)
+      crossed |= adc <= channel.threshold - channel.thresholdOffset;
+
+    if (crossed)
+    {
+      Serial.printf("Channel %u: ADC threshold crossed\n", ch);
+      lastActiveMs = now;
+      adcSamplerSetStandby(false);
+      halInputWakeArm(false);
+    }
+  }
+
+  if (ctl.calibrationRemaining > 0)
+  {
+    ctl.calibrationSum += adc;
+    if (--ctl.calibrationRemaining == 0)
+      finishCalibration(ch);
+  }
+  else if (autoCalibrate)
+  {
+    baselineTrackerUpdate(ctl.baselineTracker, adc, channel.ledEnabled, now, channel.threshold);
+  }
+
+  // Use runtime threshold derived from calibrated baseline + fixed offset
+  channel.ledEnabled = powerDetectUpdate(ctl.powerDetector, adc, channel.threshold, channel.thresholdOffset, now);
+}
+
+static void handlePowerDetection()
+{
+  adcSamplerPoll();
+
+  // Drain everything sampled since the last iteration, every channel's
+  // samples go through its own detector as they arrive
+  uint16_t samples[64];
+  size_t n;
+  uint32_t now = halMillis();
+
+  while ((n = adcSamplerRead(samples, sizeof(samples) / sizeof(samples[0]))) > 0)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      uint8_t ch = adcSampleChannel(samples[i]);
+      if (ch >= CONSOLE_CHANNELS)
+        continue;
+
+      uint16_t adc = adcSampleValue(samples[i]);
+      adcTraceFeed(ch, adc, now);
+      feedSample(ch, adc, now);
+    }
+  }
+
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    ChannelState &channel = channels[ch];
+    ChannelControl &ctl = control[ch];
+    channel.adcLevel = ctl.powerDetector.level;
+
+    if (autoCalibrate)
+      handleBaselineDrift(ch, now);
+
+    if (channel.ledEnabled == ctl.lastLedEnabled)
+      continue;
+
+    Serial.printf("Channel %u: %s\n", ch, channel.ledEnabled ? "Turning ON LEDs" : "Turning OFF LEDs");
+    fadeToColor(ch, channel.ledEnabled ? channelColor(channel) : 0x000000);
+    ctl.lastLedEnabled = channel.ledEnabled;
+
+    statePublishMark();
+  }
+}
+
+static void handleEncoderTurn(const InputEvent &event)
+{
+  if (inBrightnessMode)
+  {
+    // Slow detents step by one, a quick spin covers the range in a few
+    int step = event.value * inputAccelStep(event.intervalMs);
+    int newBrightness = clampInt(currentBrightness + step, 0, 255);
+    if (newBrightness != currentBrightness)
+    {
+      currentBrightness = newBrightness;
+      ledSetBrightness(currentBrightness);
+      updateAllLEDs(false);
+    }
+  }
+  else
+  {
+    ChannelState &channel = channels[ENCODER_CHANNEL];
+    channel.colorMode = ColorMode::Palette;
+    channel.colorIndex = (channel.colorIndex + event.value + NUM_COLORS) % NUM_COLORS;
+    settingsPutUChar(channelKey(ENCODER_CHANNEL, ChannelKey::ColorMode), static_cast<uint8_t>(channel.colorMode));
+    settingsPutUChar(channelKey(ENCODER_CHANNEL, ChannelKey::ColorIndex), channel.colorIndex);
+    updateLED(ENCODER_CHANNEL, false);
+  }
+}
+
+static void handleEncoderButton(const InputEvent &event)
+{
+  if (event.type == InputType::Press)
+  {
+    encoderButtonHeld = true;
+    longPressShown = false;
+    encoderPressTime = event.timeMs;
+    return;
+  }
+
+  if (!encoderButtonHeld)
+    return;
+  encoderButtonHeld = false;
+
+  uint32_t pressDuration = event.timeMs - encoderPressTime;
+  if (pressDuration >= LONG_PRESS_THRESHOLD)
+  {
+    inBrightnessMode = !inBrightnessMode;
+    Serial.println(inBrightnessMode ? "Entered brightness mode" : "Exited brightness mode");
+  }
+  else if (inBrightnessMode)
+  {
+    settingsPutUChar("brightness", currentBrightness);
+    Serial.print("Saved brightness: ");
+    Serial.println(currentBrightness);
+    Serial.println("Exiting brightness mode");
+    inBrightnessMode = false;
+
+    statePublishMark();
+  }
+  else
+  {
+    ChannelState &channel = channels[ENCODER_CHANNEL];
+    channel.colorMode = ColorMode::Palette;
+    settingsPutUChar(channelKey(ENCODER_CHANNEL, ChannelKey::ColorMode), static_cast<uint8_t>(channel.colorMode));
+    settingsPutUChar(channelKey(ENCODER_CHANNEL, ChannelKey::ColorIndex), channel.colorIndex);
+    Serial.print("Saved color to Preferences: ");
+    Serial.println(channel.colorIndex);
+
+    statePublishMark();
+  }
+}
+
+static void handleCalibrationButton(const InputEvent &event)
+{
+  // Single-press calibration on POWER_CALIBRATE_PIN, for every channel
+  if (event.type != InputType::Press)
+    return;
+
+  Serial.println();
+  Serial.println("Calibration button pressed. Sampling ADC");
+
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    startCalibration(ch);
+}
+
+// Everything that happened since the last iteration, in order
+static void handleInput()
+{
+  InputEvent event;
+  while (inputPoll(InputConsumer::Control, event))
+  {
+    switch (event.source)
+    {
+    case InputSource::Encoder:
+      handleEncoderTurn(event);
+      break;
+    case InputSource::EncoderButton:
+      handleEncoderButton(event);
+      break;
+    case InputSource::CalibrateButton:
+      handleCalibrationButton(event);
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Show when brightness mode has been activated and button can be released
+  if (encoderButtonHeld && !longPressShown && halMillis() - encoderPressTime >= LONG_PRESS_THRESHOLD)
+  {
+    blinkConfirm(ENCODER_CHANNEL, 0xFFFFFF, 2);
+    longPressShown = true;
+  }
+}
+
+// Pauses continuous sampling once every console has been off for
+// ADC_STANDBY_DELAY and nothing else needs the full rate
+static void handleStandby(uint32_t now)
+{
+  bool active = ledAnimating() || adcTraceActive() || inBrightnessMode || encoderButtonHeld;
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    active |= channels[ch].ledEnabled || control[ch].calibrationRemaining > 0;
+
+  if (active)
+    lastActiveMs = now;
+
+  bool standby = ADC_STANDBY_DELAY > 0 && now - lastActiveMs >= ADC_STANDBY_DELAY;
+  if (standby == adcSamplerStandby())
+    return;
+
+  adcSamplerSetStandby(standby);
+  halInputWakeArm(standby);
+}
+
+static uint32_t earliest(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+uint32_t controlIdleMs()
+{
+  uint32_t now = halMillis();
+  uint32_t idle = CONTROL_IDLE_MAX;
+
+  idle = earliest(idle, adcSamplerIdleMs(now));
+  idle = earliest(idle, ledIdleMs(now));
+  idle = earliest(idle, inputIdleMs(InputConsumer::Control, now));
+  idle = earliest(idle, settingsIdleMs(now));
+  idle = earliest(idle, statePublishIdleMs(now));
+  if (encoderButtonHeld && !longPressShown)
+    idle = earliest(idle, msUntil(encoderPressTime + LONG_PRESS_THRESHOLD, now));
+  if (!adcSamplerStandby() && ADC_STANDBY_DELAY > 0)
+    idle = earliest(idle, msUntil(lastActiveMs + ADC_STANDBY_DELAY, now));
+
+  return idle;
+}
+
+void controlLoop()
+{
+  commandsPoll();
+
+  handleInput();
+  loopStatsMark(LoopStage::Input);
+
+  handlePowerDetection();
+  handleStandby(halMillis());
+  loopStatsMark(LoopStage::Adc);
+
+  ledTick();
+  loopStatsMark(LoopStage::Led);
+
+  settingsLoop();
+  statePublishLoop();
+}
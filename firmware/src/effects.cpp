@@ -0,0 +1,172 @@
+#include <string.h>
+
+#include <effects.h>
+#include <config.h>
+#include <hal.h>
+
+static const char *const EFFECT_NAMES[] = {"solid", "breathing", "chase", "gradient", "rainbow"};
+static_assert(sizeof(EFFECT_NAMES) / sizeof(EFFECT_NAMES[0]) == static_cast<uint8_t>(Effect::Count), "one name per effect");
+
+const char *effectName(Effect effect)
+{
+  return effect < Effect::Count ? EFFECT_NAMES[static_cast<uint8_t>(effect)] : EFFECT_NAMES[0];
+}
+
+bool effectFromName(const char *name, Effect &effect)
+{
+  for (uint8_t i = 0; i < static_cast<uint8_t>(Effect::Count); ++i)
+  {
+    if (strcmp(name, EFFECT_NAMES[i]) == 0)
+    {
+      effect = static_cast<Effect>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline Rgb16 scale(const Rgb16 &c, uint16_t amount)
+{
+  return {(uint16_t)((uint32_t)c.r * amount >> 16), (uint16_t)((uint32_t)c.g * amount >> 16),
+          (uint16_t)((uint32_t)c.b * amount >> 16)};
+}
+
+// 0..65535 position within a repeating period
+static inline uint16_t phase(uint32_t nowMs, uint32_t periodMs)
+{
+  return (uint16_t)(((nowMs % periodMs) << 16) / periodMs);
+}
+
+// Eased triangle wave, 0 at both ends, 65535 in the middle
+static uint16_t breathWave(uint16_t p)
+{
+  uint32_t tri = p < 32768 ? (uint32_t)p * 2 : (uint32_t)(65535 - p) * 2;
+  return (uint16_t)(tri * tri >> 16);
+}
+
+static void renderBreathing(const Rgb16 &base, uint32_t nowMs, uint16_t start, uint16_t length)
+{
+  // Never fully dark, 1/16 at the bottom of the breath
+  uint16_t level = 4096 + (uint16_t)((uint32_t)breathWave(phase(nowMs, EFFECT_BREATH_PERIOD)) * 61439 >> 16);
+  fbFillRange(start, length, scale(base, level));
+}
+
+static void renderChase(const Rgb16 &base, uint32_t nowMs, uint16_t start, uint16_t length)
+{
+  static const uint16_t TAIL[] = {65535, 24576, 8192};
+  const Rgb16 background = scale(base, 2048);
+
+  uint16_t head = (nowMs / EFFECT_CHASE_STEP) % length;
+  for (uint16_t i = 0; i < length; ++i)
+  {
+    uint16_t behind = (head + length - i) % length;
+    fbSet(start + i, behind < sizeof(TAIL) / sizeof(TAIL[0]) ? scale(base, TAIL[behind]) : background);
+  }
+}
+
+// From the color to its channel-rotated partner and back, so it wraps cleanly
+static void renderGradient(const Rgb16 &base, uint16_t start, uint16_t length)
+{
+  const Rgb16 partner = {base.b, base.r, base.g};
+  for (uint16_t i = 0; i < length; ++i)
+  {
+    uint32_t p = (uint32_t)i * 131070 / length;
+    uint16_t frac = p < 65536 ? p : 131070 - p;
+    fbSet(start + i, rgb16Lerp(base, partner, frac));
+  }
+}
+
+// Hue 0..1535 to a fully saturated 24-bit color
+static uint32_t hueColor(uint16_t hue)
+{
+  uint8_t f = hue & 0xFF;
+  switch (hue >> 8)
+  {
+  case 0:
+    return 0xFF0000 | (uint32_t)f << 8;
+  case 1:
+    return (uint32_t)(255 - f) << 16 | 0x00FF00;
+  case 2:
+    return 0x00FF00 | f;
+  case 3:
+    return (uint32_t)(255 - f) << 8 | 0x0000FF;
+  case 4:
+    return (uint32_t)f << 16 | 0x0000FF;
+  default:
+    return 0xFF0000 | (255 - f);
+  }
+}
+
+// Takes only its intensity from the base color
+static void renderRainbow(const Rgb16 &base, uint32_t nowMs, uint16_t start, uint16_t length)
+{
+  uint16_t value = base.r > base.g ? (base.r > base.b ? base.r : base.b) : (base.g > base.b ? base.g : base.b);
+  uint32_t offset = (uint32_t)phase(nowMs, EFFECT_RAINBOW_PERIOD) * 1536 >> 16;
+
+  for (uint16_t i = 0; i < length; ++i)
+  {
+    uint16_t hue = (offset + (uint32_t)i * 1536 / length) % 1536;
+    fbSet(start + i, scale(rgb16FromColor(hueColor(hue)), value));
+  }
+}
+
+bool effectAnimated(Effect effect)
+{
+  return effect == Effect::Breathing || effect == Effect::Chase || effect == Effect::Rainbow;
+}
+
+void effectRender(Effect effect, const Rgb16 &base, uint32_t nowMs, uint16_t start, uint16_t length)
+{
+  if (length == 0)
+    return;
+
+  switch (effect)
+  {
+  case Effect::Breathing:
+    renderBreathing(base, nowMs, start, length);
+    break;
+  case Effect::Chase:
+    renderChase(base, nowMs, start, length);
+    break;
+  case Effect::Gradient:
+    renderGradient(base, start, length);
+    break;
+  case Effect::Rainbow:
+    renderRainbow(base, nowMs, start, length);
+    break;
+  default:
+    fbFillRange(start, length, base);
+    break;
+  }
+}
+
+// Read and reset from the network task like the loop stats; a torn window
+// there only skews one report
+static uint32_t frameCount = 0;
+static uint32_t shownCount = 0;
+static uint64_t frameCyclesTotal = 0;
+static uint32_t frameCyclesMax = 0;
+
+void effectFrameRecord(uint32_t cycles, bool shown)
+{
+  frameCount++;
+  if (shown)
+    shownCount++;
+  frameCyclesTotal += cycles;
+  if (cycles > frameCyclesMax)
+    frameCyclesMax = cycles;
+}
+
+void effectFrameStatsToJson(JsonObject obj)
+{
+  uint32_t perMicro = halCyclesPerMicro();
+  obj["n"] = frameCount;
+  obj["shown"] = shownCount;
+  obj["avg_us"] = frameCount ? (uint32_t)(frameCyclesTotal / frameCount / perMicro) : 0;
+  obj["max_us"] = frameCyclesMax / perMicro;
+
+  frameCount = 0;
+  shownCount = 0;
+  frameCyclesTotal = 0;
+  frameCyclesMax = 0;
+}
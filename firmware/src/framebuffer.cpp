@@ -0,0 +1,190 @@
+#include <framebuffer.h>
+#include <config.h>
+#include <hal.h>
+
+// Gamma tables, computed at compile time
+// constexpr pow() via exp(g * ln(x)), x in (0, 1]
+static constexpr double cexp(double y)
+{
+  // exp(y) = exp(y / 2^8) ^ (2^8)
+  double x = y / 256.0;
+  double term = 1.0;
+  double sum = 1.0;
+  for (int i = 1; i < 12; ++i)
+  {
+    term *= x / i;
+    sum += term;
+  }
+  for (int i = 0; i < 8; ++i)
+    sum *= sum;
+  return sum;
+}
+
+static constexpr double cln(double x)
+{
+  // Scale into [0.5, 1), then ln(m) = 2 atanh((m - 1) / (m + 1))
+  double e = 0.0;
+  while (x < 0.5)
+  {
+    x *= 2.0;
+    e -= 1.0;
+  }
+  double z = (x - 1.0) / (x + 1.0);
+  double z2 = z * z;
+  double term = z;
+  double sum = 0.0;
+  for (int k = 0; k < 20; ++k)
+  {
+    sum += term / (2 * k + 1);
+    term *= z2;
+  }
+  return 2.0 * sum + e * 0.69314718055994531;
+}
+
+struct GammaTable
+{
+  uint16_t value[256];
+};
+
+static constexpr GammaTable makeGammaTable()
+{
+  GammaTable table = {};
+  for (int i = 1; i < 256; ++i)
+    table.value[i] = (uint16_t)(cexp(LED_GAMMA * cln(i / 255.0)) * 65535.0 + 0.5);
+  return table;
+}
+
+// 8-bit gamma encoded level to 16-bit linear
+static constexpr GammaTable GAMMA = makeGammaTable();
+static_assert(GAMMA.value[0] == 0 && GAMMA.value[255] == 65535, "gamma table endpoints");
+
+static Rgb16 frame[LED_MAX_PIXELS];
+static uint32_t shown[LED_MAX_PIXELS];
+static uint8_t residual[LED_MAX_PIXELS][3]; // Dither error carried to the next frame
+static uint16_t pixelCount = NUM_PIXELS;
+static uint32_t brightnessScale = 65281; // scaleFor(255)
+static uint8_t brightnessLevel = 255;
+static bool dithering = false;
+static bool ditherEnabled = true;
+
+// Never a 24-bit color, forces the pixel out on the next render
+static constexpr uint32_t SHOWN_UNKNOWN = 0xFF000000;
+
+void fbBegin(uint16_t count)
+{
+  pixelCount = count < LED_MAX_PIXELS ? count : LED_MAX_PIXELS;
+  for (uint16_t i = 0; i < LED_MAX_PIXELS; ++i)
+  {
+    frame[i] = {0, 0, 0};
+    shown[i] = SHOWN_UNKNOWN;
+    residual[i][0] = residual[i][1] = residual[i][2] = 0;
+  }
+}
+
+uint16_t fbPixelCount() { return pixelCount; }
+
+Rgb16 rgb16FromColor(uint32_t color)
+{
+  return {GAMMA.value[(color >> 16) & 0xFF], GAMMA.value[(color >> 8) & 0xFF], GAMMA.value[color & 0xFF]};
+}
+
+static inline uint16_t lerp16(uint16_t from, uint16_t to, uint16_t frac)
+{
+  return from + (int32_t)(((int64_t)((int32_t)to - from) * frac) >> 16);
+}
+
+Rgb16 rgb16Lerp(const Rgb16 &from, const Rgb16 &to, uint16_t frac)
+{
+  return {lerp16(from.r, to.r, frac), lerp16(from.g, to.g, frac), lerp16(from.b, to.b, frac)};
+}
+
+void fbSet(uint16_t index, const Rgb16 &color)
+{
+  if (index < pixelCount)
+    frame[index] = color;
+}
+
+void fbFillRange(uint16_t start, uint16_t length, const Rgb16 &color)
+{
+  uint16_t end = start + length < pixelCount ? start + length : pixelCount;
+  for (uint16_t i = start; i < end; ++i)
+    frame[i] = color;
+}
+
+void fbFill(const Rgb16 &color) { fbFillRange(0, pixelCount, color); }
+
+Rgb16 fbGet(uint16_t index) { return index < pixelCount ? frame[index] : Rgb16{0, 0, 0}; }
+
+// Output level in 1/256 steps is (linear * brightnessScale) >> 16, so that
+// 65535 at full brightness lands exactly on 255 with no error left over
+static uint32_t scaleFor(uint8_t brightness)
+{
+  return ((uint32_t)brightness * 16777216u + 32767) / 65535;
+}
+
+void fbSetBrightness(uint8_t brightness)
+{
+  // Linear like Adafruit_NeoPixel::setBrightness()
+  brightnessLevel = brightness;
+  brightnessScale = scaleFor(brightness);
+}
+
+uint8_t fbBrightness() { return brightnessLevel; }
+
+// Scale to the output and keep the low byte as dither error. Without
+// dithering the level is rounded and no error is carried.
+static inline uint8_t outputLevel(uint16_t linear, uint8_t &error, bool &dithered)
+{
+  uint32_t level = (linear * brightnessScale) >> 16;
+  if (!ditherEnabled)
+  {
+    error = 0;
+    level = (level + 128) >> 8;
+    return level > 255 ? 255 : level;
+  }
+
+  level += error;
+  error = level & 0xFF;
+  level >>= 8;
+  if (level >= 255)
+    return 255; // At the top the error only matters once it has drained, not worth a refresh
+  if (error)
+    dithered = true;
+  return level;
+}
+
+bool fbRender(uint16_t start, uint16_t length, bool &dithered)
+{
+  dithered = false;
+  bool changed = false;
+
+  uint16_t end = start + length < pixelCount ? start + length : pixelCount;
+  for (uint16_t i = start; i < end; ++i)
+  {
+    uint32_t color = (uint32_t)outputLevel(frame[i].r, residual[i][0], dithered) << 16 |
+                     (uint32_t)outputLevel(frame[i].g, residual[i][1], dithered) << 8 |
+                     outputLevel(frame[i].b, residual[i][2], dithered);
+    if (color != shown[i])
+    {
+      shown[i] = color;
+      halPixelsSet(i, color);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool fbShow()
+{
+  bool changed = fbRender(0, pixelCount, dithering);
+  if (changed)
+    halPixelsShow();
+  return changed;
+}
+
+bool fbDithering() { return dithering; }
+
+void fbDitherEnable(bool enabled) { ditherEnabled = enabled; }
+bool fbDitherEnabled() { return ditherEnabled; }
+
+uint32_t fbMemoryUsed() { return (uint32_t)pixelCount * FB_BYTES_PER_PIXEL; }
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <ha_discovery.h>
+#include <ha_topics.h>
+#include <state.h>
+#include <config.h>
+
+static char deviceNameForHa[DEVICE_NAME_MAX_LEN + 1] = "";
+
+void haDiscoverySetName(const char *name)
+{
+  snprintf(deviceNameForHa, sizeof(deviceNameForHa), "%s", name);
+}
+
+static const char *discoveryName(char *fallback, size_t len)
+{
+  if (deviceNameForHa[0])
+    return deviceNameForHa;
+  snprintf(fallback, len, "Console-%s", haMacSuffix());
+  return fallback;
+}
+
+// The name is user input and lands inside a JSON string
+static bool appendEscaped(const char *value, char *out, size_t len, size_t &pos)
+{
+  for (; *value; ++value)
+  {
+    char c = *value;
+    bool escape = c == '"' || c == '\\';
+    if ((unsigned char)c < 0x20)
+      c = ' ';
+    if (pos + (escape ? 2 : 1) >= len)
+      return false;
+    if (escape)
+      out[pos++] = '\\';
+    out[pos++] = c;
+  }
+  return true;
+}
+
+size_t haDiscoveryExpand(const char *tmpl, char *out, size_t len, uint8_t channel)
+{
+  size_t pos = 0;
+
+  char chTopic[8] = "";
+  char chId[8] = "";
+  char chName[8] = "";
+  if (channel > 0)
+  {
+    snprintf(chTopic, sizeof(chTopic), "ch%u/", channel);
+    snprintf(chId, sizeof(chId), "_ch%u", channel);
+    snprintf(chName, sizeof(chName), " %u", channel + 1);
+  }
+
+  while (*tmpl)
+  {
+    const char *value = nullptr;
+    if (strncmp(tmpl, "{name}", 6) == 0)
+    {
+      char fallback[16];
+      if (!appendEscaped(discoveryName(fallback, sizeof(fallback)), out, len, pos))
+        return 0;
+      tmpl += 6;
+      continue;
+    }
+    else if (strncmp(tmpl, "{node}", 6) == 0)
+    {
+      value = haNodeId();
+      tmpl += 6;
+    }
+    else if (strncmp(tmpl, "{mac}", 5) == 0)
+    {
+      value = haMacSuffix();
+      tmpl += 5;
+    }
+    else if (strncmp(tmpl, "{ch}", 4) == 0)
+    {
+      value = chTopic;
+      tmpl += 4;
+    }
+    else if (strncmp(tmpl, "{chid}", 6) == 0)
+    {
+      value = chId;
+      tmpl += 6;
+    }
+    else if (strncmp(tmpl, "{chn}", 5) == 0)
+    {
+      value = chName;
+      tmpl += 5;
+    }
+
+    if (value)
+    {
+      size_t n = strlen(value);
+      if (pos + n >= len)
+        return 0;
+      memcpy(out + pos, value, n);
+      pos += n;
+      continue;
+    }
+
+    if (pos + 1 >= len)
+      return 0;
+    out[pos++] = *tmpl++;
+  }
+
+  out[pos] = '\0';
+  return pos;
+}
+
+uint32_t haDiscoveryHash()
+{
+  uint32_t hash = HA_DISCOVERY_HASH;
+  for (const char *p = haNodeId(); *p; ++p)
+  {
+    hash ^= (uint8_t)*p;
+    hash *= 0x01000193;
+  }
+  char fallback[16];
+  for (const char *p = discoveryName(fallback, sizeof(fallback)); *p; ++p)
+  {
+    hash ^= (uint8_t)*p;
+    hash *= 0x01000193;
+  }
+  hash ^= CONSOLE_CHANNELS;
+  hash *= 0x01000193;
+  return hash;
+}
@@ -0,0 +1,69 @@
+// Generated by firmware/scripts/generate_ha_discovery.py, do not edit
+#include "ha_discovery.h"
+
+const HaDiscoveryEntry haDiscoveryEntries[] = {
+    {"homeassistant/light/{node}{chid}/config",
+     "{\"name\":\"Console LED Strip{chn}\",\"uniq_id\":\"{node}{chid}\",\"cmd_t\":\"console/{node}/{ch}ha/set\",\"stat_t\":\"console/{node}/{ch}ha/state\",\"avty_t\":\"console/{node}/status\",\"pl_avail\":\"1\",\"pl_not_avail\":\"0\",\"schema\":\"json\",\"color_mode\":true,\"optimistic\":false,\"icon\":\"mdi:led-strip\",\"supported_color_modes\":[\"rgb\"],\"effect\":true,\"effect_list\":[\"solid\",\"breathing\",\"chase\",\"gradient\",\"rainbow\"],\"device\":{\"ids\":[\"console_{node}\"],\"name\":\"{name}\",\"mf\":\"Kostecki\",\"mdl\":\"Console LED Trigger\",\"sw\":\"1.0.0\"}}",
+     true},
+    {"homeassistant/button/{node}/identify{chid}/config",
+     "{\"name\":\"Identify{chn}\",\"uniq_id\":\"{node}_identify{chid}\",\"cmd_t\":\"console/{node}/{ch}identify\",\"payload_press\":\"1\",\"icon\":\"mdi:magnify\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/button/{node}/reboot/config",
+     "{\"name\":\"Reboot\",\"uniq_id\":\"{node}_reboot\",\"cmd_t\":\"console/{node}/reboot\",\"payload_press\":\"1\",\"icon\":\"mdi:reload\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/button/{node}/calibrate{chid}/config",
+     "{\"name\":\"Start Calibration{chn}\",\"uniq_id\":\"{node}_calibrate{chid}\",\"cmd_t\":\"console/{node}/{ch}calibrate\",\"payload_press\":\"1\",\"icon\":\"mdi:lightning-bolt\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/number/{node}/offset{chid}/config",
+     "{\"name\":\"Threshold offset{chn}\",\"uniq_id\":\"{node}_offset{chid}\",\"cmd_t\":\"console/{node}/{ch}offset/set\",\"stat_t\":\"console/{node}/{ch}offset/state\",\"mode\":\"box\",\"min\":0,\"max\":5000,\"step\":1,\"entity_category\":\"config\",\"icon\":\"mdi:arrow-expand-horizontal\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/sensor/{node}/threshold{chid}/config",
+     "{\"name\":\"Baseline{chn}\",\"uniq_id\":\"{node}_threshold{chid}\",\"stat_t\":\"console/{node}/{ch}threshold/state\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/sensor/{node}/th_on{chid}/config",
+     "{\"name\":\"Threshold (on){chn}\",\"uniq_id\":\"{node}_th_on{chid}\",\"stat_t\":\"console/{node}/{ch}th_on/state\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/sensor/{node}/th_off{chid}/config",
+     "{\"name\":\"Threshold (off){chn}\",\"uniq_id\":\"{node}_th_off{chid}\",\"stat_t\":\"console/{node}/{ch}th_off/state\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     true},
+    {"homeassistant/sensor/{node}/loop_wifi/config",
+     "{\"name\":\"Loop wifi p99\",\"uniq_id\":\"{node}_loop_wifi\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.wifi.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_net_init/config",
+     "{\"name\":\"Loop net_init p99\",\"uniq_id\":\"{node}_loop_net_init\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.net_init.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_mqtt/config",
+     "{\"name\":\"Loop mqtt p99\",\"uniq_id\":\"{node}_loop_mqtt\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.mqtt.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_ota/config",
+     "{\"name\":\"Loop ota p99\",\"uniq_id\":\"{node}_loop_ota\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.ota.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_input/config",
+     "{\"name\":\"Loop input p99\",\"uniq_id\":\"{node}_loop_input\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.input.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_adc/config",
+     "{\"name\":\"Loop adc p99\",\"uniq_id\":\"{node}_loop_adc\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.adc.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_led/config",
+     "{\"name\":\"Loop led p99\",\"uniq_id\":\"{node}_loop_led\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.led.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_network/config",
+     "{\"name\":\"Loop network p99\",\"uniq_id\":\"{node}_loop_network\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.network.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/loop_control/config",
+     "{\"name\":\"Loop control p99\",\"uniq_id\":\"{node}_loop_control\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.control.p99 | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+    {"homeassistant/sensor/{node}/led_frame/config",
+     "{\"name\":\"LED frame avg\",\"uniq_id\":\"{node}_led_frame\",\"stat_t\":\"console/{node}/diag/loop\",\"val_tpl\":\"{{ value_json.frame.avg_us | default(0) }}\",\"unit_of_meas\":\"µs\",\"entity_category\":\"diagnostic\",\"device\":{\"ids\":[\"console_{node}\"]}}",
+     false},
+};
+
+const uint8_t HA_DISCOVERY_COUNT = sizeof(haDiscoveryEntries) / sizeof(haDiscoveryEntries[0]);
+
+const char *const haDiscoveryRetired[] = {
+    "homeassistant/sensor/{node}/loop_buttons/config",
+    "homeassistant/sensor/{node}/loop_encoder/config",
+};
+
+const uint8_t HA_DISCOVERY_RETIRED_COUNT = sizeof(haDiscoveryRetired) / sizeof(haDiscoveryRetired[0]);
+const uint32_t HA_DISCOVERY_HASH = 0x1EB95496;
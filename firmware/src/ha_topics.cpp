@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <ctype.h>
+
+#include <ha_topics.h>
+#include <config.h>
+
+static constexpr size_t TOPIC_LEN = 64;
+
+static char macSuffix[7];
+static char nodeId[16];
+static char objectId[24];
+static char deviceId[24];
+
+static char cmdPrefix[TOPIC_LEN];
+static char deviceStateTopic[TOPIC_LEN];
+static char setCmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char deviceStateMsgPackTopic[TOPIC_LEN];
+static char setMsgPackCmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char fwUpdateCmdTopic[TOPIC_LEN];
+static char fwStatusTopic[TOPIC_LEN];
+static char captureCmdTopic[TOPIC_LEN];
+
+static char cmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char stateTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char availTopic[TOPIC_LEN];
+
+static char offsetCmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char offsetStateTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+
+static char baseStateTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char thOnStateTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char thOffStateTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+
+static char diagLoopTopic[TOPIC_LEN];
+static char diagAdcTopic[TOPIC_LEN];
+
+static char identifyCmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+static char rebootCmdTopic[TOPIC_LEN];
+static char calibrateCmdTopic[CONSOLE_CHANNELS][TOPIC_LEN];
+
+static void deviceTopic(char *out, const char *suffix)
+{
+  snprintf(out, TOPIC_LEN, "console/%s/%s", nodeId, suffix);
+}
+
+static void channelTopic(char (*out)[TOPIC_LEN], const char *suffix)
+{
+  deviceTopic(out[0], suffix);
+  for (uint8_t ch = 1; ch < CONSOLE_CHANNELS; ++ch)
+    snprintf(out[ch], TOPIC_LEN, "console/%s/ch%u/%s", nodeId, ch, suffix);
+}
+
+static uint8_t clampChannel(uint8_t channel)
+{
+  return channel < CONSOLE_CHANNELS ? channel : 0;
+}
+
+void haTopicsBegin(const char *suffix)
+{
+  snprintf(macSuffix, sizeof(macSuffix), "%s", suffix);
+
+  char lower[sizeof(macSuffix)];
+  for (size_t i = 0; i < sizeof(lower); ++i)
+    lower[i] = (char)tolower((unsigned char)macSuffix[i]);
+
+  snprintf(nodeId, sizeof(nodeId), "board-%s", lower);
+  snprintf(objectId, sizeof(objectId), "%s-light", nodeId);
+  snprintf(deviceId, sizeof(deviceId), "console_%s", nodeId);
+
+  deviceTopic(cmdPrefix, "");
+  deviceTopic(deviceStateTopic, "state");
+  channelTopic(setCmdTopic, "set");
+  deviceTopic(deviceStateMsgPackTopic, "state/msgpack");
+  channelTopic(setMsgPackCmdTopic, "set/msgpack");
+  deviceTopic(fwUpdateCmdTopic, "fw-update");
+  deviceTopic(fwStatusTopic, "fw-update/status");
+  deviceTopic(captureCmdTopic, "capture");
+
+  channelTopic(cmdTopic, "ha/set");
+  channelTopic(stateTopic, "ha/state");
+  deviceTopic(availTopic, "status");
+
+  channelTopic(offsetCmdTopic, "offset/set");
+  channelTopic(offsetStateTopic, "offset/state");
+
+  channelTopic(baseStateTopic, "threshold/state");
+  channelTopic(thOnStateTopic, "th_on/state");
+  channelTopic(thOffStateTopic, "th_off/state");
+
+  deviceTopic(diagLoopTopic, "diag/loop");
+  deviceTopic(diagAdcTopic, "diag/adc");
+
+  channelTopic(identifyCmdTopic, "identify");
+  deviceTopic(rebootCmdTopic, "reboot");
+  channelTopic(calibrateCmdTopic, "calibrate");
+}
+
+const char *haMacSuffix() { return macSuffix; }
+const char *haNodeId() { return nodeId; }
+const char *haObjectId() { return objectId; }
+const char *haDeviceId() { return deviceId; }
+
+const char *haCmdPrefix() { return cmdPrefix; }
+const char *haDeviceStateTopic() { return deviceStateTopic; }
+const char *haSetCmdTopic(uint8_t channel) { return setCmdTopic[clampChannel(channel)]; }
+const char *haDeviceStateMsgPackTopic() { return deviceStateMsgPackTopic; }
+const char *haSetMsgPackCmdTopic(uint8_t channel) { return setMsgPackCmdTopic[clampChannel(channel)]; }
+const char *haFwUpdateCmdTopic() { return fwUpdateCmdTopic; }
+const char *haFwStatusTopic() { return fwStatusTopic; }
+const char *haCaptureCmdTopic() { return captureCmdTopic; }
+
+const char *haCmdTopic(uint8_t channel) { return cmdTopic[clampChannel(channel)]; }
+const char *haStateTopic(uint8_t channel) { return stateTopic[clampChannel(channel)]; }
+const char *haAvailTopic() { return availTopic; }
+
+const char *haOffsetCmdTopic(uint8_t channel) { return offsetCmdTopic[clampChannel(channel)]; }
+const char *haOffsetStateTopic(uint8_t channel) { return offsetStateTopic[clampChannel(channel)]; }
+
+const char *haBaseStateTopic(uint8_t channel) { return baseStateTopic[clampChannel(channel)]; }
+const char *haThOnStateTopic(uint8_t channel) { return thOnStateTopic[clampChannel(channel)]; }
+const char *haThOffStateTopic(uint8_t channel) { return thOffStateTopic[clampChannel(channel)]; }
+
+const char *haDiagLoopTopic() { return diagLoopTopic; }
+const char *haDiagAdcTopic() { return diagAdcTopic; }
+
+const char *haIdentifyCmdTopic(uint8_t channel) { return identifyCmdTopic[clampChannel(channel)]; }
+const char *haRebootCmdTopic() { return rebootCmdTopic; }
+const char *haCalibrateCmdTopic(uint8_t channel) { return calibrateCmdTopic[clampChannel(channel)]; }
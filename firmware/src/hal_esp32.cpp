@@ -0,0 +1,468 @@
+#include <string.h>
+#include <atomic>
+#include <Arduino.h>
+#include <Preferences.h>
+#include <RotaryEncoder.h>
+#include <Adafruit_NeoPixel.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <driver/adc.h>
+#include <driver/gpio.h>
+#include <driver/rmt.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+
+#include <adc_sampler.h>
+#include <input_events.h>
+#include <scheduler.h>
+#include <serial_mux.h>
+
+#include <hal.h>
+#include <pins.h>
+#include <config.h>
+#include <wifi_mqtt_ota_setup.h>
+
+// LED Setup
+// Frames go out through the RMT peripheral in the background, so show()
+// returns at once and never masks interrupts. Adafruit_NeoPixel, which
+// bit-bangs with interrupts off, is only used if the RMT channel can't be set up.
+static Adafruit_NeoPixel strip(NUM_PIXELS, LED_PIN, NEO_GRB + NEO_KHZ800);
+
+static constexpr rmt_channel_t LED_RMT_CHANNEL = RMT_CHANNEL_0;
+static constexpr uint8_t LED_RMT_CLK_DIV = 2; // 40 MHz, 25 ns ticks
+
+static bool ledRmt = false;
+static uint16_t ledCount = NUM_PIXELS;
+static uint8_t ledPending[LED_MAX_PIXELS * 3]; // GRB, written by halPixelsSet()
+static uint8_t ledSending[LED_MAX_PIXELS * 3]; // Read by the RMT driver during a transmission
+
+// WS2812 bit timings in 25 ns ticks: 0 = 0.4 us high, 0.85 us low; 1 = 0.8 us high, 0.45 us low
+static const rmt_item32_t WS2812_ZERO = {{{16, 1, 34, 0}}};
+static const rmt_item32_t WS2812_ONE = {{{32, 1, 18, 0}}};
+
+// Called by the RMT driver from its ISR as it needs more items
+static void IRAM_ATTR ws2812Translate(const void *src, rmt_item32_t *dest, size_t srcSize, size_t wantedNum,
+                                      size_t *translatedSize, size_t *itemNum)
+{
+  const uint8_t *bytes = (const uint8_t *)src;
+  size_t size = 0;
+  size_t num = 0;
+  while (size < srcSize && num + 8 <= wantedNum)
+  {
+    for (uint8_t bit = 0; bit < 8; ++bit)
+      dest[num++] = (bytes[size] & (0x80 >> bit)) ? WS2812_ONE : WS2812_ZERO;
+    size++;
+  }
+  *translatedSize = size;
+  *itemNum = num;
+}
+
+static bool ledRmtBegin()
+{
+  rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)LED_PIN, LED_RMT_CHANNEL);
+  config.clk_div = LED_RMT_CLK_DIV;
+
+  if (rmt_config(&config) != ESP_OK)
+    return false;
+  if (rmt_driver_install(LED_RMT_CHANNEL, 0, 0) != ESP_OK)
+    return false;
+  if (rmt_translator_init(LED_RMT_CHANNEL, ws2812Translate) != ESP_OK)
+  {
+    rmt_driver_uninstall(LED_RMT_CHANNEL);
+    return false;
+  }
+  return true;
+}
+
+// Encoder Setup
+static RotaryEncoder encoder(ENCODER_A, ENCODER_B, RotaryEncoder::LatchMode::FOUR3);
+static long encoderPosition = 0;
+
+// Light sleep can only be left through level wake-ups, and arming one
+// replaces the pin's edge interrupt. All inputs idle HIGH, so while armed a
+// LOW level on any of them wakes the chip, and its interrupt switches every
+// pin back to edges before anything else.
+static constexpr uint8_t INPUT_PINS[] = {ENCODER_A, ENCODER_B, ENCODER_SW, POWER_CALIBRATE_PIN, WIFI_RESET};
+static volatile bool inputWakeArmed = false;
+
+static void inputWakeDisarm()
+{
+  inputWakeArmed = false;
+  for (uint8_t pin : INPUT_PINS)
+  {
+    gpio_wakeup_disable((gpio_num_t)pin);
+    gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_ANYEDGE);
+  }
+}
+
+// Every detent becomes its own event, however long until the control task looks
+static void encoderIsr()
+{
+  if (inputWakeArmed)
+    inputWakeDisarm();
+
+  encoder.tick();
+  long position = encoder.getPosition();
+  while (position != encoderPosition)
+  {
+    int8_t direction = position > encoderPosition ? 1 : -1;
+    encoderPosition += direction;
+    inputIsrTurn(direction, millis());
+  }
+}
+
+static void buttonIsr(void *arg)
+{
+  if (inputWakeArmed)
+    inputWakeDisarm();
+
+  uint8_t pin = (uint8_t)(uintptr_t)arg;
+  inputIsrPin(pin, digitalRead(pin) == HIGH, millis());
+}
+
+void halInputWakeArm(bool armed)
+{
+  if (!armed)
+  {
+    if (inputWakeArmed)
+      inputWakeDisarm();
+    return;
+  }
+
+  // A pin that is already LOW would wake the chip straight away
+  for (uint8_t pin : INPUT_PINS)
+  {
+    if (digitalRead(pin) == LOW)
+      return;
+  }
+
+  inputWakeArmed = true;
+  for (uint8_t pin : INPUT_PINS)
+    gpio_wakeup_enable((gpio_num_t)pin, GPIO_INTR_LOW_LEVEL);
+}
+
+// Task wake-ups
+static TaskHandle_t wakeHandles[static_cast<uint8_t>(LoopTask::Count)];
+
+void halWakeRegister(uint8_t task) { wakeHandles[task] = xTaskGetCurrentTaskHandle(); }
+void halWaitForWake(uint32_t timeoutMs) { ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs)); }
+
+void halWakeTask(uint8_t task)
+{
+  TaskHandle_t handle = wakeHandles[task];
+  if (!handle)
+    return;
+
+  if (xPortInIsrContext())
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(handle, &woken);
+    if (woken)
+      portYIELD_FROM_ISR();
+  }
+  else
+  {
+    xTaskNotifyGive(handle);
+  }
+}
+
+// Power management
+// The IDF build needs tickless idle for automatic light sleep; without it
+// esp_pm_configure() refuses and only the frequency scales.
+static bool lightSleep = false;
+
+void halPowerBegin()
+{
+  esp_sleep_enable_gpio_wakeup();
+
+  esp_pm_config_esp32c3_t config = {};
+  config.max_freq_mhz = getCpuFrequencyMhz();
+  config.min_freq_mhz = getXtalFrequencyMhz();
+  config.light_sleep_enable = true;
+  lightSleep = esp_pm_configure(&config) == ESP_OK;
+  if (!lightSleep)
+  {
+    config.light_sleep_enable = false;
+    esp_pm_configure(&config);
+  }
+
+  Serial.printf("Power management: %s\n", lightSleep ? "light sleep between events" : "frequency scaling only");
+}
+
+bool halLightSleepAvailable() { return lightSleep; }
+
+void halBegin()
+{
+  // Initialize Pins
+  pinMode(ENCODER_SW, INPUT_PULLUP);
+  for (uint8_t i = 0; i < CONSOLE_CHANNELS; ++i)
+    pinMode(CURRENT_SENSE_PINS[i], INPUT);
+  pinMode(POWER_CALIBRATE_PIN, INPUT_PULLUP);
+  pinMode(WIFI_RESET, INPUT_PULLUP);
+
+  attachInterrupt(digitalPinToInterrupt(ENCODER_A), encoderIsr, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(ENCODER_B), encoderIsr, CHANGE);
+  for (uint8_t pin : {ENCODER_SW, POWER_CALIBRATE_PIN, WIFI_RESET})
+    attachInterruptArg(digitalPinToInterrupt(pin), buttonIsr, (void *)(uintptr_t)pin, CHANGE);
+
+  ledRmt = ledRmtBegin();
+  if (!ledRmt)
+  {
+    Serial.println("RMT unavailable, falling back to bit-banged LED output");
+    strip.begin();
+    strip.clear();
+  }
+  halPixelsShow();
+}
+
+// Clock
+uint32_t halMillis() { return millis(); }
+uint32_t halMicros() { return micros(); }
+uint32_t halCycles() { return ESP.getCycleCount(); }
+uint32_t halCyclesPerMicro() { return ESP.getCpuFreqMHz(); }
+
+// ADC
+int halAdcRead(uint8_t pin) { return analogRead(pin); }
+
+static constexpr uint32_t ADC_DMA_FRAME_BYTES = 256;
+static constexpr uint32_t ADC_READ_TIMEOUT = 20; // ms, bounds how long a pause goes unnoticed
+static int8_t adcStreamIndex[SOC_ADC_MAX_CHANNEL_NUM]; // ADC1 channel -> sampler channel, -1 if unused
+static uint8_t adcStreamPins[SOC_ADC_PATT_LEN_MAX];
+static uint8_t adcStreamPinCount = 0;
+static std::atomic<uint32_t> adcPollInterval{0}; // ms, non-zero while paused
+
+// Drains the DMA driver into the sampler ring. The conversion rate is set by
+// the ADC hardware, this task only moves finished frames. While the stream is
+// paused it polls the pins itself once the DMA buffer is empty, so the ring
+// keeps its single producer.
+static void adcReaderTask(void *)
+{
+  uint8_t frame[ADC_DMA_FRAME_BYTES];
+  bool polling = false;
+  uint32_t lastPoll = 0;
+  for (;;)
+  {
+    uint32_t pollMs = adcPollInterval.load();
+    uint32_t length = 0;
+    if (adc_digi_read_bytes(frame, sizeof(frame), &length, pollMs ? 0 : ADC_READ_TIMEOUT) == ESP_OK)
+    {
+      for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES)
+      {
+        const adc_digi_output_data_t *out = reinterpret_cast<const adc_digi_output_data_t *>(&frame[i]);
+        if (out->type2.unit == 0 && out->type2.channel < SOC_ADC_MAX_CHANNEL_NUM && adcStreamIndex[out->type2.channel] >= 0)
+          adcSamplerPush(adcStreamIndex[out->type2.channel], out->type2.data);
+      }
+      schedulerWake(LoopTask::Control, WakeReason::Adc);
+      continue;
+    }
+
+    if (pollMs == 0)
+    {
+      polling = false;
+      continue;
+    }
+
+    // Paused and drained: first poll right away, then every pollMs
+    uint32_t now = millis();
+    if (!polling)
+    {
+      polling = true;
+      lastPoll = now - pollMs;
+    }
+    if (now - lastPoll < pollMs)
+    {
+      vTaskDelay(pdMS_TO_TICKS(pollMs - (now - lastPoll)));
+      continue;
+    }
+
+    lastPoll = now;
+    for (uint8_t i = 0; i < adcStreamPinCount; ++i)
+      adcSamplerPush(i, analogRead(adcStreamPins[i]));
+    schedulerWake(LoopTask::Control, WakeReason::Adc);
+  }
+}
+
+bool halAdcStreamBegin(const uint8_t *pins, uint8_t count, uint32_t sampleRateHz)
+{
+  // Same attenuation as analogRead() so thresholds stay comparable. The
+  // controller walks the pattern table in order, one conversion per entry.
+  adc_digi_pattern_config_t patterns[SOC_ADC_PATT_LEN_MAX] = {};
+  uint32_t channelMask = 0;
+  if (count == 0 || count > SOC_ADC_PATT_LEN_MAX)
+    return false;
+
+  memset(adcStreamIndex, -1, sizeof(adcStreamIndex));
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    int8_t channel = digitalPinToAnalogChannel(pins[i]);
+    if (channel < 0 || channel >= SOC_ADC_CHANNEL_NUM(0))
+      return false;
+
+    adcStreamIndex[channel] = i;
+    adcStreamPins[i] = pins[i];
+    channelMask |= BIT(channel);
+    patterns[i].atten = ADC_ATTEN_DB_11;
+    patterns[i].channel = channel;
+    patterns[i].unit = 0;
+    patterns[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  }
+
+  adcStreamPinCount = count;
+
+  adc_digi_init_config_t initConfig = {};
+  initConfig.max_store_buf_size = ADC_DMA_FRAME_BYTES * 4;
+  initConfig.conv_num_each_intr = ADC_DMA_FRAME_BYTES;
+  initConfig.adc1_chan_mask = channelMask;
+  initConfig.adc2_chan_mask = 0;
+  if (adc_digi_initialize(&initConfig) != ESP_OK)
+    return false;
+
+  // The conversion rate is shared by the pattern, so each pin keeps its rate
+  adc_digi_configuration_t digiConfig = {};
+  digiConfig.conv_limit_en = false;
+  digiConfig.pattern_num = count;
+  digiConfig.adc_pattern = patterns;
+  digiConfig.sample_freq_hz = sampleRateHz * count;
+  digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digiConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+  if (adc_digi_controller_configure(&digiConfig) != ESP_OK || adc_digi_start() != ESP_OK)
+  {
+    adc_digi_deinitialize();
+    return false;
+  }
+
+  return xTaskCreate(adcReaderTask, "adc_reader", 3072, nullptr, configMAX_PRIORITIES - 2, nullptr) == pdPASS;
+}
+
+// Stopping the conversions also releases the driver's PM lock
+void halAdcStreamPause(bool paused, uint32_t pollIntervalMs)
+{
+  if (paused)
+  {
+    adc_digi_stop();
+    adcPollInterval.store(pollIntervalMs);
+  }
+  else
+  {
+    adcPollInterval.store(0);
+    adc_digi_start();
+  }
+}
+
+// GPIO
+bool halGpioRead(uint8_t pin) { return digitalRead(pin) == HIGH; }
+
+// Pixel output
+void halPixelsBegin(uint16_t count)
+{
+  if (count > LED_MAX_PIXELS)
+    count = LED_MAX_PIXELS;
+
+  if (ledRmt)
+    rmt_wait_tx_done(LED_RMT_CHANNEL, portMAX_DELAY);
+  else
+    strip.updateLength(count);
+
+  ledCount = count;
+  memset(ledPending, 0, sizeof(ledPending));
+}
+
+void halPixelsSet(uint16_t index, uint32_t color)
+{
+  if (!ledRmt)
+  {
+    strip.setPixelColor(index, color);
+    return;
+  }
+
+  if (index >= ledCount)
+    return;
+  uint8_t *grb = ledPending + index * 3;
+  grb[0] = (uint8_t)(color >> 8);
+  grb[1] = (uint8_t)(color >> 16);
+  grb[2] = (uint8_t)color;
+}
+
+void halPixelsShow()
+{
+  if (!ledRmt)
+  {
+    strip.show();
+    return;
+  }
+
+  // A frame takes ~30 us per pixel and the frame interval is stretched to
+  // cover it, so the previous one is normally done; otherwise wait it out
+  // rather than tear it
+  size_t bytes = (size_t)ledCount * 3;
+  rmt_wait_tx_done(LED_RMT_CHANNEL, pdMS_TO_TICKS(ledCount * 30 / 1000 + 5));
+  memcpy(ledSending, ledPending, bytes);
+  rmt_write_sample(LED_RMT_CHANNEL, ledSending, bytes, false);
+}
+
+// NVS
+bool halNvsHasKey(const char *key) { return prefs.isKey(key); }
+int32_t halNvsGetInt(const char *key, int32_t defaultValue) { return prefs.getInt(key, defaultValue); }
+void halNvsPutInt(const char *key, int32_t value) { prefs.putInt(key, value); }
+uint8_t halNvsGetUChar(const char *key, uint8_t defaultValue) { return prefs.getUChar(key, defaultValue); }
+void halNvsPutUChar(const char *key, uint8_t value) { prefs.putUChar(key, value); }
+size_t halNvsGetString(const char *key, char *buf, size_t len) { return prefs.getString(key, buf, len); }
+void halNvsPutString(const char *key, const char *value) { prefs.putString(key, value); }
+
+// Firmware download
+static WiFiClient httpClient;
+static HTTPClient http;
+
+bool halHttpBegin(const char *url, int32_t &contentLength)
+{
+  // Connecting and reading the headers still block, up to OTA_HTTP_TIMEOUT
+  http.setConnectTimeout(OTA_HTTP_TIMEOUT);
+  http.setTimeout(OTA_HTTP_TIMEOUT);
+  if (!http.begin(httpClient, url))
+    return false;
+
+  int httpCode = http.GET();
+  if (httpCode != HTTP_CODE_OK)
+  {
+    Serial.printf("HTTP GET failed: %d\n", httpCode);
+    http.end();
+    return false;
+  }
+
+  contentLength = http.getSize();
+  return true;
+}
+
+int32_t halHttpRead(uint8_t *buf, size_t len)
+{
+  WiFiClient *stream = http.getStreamPtr();
+  if (!stream)
+    return -1;
+
+  int available = stream->available();
+  if (available <= 0)
+    return stream->connected() ? 0 : -1;
+
+  if ((size_t)available < len)
+    len = available;
+  return stream->read(buf, len);
+}
+
+void halHttpEnd() { http.end(); }
+
+// Firmware flashing
+bool halOtaBegin(size_t size) { return Update.begin(size); }
+bool halOtaWrite(const uint8_t *data, size_t len) { return Update.write(const_cast<uint8_t *>(data), len) == len; }
+
+bool halOtaEnd()
+{
+  if (!Update.end())
+  {
+    Serial.printf("Update failed. Error: %s\n", Update.errorString());
+    return false;
+  }
+  return Update.isFinished();
+}
+
+void halOtaAbort() { Update.abort(); }
+void halRestart() { ESP.restart(); }
@@ -0,0 +1,173 @@
+#include <input_events.h>
+#include <spsc_ring.h>
+#include <config.h>
+#include <pins.h>
+#include <hal.h>
+#include <scheduler.h>
+#include <utils.h>
+
+// Raw input as the interrupt saw it
+struct RawInput
+{
+  uint32_t timeMs;
+  InputSource source;
+  int8_t value; // Turn direction, or 1 while a button reads pressed
+};
+
+struct ButtonInput
+{
+  uint8_t pin;
+  InputSource source;
+  InputConsumer consumer;
+};
+
+// Buttons pull the pin LOW while pressed
+static constexpr ButtonInput BUTTONS[] = {
+    {ENCODER_SW, InputSource::EncoderButton, InputConsumer::Control},
+    {POWER_CALIBRATE_PIN, InputSource::CalibrateButton, InputConsumer::Control},
+    {WIFI_RESET, InputSource::WifiReset, InputConsumer::Network},
+};
+
+// All pin interrupts are served by the one GPIO handler and never preempt
+// each other, so every ring has a single producer
+struct InputQueue
+{
+  SpscRing<RawInput, INPUT_QUEUE_SIZE> raw;
+  SpscRing<InputEvent, INPUT_QUEUE_SIZE> ready; // Debounced, consumer side only
+};
+
+static InputQueue queues[static_cast<uint8_t>(InputConsumer::Count)];
+static std::atomic<uint32_t> dropped{0};
+
+// Interrupt side: last level pushed per button, repeats are bounce noise
+static bool isrPressed[static_cast<uint8_t>(InputSource::Count)];
+
+// Consumer side
+struct Debounce
+{
+  bool stable;
+  bool raw;
+  uint32_t rawSince;
+};
+
+static Debounce debounce[static_cast<uint8_t>(InputSource::Count)];
+static int8_t lastTurnDirection = 0;
+static uint32_t lastTurnMs = 0;
+
+void inputBegin()
+{
+  for (const ButtonInput &button : BUTTONS)
+  {
+    bool pressed = !halGpioRead(button.pin);
+    isrPressed[static_cast<uint8_t>(button.source)] = pressed;
+    debounce[static_cast<uint8_t>(button.source)] = {pressed, pressed, halMillis()};
+  }
+}
+
+static void push(InputConsumer consumer, const RawInput &input)
+{
+  if (!queues[static_cast<uint8_t>(consumer)].raw.push(input))
+    dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+  schedulerWake(consumer == InputConsumer::Control ? LoopTask::Control : LoopTask::Network, WakeReason::Input);
+}
+
+void inputIsrTurn(int8_t direction, uint32_t timeMs)
+{
+  push(InputConsumer::Control, {timeMs, InputSource::Encoder, direction});
+}
+
+void inputIsrPin(uint8_t pin, bool high, uint32_t timeMs)
+{
+  for (const ButtonInput &button : BUTTONS)
+  {
+    if (button.pin != pin)
+      continue;
+
+    bool &last = isrPressed[static_cast<uint8_t>(button.source)];
+    if (last == !high)
+      return;
+
+    last = !high;
+    push(button.consumer, {timeMs, button.source, (int8_t)!high});
+    return;
+  }
+}
+
+// A button level counts once it has held for INPUT_DEBOUNCE, either up to
+// the next edge or up to now. The event carries the time it started.
+static void settle(InputQueue &queue, InputSource source, uint32_t nowMs)
+{
+  Debounce &d = debounce[static_cast<uint8_t>(source)];
+  if (d.raw == d.stable || (int32_t)(nowMs - d.rawSince) < (int32_t)INPUT_DEBOUNCE)
+    return;
+
+  d.stable = d.raw;
+  queue.ready.push({source, d.stable ? InputType::Press : InputType::Release, 0, d.rawSince, 0});
+}
+
+bool inputPoll(InputConsumer consumer, InputEvent &event)
+{
+  InputQueue &queue = queues[static_cast<uint8_t>(consumer)];
+  uint32_t now = halMillis();
+
+  // Every raw input adds at most one event, so stop before ready can overflow
+  RawInput raw;
+  while (queue.ready.size() < queue.ready.capacity() && queue.raw.pop(raw))
+  {
+    if (raw.source == InputSource::Encoder)
+    {
+      uint32_t interval = raw.value == lastTurnDirection ? raw.timeMs - lastTurnMs : UINT32_MAX;
+      lastTurnDirection = raw.value;
+      lastTurnMs = raw.timeMs;
+      queue.ready.push({raw.source, InputType::Turn, raw.value, raw.timeMs, interval});
+      continue;
+    }
+
+    settle(queue, raw.source, raw.timeMs);
+    Debounce &d = debounce[static_cast<uint8_t>(raw.source)];
+    d.raw = raw.value != 0;
+    d.rawSince = raw.timeMs;
+  }
+
+  if (queue.ready.pop(event))
+    return true;
+
+  for (const ButtonInput &button : BUTTONS)
+  {
+    if (button.consumer == consumer)
+      settle(queue, button.source, now);
+  }
+  return queue.ready.pop(event);
+}
+
+uint32_t inputIdleMs(InputConsumer consumer, uint32_t nowMs)
+{
+  const InputQueue &queue = queues[static_cast<uint8_t>(consumer)];
+  if (queue.raw.size() || queue.ready.size())
+    return 0;
+
+  uint32_t idle = UINT32_MAX;
+  for (const ButtonInput &button : BUTTONS)
+  {
+    const Debounce &d = debounce[static_cast<uint8_t>(button.source)];
+    if (button.consumer != consumer || d.raw == d.stable)
+      continue;
+
+    uint32_t left = msUntil(d.rawSince + INPUT_DEBOUNCE, nowMs);
+    idle = left < idle ? left : idle;
+  }
+  return idle;
+}
+
+uint8_t inputAccelStep(uint32_t intervalMs)
+{
+  if (intervalMs >= ENCODER_ACCEL_SLOW)
+    return 1;
+  if (intervalMs <= ENCODER_ACCEL_FAST)
+    return ENCODER_ACCEL_MAX_STEP;
+
+  return 1 + (ENCODER_ACCEL_MAX_STEP - 1) * (ENCODER_ACCEL_SLOW - intervalMs) / (ENCODER_ACCEL_SLOW - ENCODER_ACCEL_FAST);
+}
+
+uint32_t inputDropped() { return dropped.load(std::memory_order_relaxed); }
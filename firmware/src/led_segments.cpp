@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <led_segments.h>
+#include <framebuffer.h>
+#include <config.h>
+#include <hal.h>
+#include <serial_mux.h>
+
+static_assert(LED_MAX_SEGMENTS >= CONSOLE_CHANNELS, "every channel needs a segment of its own");
+
+static LedSegment segments[LED_MAX_SEGMENTS];
+static uint8_t segmentCount = 0;
+static uint16_t pixelCount = NUM_PIXELS;
+static char layoutText[LED_LAYOUT_TEXT_LEN] = "";
+static uint32_t generation = 0;
+
+bool segmentsParse(const char *layout, uint16_t count, LedSegment *out, uint8_t &outCount)
+{
+  outCount = 0;
+  if (count < CONSOLE_CHANNELS || count > LED_MAX_PIXELS)
+    return false;
+
+  if (!layout || !layout[0])
+  {
+    for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    {
+      uint16_t start = (uint32_t)count * ch / CONSOLE_CHANNELS;
+      uint16_t end = (uint32_t)count * (ch + 1) / CONSOLE_CHANNELS;
+      out[ch] = {start, (uint16_t)(end - start), Effect::Solid, false, ch};
+    }
+    outCount = CONSOLE_CHANNELS;
+    return true;
+  }
+
+  if (strlen(layout) >= LED_LAYOUT_TEXT_LEN)
+    return false;
+
+  const char *p = layout;
+  uint32_t nextFree = 0;
+  while (*p)
+  {
+    if (outCount >= LED_MAX_SEGMENTS)
+      return false;
+
+    char *end;
+    uint32_t first = strtoul(p, &end, 10);
+    if (end == p)
+      return false;
+    uint32_t last = first;
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtoul(p, &end, 10);
+      if (end == p)
+        return false;
+    }
+    // Ascending and non-overlapping
+    if (first < nextFree || last < first || last >= count)
+      return false;
+
+    LedSegment &segment = out[outCount];
+    segment = {(uint16_t)first, (uint16_t)(last - first + 1), Effect::Solid, false, 0};
+    p = end;
+
+    if (*p == '@')
+    {
+      uint32_t channel = strtoul(++p, &end, 10);
+      if (end == p || channel >= CONSOLE_CHANNELS)
+        return false;
+      segment.channel = (uint8_t)channel;
+      p = end;
+    }
+
+    if (*p == ':')
+    {
+      char name[16];
+      size_t len = strcspn(++p, ",");
+      if (len == 0 || len >= sizeof(name))
+        return false;
+      memcpy(name, p, len);
+      name[len] = '\0';
+      if (!effectFromName(name, segment.effect))
+        return false;
+      segment.ownEffect = true;
+      p += len;
+    }
+
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return false;
+
+    nextFree = last + 1;
+    outCount++;
+  }
+
+  return outCount > 0;
+}
+
+static void apply(uint16_t count, const LedSegment *parsed, uint8_t parsedCount)
+{
+  // Blank the old length first, a shorter strip would leave its tail lit
+  fbFill({0, 0, 0});
+  fbShow();
+
+  pixelCount = count;
+  memcpy(segments, parsed, sizeof(LedSegment) * parsedCount);
+  segmentCount = parsedCount;
+
+  halPixelsBegin(pixelCount);
+  fbBegin(pixelCount);
+  generation++;
+
+  Serial.printf("LED layout: %u pixels, %u segment(s) \"%s\", %u bytes\n", pixelCount, segmentCount, layoutText,
+                (unsigned)fbMemoryUsed());
+}
+
+void segmentsBegin()
+{
+  // Rarely changed and longer than the settings cache holds, so straight to NVS
+  uint16_t count = (uint16_t)halNvsGetInt("led_count", NUM_PIXELS);
+  if (halNvsGetString("led_layout", layoutText, sizeof(layoutText)) == 0)
+    layoutText[0] = '\0';
+
+  LedSegment parsed[LED_MAX_SEGMENTS];
+  uint8_t parsedCount;
+  if (!segmentsParse(layoutText, count, parsed, parsedCount))
+  {
+    Serial.println("Stored LED layout invalid, using the default");
+    count = NUM_PIXELS;
+    layoutText[0] = '\0';
+    segmentsParse(layoutText, count, parsed, parsedCount);
+  }
+
+  apply(count, parsed, parsedCount);
+}
+
+bool segmentsConfigure(uint16_t count, const char *layout)
+{
+  if (!layout)
+    layout = layoutText;
+
+  LedSegment parsed[LED_MAX_SEGMENTS];
+  uint8_t parsedCount;
+  if (!segmentsParse(layout, count, parsed, parsedCount))
+  {
+    Serial.printf("Rejected LED layout: %u pixels, \"%s\"\n", count, layout);
+    return false;
+  }
+
+  if (layout != layoutText)
+    snprintf(layoutText, sizeof(layoutText), "%s", layout);
+
+  halNvsPutInt("led_count", count);
+  halNvsPutString("led_layout", layoutText);
+
+  apply(count, parsed, parsedCount);
+  return true;
+}
+
+uint16_t segmentsPixelCount() { return pixelCount; }
+uint8_t segmentsCount() { return segmentCount; }
+const LedSegment &segmentAt(uint8_t index) { return segments[index < segmentCount ? index : 0]; }
+const char *segmentsLayout() { return layoutText; }
+uint32_t segmentsGeneration() { return generation; }
+
+void segmentsToJson(JsonObject obj)
+{
+  obj["pixels"] = pixelCount;
+  obj["segments"] = segmentCount;
+  obj["bytes"] = fbMemoryUsed();
+}
@@ -1,62 +1,299 @@
-#include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
+#include "hal.h"
 #include "state.h"
 #include "config.h"
 #include "colors.h"
 #include "utils.h"
+#include "framebuffer.h"
+#include "effects.h"
+#include "led_segments.h"
 
-void updateLED(bool force)
+// Animation engine
+// Fades are queued as keyframes and advanced by ledTick() from loop(), so
+// nothing in here blocks. Each console channel has its own queue and drives
+// the segments of its zone. Starting a new fade drops whatever is queued and
+// continues from the color currently shown. Colors are interpolated in the
+// linear 16-bit space of the framebuffer, and each segment's effect is drawn
+// on top of the result. Segments whose frame can't have changed are skipped.
+struct Keyframe
 {
-  uint32_t color = 0;
-  if (ledEnabled || force)
-  {
-    if (colorMode == ColorMode::Palette && currentColorIndex < NUM_COLORS)
-      color = colors[currentColorIndex];
-    else
-      color = customColor;
-  }
-  for (int i = 0; i < NUM_PIXELS; ++i)
-    strip.setPixelColor(i, color);
-  strip.show();
+  Rgb16 color;
+  uint16_t fadeMs;
+  uint16_t holdMs;
+};
+
+static constexpr uint8_t MAX_KEYFRAMES = 16;
+
+struct ChannelAnimation
+{
+  Keyframe keyframes[MAX_KEYFRAMES];
+  uint8_t head;
+  uint8_t count;
+  Rgb16 fromColor;  // Color at the start of the running keyframe
+  Rgb16 shownColor; // Base color of the current frame
+  uint32_t stageStart;
+  bool blinking; // Blinks are shown as plain colors
+};
+
+static ChannelAnimation animations[CONSOLE_CHANNELS];
+static uint32_t lastFrameMs = 0;
+
+// What each segment was last drawn with
+struct SegmentState
+{
+  Rgb16 base;
+  Effect effect;
+  bool drawn;
+  bool dithered;
+};
+
+static SegmentState segmentState[LED_MAX_SEGMENTS];
+static uint32_t layoutGeneration = 0;
+static uint32_t frameInterval = LED_FRAME_INTERVAL;
+static bool anyDithered = false;
+static bool anyAnimated = false;
+static uint32_t lastMotionMs = 0; // Last frame where something other than the dither changed
+
+// WS2812 data takes 30 us per pixel; long strips need longer frames
+static constexpr uint32_t WS2812_US_PER_PIXEL = 30;
+
+static void redrawAll()
+{
+  for (uint8_t i = 0; i < LED_MAX_SEGMENTS; ++i)
+    segmentState[i].drawn = false;
 }
 
-void fadeToColor(uint32_t targetColor, uint8_t steps, uint16_t delayMs)
+static Effect segmentEffect(const LedSegment &segment)
 {
-  uint32_t startColor = strip.getPixelColor(0);
-  for (int i = 0; i <= steps; ++i)
+  const ChannelAnimation &anim = animations[segment.channel];
+  if (anim.blinking || !(channels[segment.channel].ledEnabled || anim.count > 0))
+    return Effect::Solid;
+  return segment.ownEffect ? segment.effect : currentEffect;
+}
+
+static void drawFrame(uint32_t now)
+{
+  uint32_t start = halCycles();
+
+  if (layoutGeneration != segmentsGeneration())
   {
-    uint32_t interp = strip.Color(
-        lerpColorComponent((startColor >> 16) & 0xFF, (targetColor >> 16) & 0xFF, i, steps),
-        lerpColorComponent((startColor >> 8) & 0xFF, (targetColor >> 8) & 0xFF, i, steps),
-        lerpColorComponent(startColor & 0xFF, targetColor & 0xFF, i, steps));
+    layoutGeneration = segmentsGeneration();
+    uint32_t wireMs = (uint32_t)segmentsPixelCount() * WS2812_US_PER_PIXEL / 1000 + 1;
+    frameInterval = wireMs > LED_FRAME_INTERVAL ? wireMs : LED_FRAME_INTERVAL;
+    redrawAll();
+  }
 
-    for (int j = 0; j < NUM_PIXELS; ++j)
+  bool changed = false;
+  anyDithered = false;
+  anyAnimated = false;
+  for (uint8_t i = 0; i < segmentsCount(); ++i)
+  {
+    const LedSegment &segment = segmentAt(i);
+    const Rgb16 &base = animations[segment.channel].shownColor;
+    SegmentState &state = segmentState[i];
+    Effect effect = segmentEffect(segment);
+    bool animated = effectAnimated(effect);
+
+    bool moved = !state.drawn || animated || state.effect != effect || state.base != base;
+    if (!moved && !state.dithered)
+      continue;
+
+    // Something changed, dither it again until it settles
+    if (moved)
     {
-      strip.setPixelColor(j, interp);
+      lastMotionMs = now;
+      fbDitherEnable(true);
     }
 
-    strip.show();
-    delay(delayMs);
+    effectRender(effect, base, now, segment.start, segment.length);
+    changed |= fbRender(segment.start, segment.length, state.dithered);
+    state.base = base;
+    state.effect = effect;
+    state.drawn = true;
+    anyDithered |= state.dithered;
+    anyAnimated |= animated;
   }
+
+  if (changed)
+    halPixelsShow();
+  effectFrameRecord(halCycles() - start, changed);
+  lastFrameMs = now;
 }
 
-void blinkConfirm(uint32_t color, int times)
+static void showColor(uint8_t channel, const Rgb16 &color)
 {
-  // Animation constants
-  const uint8_t steps = 10;      // Fade steps
-  const uint16_t stepDelay = 10; // Delay between steps (ms)
-  const uint16_t holdTime = 100; // Time to hold the color/black (ms)
+  animations[channel].shownColor = color;
+  drawFrame(halMillis());
+}
+
+static void clearKeyframes(ChannelAnimation &anim)
+{
+  anim.head = 0;
+  anim.count = 0;
+}
+
+static void pushKeyframe(ChannelAnimation &anim, const Rgb16 &color, uint16_t fadeMs, uint16_t holdMs)
+{
+  if (anim.count >= MAX_KEYFRAMES)
+    return;
+
+  if (anim.count == 0)
+  {
+    anim.fromColor = anim.shownColor;
+    anim.stageStart = halMillis();
+  }
+
+  anim.keyframes[(anim.head + anim.count) % MAX_KEYFRAMES] = {color, fadeMs, holdMs};
+  anim.count++;
+}
+
+static uint32_t targetLedColor(uint8_t channel, bool force)
+{
+  if (!channels[channel].ledEnabled && !force)
+    return 0;
+
+  return channelColor(channels[channel]);
+}
+
+uint32_t channelColor(const ChannelState &channel)
+{
+  if (channel.colorMode == ColorMode::Palette && channel.colorIndex < NUM_COLORS)
+    return colors[channel.colorIndex];
+
+  return channel.customColor;
+}
+
+bool ledAnimating()
+{
+  for (const ChannelAnimation &anim : animations)
+  {
+    if (anim.count > 0)
+      return true;
+  }
+  return false;
+}
+
+void ledSetBrightness(uint8_t brightness)
+{
+  fbSetBrightness(brightness);
+  redrawAll();
+  drawFrame(halMillis());
+}
+
+// Moves a channel's fade along, false when it has nothing queued
+static bool advanceChannel(ChannelAnimation &anim, uint32_t now)
+{
+  if (anim.count == 0)
+  {
+    anim.blinking = false;
+    return false;
+  }
+
+  const Keyframe &kf = anim.keyframes[anim.head];
+  uint32_t elapsed = now - anim.stageStart;
+
+  if (elapsed < kf.fadeMs)
+  {
+    // One divide per frame, the per-channel work is a multiply
+    uint16_t frac = (elapsed << 16) / kf.fadeMs;
+    anim.shownColor = rgb16Lerp(anim.fromColor, kf.color, frac);
+    return true;
+  }
+
+  anim.shownColor = kf.color;
+
+  if (elapsed < (uint32_t)kf.fadeMs + kf.holdMs)
+    return true;
+
+  // Keyframe done, start the next one from where this one ended
+  anim.head = (anim.head + 1) % MAX_KEYFRAMES;
+  anim.count--;
+  anim.fromColor = anim.shownColor;
+  anim.stageStart = now;
+  return true;
+}
+
+void ledTick()
+{
+  uint32_t now = halMillis();
+  if (now - lastFrameMs < frameInterval)
+    return;
+
+  bool fading = false;
+  for (ChannelAnimation &anim : animations)
+    fading |= advanceChannel(anim, now);
+
+  // A static frame only needs redrawing to keep the dither moving, and only
+  // for LED_DITHER_SETTLE: then it is drawn once more rounded and left alone
+  if (anyDithered && !fading && !anyAnimated && now - lastMotionMs >= LED_DITHER_SETTLE)
+    fbDitherEnable(false);
+
+  if (fading || anyAnimated || anyDithered || layoutGeneration != segmentsGeneration())
+    drawFrame(now);
+}
+
+uint32_t ledIdleMs(uint32_t nowMs)
+{
+  if (!ledAnimating() && !anyAnimated && !anyDithered && layoutGeneration == segmentsGeneration())
+    return UINT32_MAX;
+
+  return msUntil(lastFrameMs + frameInterval, nowMs);
+}
+
+void updateLED(uint8_t channel, bool force)
+{
+  ChannelAnimation &anim = animations[channel];
+  Rgb16 color = rgb16FromColor(targetLedColor(channel, force));
+
+  if (anim.count == 0)
+  {
+    showColor(channel, color);
+    return;
+  }
+
+  // Retarget a running fade, keeping whatever time it had left
+  const Keyframe &kf = anim.keyframes[anim.head];
+  uint32_t elapsed = halMillis() - anim.stageStart;
+  uint16_t remaining = elapsed < kf.fadeMs ? kf.fadeMs - elapsed : 0;
 
-  uint32_t black = strip.Color(0, 0, 0);
+  clearKeyframes(anim);
+  anim.blinking = false;
+  pushKeyframe(anim, color, remaining, 0);
+}
 
+void updateAllLEDs(bool force)
+{
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    updateLED(ch, force);
+}
+
+void fadeToColor(uint8_t channel, uint32_t targetColor, uint8_t steps, uint16_t delayMs)
+{
+  ChannelAnimation &anim = animations[channel];
+  clearKeyframes(anim);
+  anim.blinking = false;
+  pushKeyframe(anim, rgb16FromColor(targetColor), (uint16_t)steps * delayMs, 0);
+}
+
+void blinkSequence(uint8_t channel, uint32_t color, uint32_t baseColor, int times, uint16_t fadeMs, uint16_t holdMs)
+{
+  ChannelAnimation &anim = animations[channel];
+  clearKeyframes(anim);
+  anim.blinking = true;
   for (int i = 0; i < times; ++i)
   {
-    fadeToColor(color, steps, stepDelay);
-    delay(holdTime);
-    fadeToColor(black, steps, stepDelay);
-    delay(holdTime);
+    pushKeyframe(anim, rgb16FromColor(color), fadeMs, holdMs);
+    pushKeyframe(anim, rgb16FromColor(baseColor), fadeMs, holdMs);
   }
+}
+
+void blinkConfirm(uint8_t channel, uint32_t color, int times)
+{
+  // Animation constants
+  const uint16_t fadeTime = 100; // Fade duration (ms)
+  const uint16_t holdTime = 100; // Time to hold the color/black (ms)
+
+  blinkSequence(channel, color, 0, times, fadeTime, holdTime);
 
   // Restore the normal LED state
-  updateLED(false);
+  pushKeyframe(animations[channel], rgb16FromColor(targetLedColor(channel, false)), 0, 0);
 }
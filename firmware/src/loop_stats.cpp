@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include <loop_stats.h>
+#include <hal.h>
+
+// Bucket b holds durations in [2^(b-1), 2^b) cycles, bucket 0 holds zero
+static constexpr uint8_t NUM_BUCKETS = 33;
+static constexpr uint8_t NUM_STAGES = static_cast<uint8_t>(LoopStage::Count);
+static constexpr uint8_t NUM_TASKS = static_cast<uint8_t>(LoopTask::Count);
+static constexpr uint8_t NUM_HISTOGRAMS = NUM_STAGES + NUM_TASKS; // + whole iteration per task
+
+struct StageHistogram
+{
+  uint32_t counts[NUM_BUCKETS];
+  uint32_t samples;
+  uint32_t maxCycles;
+};
+
+static const char *const STAGE_NAMES[NUM_HISTOGRAMS] = {
+    "wifi", "net_init", "mqtt", "ota", "input", "adc", "led", "network", "control"};
+
+// Recording only touches the calling task's slots. The network task reads
+// and resets everything for the summary; a torn sample there is harmless.
+static StageHistogram histograms[NUM_HISTOGRAMS];
+static uint32_t pendingCycles[NUM_STAGES];
+static uint32_t pendingMask[NUM_TASKS];
+static uint32_t iterationStart[NUM_TASKS];
+static uint32_t lastMark[NUM_TASKS];
+
+static inline uint8_t taskFor(LoopStage stage)
+{
+  return static_cast<uint8_t>(stage < LoopStage::Input ? LoopTask::Network : LoopTask::Control);
+}
+
+static inline uint8_t bucketFor(uint32_t cycles)
+{
+  return cycles ? 32 - __builtin_clz(cycles) : 0;
+}
+
+static void record(uint8_t index, uint32_t cycles)
+{
+  StageHistogram &h = histograms[index];
+  h.counts[bucketFor(cycles)]++;
+  h.samples++;
+  if (cycles > h.maxCycles)
+    h.maxCycles = cycles;
+}
+
+// Upper bound of the bucket holding the given percentile, capped at the max
+static uint32_t percentileCycles(const StageHistogram &h, uint8_t percent)
+{
+  uint32_t rank = (uint32_t)(((uint64_t)h.samples * percent + 99) / 100);
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < NUM_BUCKETS; ++b)
+  {
+    seen += h.counts[b];
+    if (seen >= rank)
+    {
+      uint32_t upper = b == 0 ? 0 : (b >= 32 ? UINT32_MAX : (1UL << b) - 1);
+      return upper < h.maxCycles ? upper : h.maxCycles;
+    }
+  }
+  return h.maxCycles;
+}
+
+void loopStatsBegin(LoopTask task)
+{
+  uint8_t t = static_cast<uint8_t>(task);
+  iterationStart[t] = halCycles();
+  lastMark[t] = iterationStart[t];
+}
+
+void loopStatsMark(LoopStage stage)
+{
+  uint32_t now = halCycles();
+  uint8_t index = static_cast<uint8_t>(stage);
+  uint8_t t = taskFor(stage);
+  pendingCycles[index] += now - lastMark[t];
+  pendingMask[t] |= 1UL << index;
+  lastMark[t] = now;
+}
+
+void loopStatsEnd(LoopTask task)
+{
+  uint8_t t = static_cast<uint8_t>(task);
+  for (uint8_t i = 0; i < NUM_STAGES; ++i)
+  {
+    if (pendingMask[t] & (1UL << i))
+    {
+      record(i, pendingCycles[i]);
+      pendingCycles[i] = 0;
+    }
+  }
+  pendingMask[t] = 0;
+
+  record(NUM_STAGES + t, halCycles() - iterationStart[t]);
+}
+
+void loopStatsToJson(JsonDocument &doc)
+{
+  const uint32_t cyclesPerUs = halCyclesPerMicro();
+
+  for (uint8_t i = 0; i < NUM_HISTOGRAMS; ++i)
+  {
+    const StageHistogram &h = histograms[i];
+    if (h.samples == 0)
+      continue;
+
+    JsonObject stage = doc[STAGE_NAMES[i]].to<JsonObject>();
+    stage["p50"] = percentileCycles(h, 50) / cyclesPerUs;
+    stage["p99"] = percentileCycles(h, 99) / cyclesPerUs;
+    stage["max"] = h.maxCycles / cyclesPerUs;
+    stage["n"] = h.samples;
+  }
+}
+
+void loopStatsReset()
+{
+  memset(histograms, 0, sizeof(histograms));
+}
+
+const char *loopStageName(uint8_t stage)
+{
+  return stage < NUM_HISTOGRAMS ? STAGE_NAMES[stage] : "unknown";
+}
@@ -1,13 +1,18 @@
 #include <Preferences.h>
 #include <ArduinoOTA.h>
-#include <RotaryEncoder.h>
-#include <Adafruit_NeoPixel.h>
 #include <time.h>
 
 #include <state.h>
+#include <hal.h>
+#include <input_events.h>
+#include <control.h>
+#include <loop_stats.h>
+#include <scheduler.h>
 #include <wifi_mqtt_ota_setup.h>
+#include <ha_topics.h>
+#include <ha_discovery.h>
+#include <ota_update.h>
 #include <pins.h>
-#include <colors.h>
 #include <config.h>
 #include <utils.h>
 #include <serial_mux.h>
@@ -15,32 +20,21 @@
 // Preferences setup
 Preferences prefs;
 
-// LED Setup
-Adafruit_NeoPixel strip(NUM_PIXELS, LED_PIN, NEO_GRB + NEO_KHZ800);
-bool ledEnabled = false;
-bool inBrightnessMode = false;
-
-// Encoder Setup
-RotaryEncoder encoder(ENCODER_A, ENCODER_B, RotaryEncoder::LatchMode::FOUR3);
-
-// Color management
-ColorMode colorMode = ColorMode::Palette;
-uint8_t currentColorIndex = 0;
-uint32_t customColor = 0x000000;
-
-// Current brightness
-uint8_t currentBrightness = 128;
-
-String deviceName = "";
-unsigned long powerOffTime = 0;
-time_t bootTime = 0;
-
-static bool wasResetButtonPressed = false;
-static bool wasCalButtonPressed = false;
+// Sensing, input and LED rendering run here, above the network work in
+// loop(), so a stalled broker or portal can't delay the LEDs. The task sleeps
+// until input, ADC data or a command arrives, or its next deadline.
+static void controlTask(void *)
+{
+  schedulerBegin(LoopTask::Control);
+  for (;;)
+  {
+    loopStatsBegin(LoopTask::Control);
+    controlLoop();
+    loopStatsEnd(LoopTask::Control);
 
-// Runtime current threshold + offset (loaded from NVS. Fallback to config default)
-int currentThreshold = CURRENT_THRESHOLD;
-int currentThresholdOffset = CURRENT_THRESHOLD_OFFSET;
+    schedulerWait(LoopTask::Control, controlIdleMs());
+  }
+}
 
 void setup()
 {
@@ -52,113 +46,68 @@ void setup()
   Serial.println();
   Serial.println("Console LED Trigger starting");
 
-  // Initialize Pins
-  pinMode(ENCODER_SW, INPUT_PULLUP);
-  pinMode(CURRENT_SENSE_PIN, INPUT);
-  pinMode(POWER_CALIBRATE_PIN, INPUT_PULLUP);
-  pinMode(WIFI_RESET, INPUT_PULLUP);
+  // Initialize Pins, LED strip and encoder
+  halBegin();
+  halPowerBegin();
+  inputBegin();
+  schedulerBegin(LoopTask::Network);
+
+  // Build MQTT topics once, they never change at runtime
+  haTopicsBegin(getMacSuffix().c_str());
 
   // Initialize Preferences
   prefs.begin("led-config", false);
 
   // Handle device name
-  deviceName = prefs.getString("name", "");
-  if (deviceName.isEmpty())
+  prefs.getString("name", deviceName, sizeof(deviceName));
+  if (deviceName[0] == '\0')
   {
-    deviceName = "Console-" + getMacSuffix();
+    snprintf(deviceName, sizeof(deviceName), "Console-%s", haMacSuffix());
     prefs.putString("name", deviceName);
   }
   Serial.println();
   Serial.print("Device name: ");
   Serial.println(deviceName);
+  haDiscoverySetName(deviceName);
 
-  // Load calibrated threshold if available
-  currentThreshold = prefs.getInt("th_base", CURRENT_THRESHOLD);
-  currentThresholdOffset = prefs.getInt("the_offset", CURRENT_THRESHOLD_OFFSET);
-  Serial.println();
-  Serial.print("Current threshold: ");
-  Serial.println(currentThreshold);
-  Serial.print("Current threshold offset: ");
-  Serial.println(currentThresholdOffset);
+  controlSetup();
+  xTaskCreate(controlTask, "control", CONTROL_TASK_STACK, nullptr, CONTROL_TASK_PRIORITY, nullptr);
 
-  String apName = "Console-LED-" + getMacSuffix();
+  String apName = String("Console-LED-") + haMacSuffix();
   wifiKickoff(apName, prefs);
+}
 
-  attachInterrupt(digitalPinToInterrupt(ENCODER_A), []
-                  { encoder.tick(); }, CHANGE);
-  attachInterrupt(digitalPinToInterrupt(ENCODER_B), []
-                  { encoder.tick(); }, CHANGE);
-
-  // Read saved color + brightness from Preferences (quiet on first boot)
-  colorMode = static_cast<ColorMode>(prefs.getUChar("color_mode", 0));
-  currentColorIndex = prefs.getUChar("color_index", 0);
-
-  uint32_t defaultCustom = 0x000000;
-  if (prefs.isKey("custom_color"))
-  {
-    String hex = prefs.getString("custom_color"); // may be "RRGGBB" or "#RRGGBB"
-    if (hex.startsWith("#"))
-      hex.remove(0, 1);
-    while (hex.length() < 6)
-      hex = "0" + hex;
-
-    customColor = (uint32_t)strtoul(hex.c_str(), nullptr, 16) & 0xFFFFFF;
-  }
-  else
-  {
-    customColor = defaultCustom;
-  }
-
-  Serial.println();
-  Serial.print("Color mode: ");
-  Serial.println(colorModeToString(colorMode));
+// Network task: WiFi, MQTT, OTA and NTP
+void loop()
+{
+  loopStatsBegin(LoopTask::Network);
 
-  if (colorMode == ColorMode::Custom)
-  {
-    char buf[7];
-    snprintf(buf, sizeof(buf), "%06X", (unsigned)customColor);
-    Serial.print("Custom color: #");
-    Serial.println(buf);
-  }
-  else
+  // Handle WiFi reset button, queued even while the loop was busy
+  InputEvent event;
+  while (inputPoll(InputConsumer::Network, event))
   {
-    // Clamp palette index defensively
-    if (currentColorIndex >= NUM_COLORS)
+    if (event.source == InputSource::WifiReset && event.type == InputType::Press)
     {
-      currentColorIndex = 0;
-      prefs.putUChar("color_index", currentColorIndex);
+      Serial.println("Open config portal request");
+      String apName = String("Console-LED-") + haMacSuffix();
+      reopenConfigPortal(apName);
     }
-    Serial.print("Current color index: ");
-    Serial.println(currentColorIndex);
   }
 
-  // Read saved brightness from Preferences
-  currentBrightness = prefs.getUChar("brightness", 128);
-  Serial.print("Current brightness: ");
-  Serial.println(currentBrightness);
-  Serial.println();
-
-  strip.begin();
-  strip.setBrightness(currentBrightness);
-  strip.clear();
-  strip.show();
-
-  ledEnabled = false;
-
-  delay(100);
-
-  updateLED(false);
-}
-
-void loop()
-{
   wifiProcess(prefs);
+  loopStatsMark(LoopStage::Wifi);
+
   maybeInitNetServices(prefs);
+  loopStatsMark(LoopStage::NetInit);
 
   if (wifiIsConnected())
   {
     handleMqttLoop();
+    loopStatsMark(LoopStage::Mqtt);
+
     ArduinoOTA.handle();
+    otaUpdateLoop();
+    loopStatsMark(LoopStage::Ota);
 
     if (bootTime == 0)
     {
@@ -172,190 +121,7 @@ void loop()
     }
   }
 
-  // Handle WiFi reset button
-  bool resetBtnPressed = digitalRead(WIFI_RESET) == LOW;
-  if (resetBtnPressed && !wasResetButtonPressed)
-  {
-    delay(50);
-    if (digitalRead(WIFI_RESET) == LOW)
-    {
-      Serial.println("Open config portal request");
-      String apName = "Console-LED-" + getMacSuffix();
-      reopenConfigPortal(apName);
-    }
-  }
-  wasResetButtonPressed = resetBtnPressed;
-
-  // Single-press calibration on POWER_CALIBRATE-PIN
-  bool calPressed = (digitalRead(POWER_CALIBRATE_PIN) == LOW);
-  if (calPressed && !wasCalButtonPressed)
-  {
-    delay(50);
-    if (digitalRead(POWER_CALIBRATE_PIN) == LOW)
-    {
-      Serial.println();
-      Serial.println("Calibration button pressed. Sampling ADC");
-
-      int baseline = readAdcAverage(CURRENT_SENSE_PIN, 64);
-      currentThreshold = baseline;
-      prefs.putInt("th_base", currentThreshold);
-      Serial.print("Calibrated baseline saved: ");
-      Serial.println(currentThreshold);
-      Serial.print("TH_ON / TH_OFF: ");
-      Serial.print(currentThreshold + currentThresholdOffset);
-      Serial.print(" / ");
-      Serial.println(currentThreshold - currentThresholdOffset);
-      Serial.println();
-
-      if (wifiIsConnected())
-      {
-        publishState();
-        publishHAState();
-      }
-
-      blinkConfirm(strip.Color(255, 255, 255), 2);
-    }
-  }
-  wasCalButtonPressed = calPressed;
-
-  int adc = analogRead(CURRENT_SENSE_PIN);
-
-  // ADC Debug
-  // Serial.printf("ADC Value: %d\n", adc, " > ", CURRENT_THRESHOLD_ON);
-  // delay(500);
-
-  static bool lastLedEnabled = false;
-
-  // Use runtime threshold derived from calibrated baseline + fixed offset
-  const int TH_ON = currentThreshold + currentThresholdOffset;
-  const int TH_OFF = currentThreshold - currentThresholdOffset;
-
-  if (!ledEnabled && adc > TH_ON)
-  {
-    ledEnabled = true;
-  }
-  else if (ledEnabled && adc < TH_OFF)
-  {
-    if (powerOffTime == 0)
-      powerOffTime = millis();
-    if (millis() - powerOffTime >= POWER_OFF_DELAY)
-      ledEnabled = false;
-  }
-  else if (adc > TH_OFF)
-  {
-    powerOffTime = 0;
-  }
-
-  if (ledEnabled != lastLedEnabled)
-  {
-    Serial.println(ledEnabled ? "Turning ON LEDs" : "Turning OFF LEDs");
-    if (ledEnabled)
-    {
-      uint32_t fadeTarget = (colorMode == ColorMode::Palette && currentColorIndex < NUM_COLORS)
-                                ? colors[currentColorIndex]
-                                : customColor;
-
-      fadeToColor(fadeTarget);
-    }
-    else
-    {
-      fadeToColor(strip.Color(0, 0, 0));
-    }
-    lastLedEnabled = ledEnabled;
-
-    if (wifiIsConnected())
-    {
-      publishState();
-      publishHAState();
-    }
-  }
-
-  // Handle encoder input using getDirection()
-  RotaryEncoder::Direction dir = encoder.getDirection();
-  if (dir != RotaryEncoder::Direction::NOROTATION)
-  {
-    int delta = (dir == RotaryEncoder::Direction::CLOCKWISE) ? 1 : -1;
-
-    if (inBrightnessMode)
-    {
-      int newBrightness = constrain(currentBrightness + delta * 5, 0, 255);
-      if (newBrightness != currentBrightness)
-      {
-        currentBrightness = newBrightness;
-        strip.setBrightness(currentBrightness);
-        updateLED(false);
-      }
-    }
-    else
-    {
-      colorMode = ColorMode::Palette;
-      currentColorIndex = (currentColorIndex + delta + NUM_COLORS) % NUM_COLORS;
-      prefs.putUChar("color_mode", static_cast<uint8_t>(colorMode));
-      prefs.putUChar("color_index", currentColorIndex);
-      updateLED(false);
-    }
-  }
-
-  // Handle button presses
-  static bool wasButtonPressed = false;
-  static bool feedbackShown = false;
-  static unsigned long pressStartTime = 0;
-
-  bool buttonPressed = digitalRead(ENCODER_SW) == LOW;
-
-  if (buttonPressed && !wasButtonPressed)
-  {
-    pressStartTime = millis();
-    feedbackShown = false;
-  }
-
-  // Show when brightness mode has been activated and button can be released
-  if (buttonPressed && !feedbackShown && millis() - pressStartTime >= LONG_PRESS_THRESHOLD)
-  {
-    blinkConfirm(strip.Color(255, 255, 255), 2);
-    feedbackShown = true;
-  }
-
-  if (!buttonPressed && wasButtonPressed)
-  {
-    unsigned long pressDuration = millis() - pressStartTime;
-
-    if (pressDuration >= LONG_PRESS_THRESHOLD)
-    {
-      inBrightnessMode = !inBrightnessMode;
-      Serial.println(inBrightnessMode ? "Entered brightness mode" : "Exited brightness mode");
-    }
-    else
-    {
-      if (inBrightnessMode)
-      {
-        prefs.putUChar("brightness", currentBrightness);
-        Serial.print("Saved brightness: ");
-        Serial.println(currentBrightness);
-        Serial.println("Exiting brightness mode");
-        inBrightnessMode = false;
-
-        if (wifiIsConnected())
-        {
-          publishState();
-        }
-      }
-      else
-      {
-        colorMode = ColorMode::Palette;
-        prefs.putUChar("color_mode", static_cast<uint8_t>(colorMode));
-        prefs.putUChar("color_index", currentColorIndex);
-        Serial.print("Saved color to Preferences: ");
-        Serial.println(currentColorIndex);
-
-        if (wifiIsConnected())
-        {
-          publishState();
-        }
-      }
-    }
-  }
+  loopStatsEnd(LoopTask::Network);
 
-  wasButtonPressed = buttonPressed;
-  delay(10);
+  schedulerWait(LoopTask::Network, networkIdleMs());
 }
@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include <mqtt_dispatch.h>
+#include <config.h>
+#include <hal.h>
+#include <serial_mux.h>
+
+void mqttDispatchBegin(MqttDispatcher &d, const char *prefix, const MqttCommand *commands, uint8_t count)
+{
+  d.prefix = prefix;
+  d.prefixLen = strlen(prefix);
+  d.commands = commands;
+  d.count = count < MQTT_DISPATCH_MAX_COMMANDS ? count : MQTT_DISPATCH_MAX_COMMANDS;
+
+  for (uint8_t i = 0; i < d.count; ++i)
+  {
+    d.filters[i].clear();
+    if (commands[i].filter)
+      deserializeJson(d.filters[i], commands[i].filter);
+  }
+}
+
+// "ch<n>/" in front of the suffix, channel 0 has none
+static const char *splitChannel(const char *suffix, uint8_t &channel)
+{
+  channel = 0;
+  if (suffix[0] != 'c' || suffix[1] != 'h' || suffix[2] < '1' || suffix[2] > '9' || suffix[3] != '/')
+    return suffix;
+
+  channel = suffix[2] - '0';
+  return suffix + 4;
+}
+
+static int findCommand(const MqttDispatcher &d, const char *topic, uint8_t &channel)
+{
+  if (strncmp(topic, d.prefix, d.prefixLen) != 0)
+    return -1;
+
+  const char *suffix = splitChannel(topic + d.prefixLen, channel);
+  if (channel >= CONSOLE_CHANNELS)
+    return -1;
+
+  for (uint8_t i = 0; i < d.count; ++i)
+  {
+    if (strcmp(suffix, d.commands[i].suffix) == 0)
+      return channel == 0 || d.commands[i].perChannel ? i : -1;
+  }
+  return -1;
+}
+
+bool mqttDispatchHandles(const MqttDispatcher &d, const char *topic)
+{
+  uint8_t channel;
+  return findCommand(d, topic, channel) >= 0;
+}
+// Decimal integer straight from the (unterminated) payload bytes
+static bool parseInt(const uint8_t *payload, size_t length, int32_t &out)
+{
+  size_t i = 0;
+  while (i < length && payload[i] == ' ')
+    i++;
+
+  bool negative = false;
+  if (i < length && (payload[i] == '-' || payload[i] == '+'))
+    negative = payload[i++] == '-';
+
+  if (i >= length || payload[i] < '0' || payload[i] > '9')
+    return false;
+
+  int32_t value = 0;
+  while (i < length && payload[i] >= '0' && payload[i] <= '9')
+    value = value * 10 + (payload[i++] - '0');
+
+  out = negative ? -value : value;
+  return true;
+}
+
+static DeserializationError parseDocument(JsonDocument &doc, MqttPayload format, const uint8_t *payload, size_t length,
+                                          const JsonDocument *filter)
+{
+  if (format == MqttPayload::MsgPack)
+    return filter ? deserializeMsgPack(doc, payload, length, DeserializationOption::Filter(*filter))
+                  : deserializeMsgPack(doc, payload, length);
+
+  return filter ? deserializeJson(doc, (const char *)payload, length, DeserializationOption::Filter(*filter))
+                : deserializeJson(doc, (const char *)payload, length);
+}
+
+bool mqttDispatch(MqttDispatcher &d, const char *topic, const uint8_t *payload, size_t length)
+{
+  uint32_t start = halCycles();
+
+  uint8_t channel;
+  int index = findCommand(d, topic, channel);
+  if (index < 0)
+  {
+    d.rejected++;
+    Serial.printf("Unknown topic: %s\n", topic);
+    return false;
+  }
+
+  const MqttCommand *cmd = &d.commands[index];
+  MqttMessage msg{};
+  msg.channel = channel;
+  JsonDocument doc;
+
+  switch (cmd->payload)
+  {
+  case MqttPayload::None:
+    break;
+  case MqttPayload::Int:
+    if (!parseInt(payload, length, msg.value))
+    {
+      d.rejected++;
+      Serial.printf("Invalid number on %s\n", topic);
+      return false;
+    }
+    break;
+  case MqttPayload::Json:
+  case MqttPayload::MsgPack:
+  {
+    DeserializationError err = parseDocument(doc, cmd->payload, payload, length, cmd->filter ? &d.filters[index] : nullptr);
+    if (err)
+    {
+      d.rejected++;
+      Serial.printf("%s parse failed on %s: %s\n", cmd->payload == MqttPayload::MsgPack ? "MessagePack" : "JSON", topic,
+                    err.c_str());
+      return false;
+    }
+    msg.json = doc.as<JsonVariantConst>();
+    break;
+  }
+  }
+
+  cmd->handler(msg);
+
+  uint32_t cycles = halCycles() - start;
+  d.calls[index]++;
+  if (cycles > d.maxCycles[index])
+    d.maxCycles[index] = cycles;
+
+  return true;
+}
+
+void mqttDispatchStatsToJson(const MqttDispatcher &d, JsonObject out)
+{
+  uint32_t perMicro = halCyclesPerMicro();
+
+  for (uint8_t i = 0; i < d.count; ++i)
+  {
+    if (d.calls[i] == 0)
+      continue;
+
+    JsonObject entry = out[d.commands[i].suffix].to<JsonObject>();
+    entry["n"] = d.calls[i];
+    entry["max"] = d.maxCycles[i] / perMicro;
+  }
+  out["rejected"] = (out["rejected"] | 0u) + d.rejected;
+}
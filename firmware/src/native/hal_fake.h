@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Controls for the native fakes behind hal.h
+
+// Clock: time only moves when the host advances it
+void fakeAdvanceMillis(uint32_t ms);
+
+// Inputs
+void fakeSetAdc(uint8_t pin, int value);
+void fakeSetGpio(uint8_t pin, bool high);
+void fakeTurnEncoder(int8_t direction);
+void fakeSetWifiConnected(bool connected);
+// Stand-in for the HTTP server behind halHttp*
+void fakeSetHttpBody(const uint8_t *data, size_t length, size_t bytesPerRead);
+
+// Outputs
+uint32_t fakePixel(uint16_t index);
+uint32_t fakeShowCount(); // Also the number of recorded frames
+void fakeRecordFrames(bool record); // On by default, off for long runs
+uint32_t fakeFrameTime(uint32_t frame);
+uint32_t fakeFramePixel(uint32_t frame, uint16_t index);
+uint32_t fakeNvsWriteCount();
+uint32_t fakePublishCount();
+uint32_t fakeMqttPublishCount();
+const char *fakeLastPayload(const char *topic); // "" until something is published
+bool fakeOtaFlashed();
+uint32_t fakeRestartCount();
+bool fakeAdcStreamPaused();
+uint32_t fakeAdcStreamPolls(); // Pin polls made by the stream while paused
+bool fakeInputWakeArmed();
@@ -0,0 +1,330 @@
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include <hal.h>
+#include <config.h>
+#include <adc_sampler.h>
+#include <input_events.h>
+#include <wifi_mqtt_ota_setup.h>
+#include <state_publish.h>
+#include <serial_mux.h>
+
+#include "hal_fake.h"
+
+SerialMirror DebugSerial;
+
+static uint32_t nowMs = 0;
+static uint8_t streamPins[CONSOLE_CHANNELS] = {};
+static uint8_t streamPinCount = 0;
+static uint32_t streamRateHz = 0;
+static uint64_t streamSamplesDue = 0;
+static bool streamPaused = false;
+static uint32_t streamPollMs = 0;
+static uint32_t streamLastPollMs = 0;
+static uint32_t streamPolls = 0;
+static bool inputWakeArmed = false;
+static int adcValues[32] = {};
+static bool gpioLevels[32] = {};
+static bool wifiConnected = false;
+
+static uint32_t pixels[LED_MAX_PIXELS] = {};
+static uint16_t pixelCount = NUM_PIXELS;
+static uint32_t showCount = 0;
+
+struct FakeFrame
+{
+  uint32_t timeMs;
+  std::vector<uint32_t> pixels;
+};
+static std::vector<FakeFrame> frames;
+static bool recordFrames = true;
+
+static std::map<std::string, std::string> nvs;
+static uint32_t nvsWriteCount = 0;
+
+static uint32_t publishCount = 0;
+static uint32_t mqttPublishCount = 0;
+static std::map<std::string, std::string> lastPayloads;
+
+static std::string httpBody;
+static size_t httpOffset = 0;
+static size_t httpReadSize = 1;
+static std::vector<uint8_t> otaImage;
+static size_t otaImageSize = 0;
+static bool otaFinished = false;
+static uint32_t restartCount = 0;
+
+void halBegin()
+{
+  // Buttons idle HIGH (INPUT_PULLUP on the board)
+  for (bool &level : gpioLevels)
+    level = true;
+}
+
+// Clock
+uint32_t halMillis() { return nowMs; }
+uint32_t halMicros() { return nowMs * 1000; }
+
+// Host "cycles" are nanoseconds of wall time
+uint32_t halCycles()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t halCyclesPerMicro() { return 1000; }
+
+// ADC
+int halAdcRead(uint8_t pin) { return pin < 32 ? adcValues[pin] : 0; }
+
+bool halAdcStreamBegin(const uint8_t *pins, uint8_t count, uint32_t sampleRateHz)
+{
+  streamPinCount = count < CONSOLE_CHANNELS ? count : CONSOLE_CHANNELS;
+  memcpy(streamPins, pins, streamPinCount);
+  streamRateHz = sampleRateHz;
+  streamSamplesDue = (uint64_t)nowMs * sampleRateHz;
+  return true;
+}
+
+void halAdcStreamPause(bool paused, uint32_t pollIntervalMs)
+{
+  if (streamPaused && !paused)
+    streamSamplesDue = (uint64_t)nowMs * streamRateHz;
+  streamPaused = paused;
+  streamPollMs = pollIntervalMs;
+  streamLastPollMs = nowMs - pollIntervalMs;
+}
+
+// GPIO
+bool halGpioRead(uint8_t pin) { return pin < 32 ? gpioLevels[pin] : true; }
+
+void halInputWakeArm(bool armed) { inputWakeArmed = armed; }
+
+// The host drives both tasks itself, so nothing ever blocks here
+void halWakeRegister(uint8_t) {}
+void halWaitForWake(uint32_t) {}
+void halWakeTask(uint8_t) {}
+
+void halPowerBegin() {}
+bool halLightSleepAvailable() { return false; }
+
+// Pixel output
+void halPixelsBegin(uint16_t count)
+{
+  pixelCount = count < LED_MAX_PIXELS ? count : LED_MAX_PIXELS;
+  memset(pixels, 0, sizeof(pixels));
+}
+
+void halPixelsSet(uint16_t index, uint32_t color)
+{
+  if (index < pixelCount)
+    pixels[index] = color;
+}
+
+// Records every frame with the time it was sent, like a logic analyser on the data pin
+void halPixelsShow()
+{
+  showCount++;
+  if (!recordFrames)
+    return;
+  FakeFrame frame;
+  frame.timeMs = nowMs;
+  frame.pixels.assign(pixels, pixels + pixelCount);
+  frames.push_back(frame);
+}
+
+// NVS
+bool halNvsHasKey(const char *key) { return nvs.count(key) > 0; }
+
+int32_t halNvsGetInt(const char *key, int32_t defaultValue)
+{
+  auto it = nvs.find(key);
+  return it == nvs.end() ? defaultValue : (int32_t)std::stol(it->second);
+}
+
+void halNvsPutInt(const char *key, int32_t value)
+{
+  nvs[key] = std::to_string(value);
+  nvsWriteCount++;
+}
+
+uint8_t halNvsGetUChar(const char *key, uint8_t defaultValue)
+{
+  return (uint8_t)halNvsGetInt(key, defaultValue);
+}
+
+void halNvsPutUChar(const char *key, uint8_t value) { halNvsPutInt(key, value); }
+
+size_t halNvsGetString(const char *key, char *buf, size_t len)
+{
+  auto it = nvs.find(key);
+  if (it == nvs.end() || len == 0)
+    return 0;
+  size_t n = it->second.copy(buf, len - 1);
+  buf[n] = '\0';
+  return n;
+}
+
+void halNvsPutString(const char *key, const char *value)
+{
+  nvs[key] = value;
+  nvsWriteCount++;
+}
+
+// MQTT
+bool halMqttConnected() { return wifiConnected; }
+
+bool halMqttPublish(const char *topic, const uint8_t *payload, size_t length, bool)
+{
+  mqttPublishCount++;
+  if (wifiConnected)
+    lastPayloads[topic].assign((const char *)payload, length);
+  return wifiConnected;
+}
+
+// Firmware download, served from memory a few bytes per read like a slow link
+bool halHttpBegin(const char *, int32_t &contentLength)
+{
+  if (!wifiConnected)
+    return false;
+  httpOffset = 0;
+  contentLength = httpBody.size();
+  return true;
+}
+
+int32_t halHttpRead(uint8_t *buf, size_t len)
+{
+  if (httpOffset >= httpBody.size())
+    return -1;
+  if (len > httpReadSize)
+    len = httpReadSize;
+  if (len > httpBody.size() - httpOffset)
+    len = httpBody.size() - httpOffset;
+  memcpy(buf, httpBody.data() + httpOffset, len);
+  httpOffset += len;
+  return len;
+}
+
+void halHttpEnd() {}
+
+// Firmware flashing
+bool halOtaBegin(size_t size)
+{
+  otaImage.clear();
+  otaImage.reserve(size);
+  otaImageSize = size;
+  otaFinished = false;
+  return true;
+}
+
+bool halOtaWrite(const uint8_t *data, size_t len)
+{
+  otaImage.insert(otaImage.end(), data, data + len);
+  return otaImage.size() <= otaImageSize;
+}
+
+bool halOtaEnd()
+{
+  otaFinished = otaImage.size() == otaImageSize;
+  return otaFinished;
+}
+
+void halOtaAbort() { otaImage.clear(); }
+void halRestart() { restartCount++; }
+
+// Network side the control loop calls into
+bool wifiIsConnected() { return wifiConnected; }
+void publishState(const StateSnapshot &, bool) { publishCount++; }
+void publishHALightState(const StateSnapshot &, uint8_t) { publishCount++; }
+
+// Fake controls
+// Advancing the clock produces the samples the continuous ADC would have
+void fakeAdvanceMillis(uint32_t ms)
+{
+  nowMs += ms;
+  if (streamRateHz == 0)
+    return;
+
+  // Paused: the stream polls each pin at the slow rate
+  if (streamPaused)
+  {
+    while (streamPollMs > 0 && nowMs - streamLastPollMs >= streamPollMs)
+    {
+      streamLastPollMs += streamPollMs;
+      streamPolls++;
+      for (uint8_t i = 0; i < streamPinCount; ++i)
+        adcSamplerPush(i, halAdcRead(streamPins[i]));
+    }
+    return;
+  }
+
+  uint64_t due = (uint64_t)nowMs * streamRateHz;
+  while (streamSamplesDue + 1000 <= due)
+  {
+    for (uint8_t i = 0; i < streamPinCount; ++i)
+      adcSamplerPush(i, halAdcRead(streamPins[i]));
+    streamSamplesDue += 1000;
+  }
+}
+
+void fakeSetAdc(uint8_t pin, int value)
+{
+  if (pin < 32)
+    adcValues[pin] = value;
+}
+
+// Pin changes raise their interrupt like on the board
+void fakeSetGpio(uint8_t pin, bool high)
+{
+  if (pin >= 32 || gpioLevels[pin] == high)
+    return;
+
+  gpioLevels[pin] = high;
+  inputWakeArmed = false;
+  inputIsrPin(pin, high, nowMs);
+}
+
+void fakeTurnEncoder(int8_t direction)
+{
+  inputWakeArmed = false;
+  inputIsrTurn(direction, nowMs);
+}
+
+bool fakeAdcStreamPaused() { return streamPaused; }
+uint32_t fakeAdcStreamPolls() { return streamPolls; }
+bool fakeInputWakeArmed() { return inputWakeArmed; }
+void fakeSetWifiConnected(bool connected) { wifiConnected = connected; }
+
+uint32_t fakePixel(uint16_t index) { return index < pixelCount ? pixels[index] : 0; }
+uint32_t fakeShowCount() { return showCount; }
+uint32_t fakeNvsWriteCount() { return nvsWriteCount; }
+uint32_t fakePublishCount() { return publishCount; }
+uint32_t fakeMqttPublishCount() { return mqttPublishCount; }
+
+void fakeSetHttpBody(const uint8_t *data, size_t length, size_t bytesPerRead)
+{
+  httpBody.assign((const char *)data, length);
+  httpReadSize = bytesPerRead;
+}
+
+bool fakeOtaFlashed() { return otaFinished; }
+uint32_t fakeRestartCount() { return restartCount; }
+
+const char *fakeLastPayload(const char *topic)
+{
+  auto it = lastPayloads.find(topic);
+  return it == lastPayloads.end() ? "" : it->second.c_str();
+}
+
+void fakeRecordFrames(bool record) { recordFrames = record; }
+
+uint32_t fakeFrameTime(uint32_t frame) { return frame < frames.size() ? frames[frame].timeMs : 0; }
+
+uint32_t fakeFramePixel(uint32_t frame, uint16_t index)
+{
+  return frame < frames.size() && index < frames[frame].pixels.size() ? frames[frame].pixels[index] : 0;
+}
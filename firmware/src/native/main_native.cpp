@@ -0,0 +1,522 @@
+// Host entry point for the native target. Drives the control loop against
+// the fakes in hal_native.cpp through a scripted power cycle and reports
+// the per-iteration cost of the hot paths.
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include <ArduinoJson.h>
+
+#include <control.h>
+#include <commands.h>
+#include <loop_stats.h>
+#include <power_detect.h>
+#include <settings.h>
+#include <sha256.h>
+#include <framebuffer.h>
+#include <effects.h>
+#include <led_segments.h>
+#include <ota_update.h>
+#include <ha_topics.h>
+#include <ha_discovery.h>
+#include <mqtt_dispatch.h>
+#include <state_publish.h>
+#include <task_queues.h>
+#include <state.h>
+#include <hal.h>
+#include <input_events.h>
+#include <adc_sampler.h>
+#include <adc_trace.h>
+#include <scheduler.h>
+#include <pins.h>
+#include <config.h>
+
+#include "hal_fake.h"
+
+static constexpr uint32_t LOOP_PERIOD_MS = 10;
+
+static int failures = 0;
+static double loopNsTotal = 0;
+static uint32_t loopCount = 0;
+
+static void expect(bool ok, const char *what)
+{
+  if (!ok)
+  {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static AdcTraceFrame lastTraceFrame;
+static uint32_t traceFrames = 0;
+static uint16_t firstTraceRate = 0;
+
+static void traceSink(const uint8_t *frame, size_t length)
+{
+  size_t consumed = 0;
+  if (adcTraceDecode(frame, length, lastTraceFrame, consumed) && traceFrames++ == 0)
+    firstTraceRate = lastTraceFrame.rateHz;
+}
+
+static void runFor(uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += LOOP_PERIOD_MS)
+  {
+    auto start = std::chrono::steady_clock::now();
+    loopStatsBegin(LoopTask::Control);
+    controlLoop();
+    loopStatsEnd(LoopTask::Control);
+    auto end = std::chrono::steady_clock::now();
+
+    // Network task's share, run in lockstep here
+    statePublishDrain();
+    otaUpdateLoop();
+
+    loopNsTotal += std::chrono::duration<double, std::nano>(end - start).count();
+    loopCount++;
+    fakeAdvanceMillis(LOOP_PERIOD_MS);
+  }
+}
+
+int main()
+{
+  halBegin();
+  inputBegin();
+  haTopicsBegin("A1B2C3");
+  controlSetup();
+
+  ChannelState &console = channels[0];
+  const int baseline = console.threshold;
+  const int offset = console.thresholdOffset;
+  const int onLevel = baseline + 2 * offset;
+  // RMS style filters sit at the baseline when idle, DC ones need to drop below it
+  const int offLevel = powerOffThreshold(baseline, offset) > baseline ? baseline : baseline - 2 * offset;
+
+  // Console off
+  fakeSetAdc(CURRENT_SENSE_PIN, offLevel);
+  runFor(500);
+  expect(!console.ledEnabled, "LEDs stay off while console is off");
+  expect(fakePixel(0) == 0, "strip is dark while console is off");
+
+  // Console on: fade starts immediately and finishes within the fade time
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(50);
+  expect(console.ledEnabled, "power on detected within 50 ms");
+  runFor(1300);
+  expect(fbGet(0) == rgb16FromColor(colors[console.colorIndex]), "fade reaches the palette color");
+
+  // Encoder turn during a fade retargets it
+  fakeSetAdc(CURRENT_SENSE_PIN, offLevel);
+  runFor(POWER_OFF_DELAY + 100);
+  expect(!console.ledEnabled, "power off detected shortly after POWER_OFF_DELAY");
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(300);
+  fakeTurnEncoder(1);
+  runFor(1300);
+  expect(fbGet(0) == rgb16FromColor(colors[console.colorIndex]), "encoder turn mid-fade ends on the new color");
+
+  // Spinning the encoder only reaches NVS once it has settled
+  runFor(SETTINGS_COMMIT_MAX_DELAY);
+  const uint32_t writesBeforeSpin = fakeNvsWriteCount();
+  for (int i = 0; i < 20; ++i)
+  {
+    fakeTurnEncoder(1);
+    runFor(50);
+  }
+  expect(fakeNvsWriteCount() == writesBeforeSpin, "encoder spin doesn't write NVS right away");
+  runFor(SETTINGS_COMMIT_DELAY + 100);
+  expect(fakeNvsWriteCount() - writesBeforeSpin == 1, "encoder spin coalesces into one commit");
+  expect(settingsGetUChar("color_index", 0xFF) == console.colorIndex, "cached color index matches");
+
+  // Inputs that arrive between iterations are queued, none get lost
+  const uint8_t indexBefore = console.colorIndex;
+  for (int i = 0; i < 3; ++i)
+    fakeTurnEncoder(1);
+  runFor(LOOP_PERIOD_MS);
+  expect(console.colorIndex == (indexBefore + 3) % NUM_COLORS, "every queued detent is applied");
+
+  // A bouncing long press enters brightness mode once
+  fakeSetGpio(ENCODER_SW, false);
+  fakeAdvanceMillis(2);
+  fakeSetGpio(ENCODER_SW, true);
+  fakeAdvanceMillis(1);
+  fakeSetGpio(ENCODER_SW, false);
+  runFor(LONG_PRESS_THRESHOLD + 100);
+  fakeSetGpio(ENCODER_SW, true);
+  runFor(50);
+  expect(inBrightnessMode, "bouncing long press enters brightness mode");
+
+  // Slow detents step by one, fast ones accelerate
+  const int brightnessBefore = currentBrightness;
+  fakeTurnEncoder(-1);
+  runFor(200);
+  fakeTurnEncoder(-1);
+  runFor(200);
+  expect(currentBrightness == brightnessBefore - 2, "slow detents step brightness by one");
+  for (int i = 0; i < 4; ++i)
+  {
+    fakeTurnEncoder(1);
+    fakeAdvanceMillis(10);
+  }
+  runFor(LOOP_PERIOD_MS);
+  expect(currentBrightness == brightnessBefore - 2 + 1 + 3 * ENCODER_ACCEL_MAX_STEP, "fast detents step further");
+  expect(inputAccelStep(ENCODER_ACCEL_SLOW) == 1 && inputAccelStep(ENCODER_ACCEL_FAST) == ENCODER_ACCEL_MAX_STEP,
+         "acceleration spans one to the max step");
+
+  // A tap over before the loop looks still counts
+  fakeSetGpio(ENCODER_SW, false);
+  fakeAdvanceMillis(40);
+  fakeSetGpio(ENCODER_SW, true);
+  runFor(50);
+  expect(!inBrightnessMode, "tap between iterations exits brightness mode");
+  expect(inputDropped() == 0, "no input dropped");
+
+  // Baseline tracking follows a slow drift while the console is off
+  autoCalibrate = true;
+  const int startBaseline = console.threshold;
+  fakeSetAdc(CURRENT_SENSE_PIN, startBaseline + 5);
+  runFor(BASELINE_SETTLE_TIME + 3 * BASELINE_STEP_INTERVAL + BASELINE_STEP_INTERVAL / 2);
+  expect(!console.ledEnabled, "small drift doesn't power on");
+  expect(console.threshold == startBaseline + 3, "baseline drifts one count per step");
+  runFor(10 * BASELINE_STEP_INTERVAL);
+  expect(console.threshold == startBaseline + 5, "baseline settles on the tracked level");
+  autoCalibrate = false;
+
+  // Topics are interned once
+  haTopicsBegin("A1B2C3");
+  expect(strcmp(haDeviceStateTopic(), "console/board-a1b2c3/state") == 0, "device state topic");
+  char expanded[512];
+  haDiscoveryExpand(haDiscoveryEntries[0].topic, expanded, sizeof(expanded));
+  expect(strcmp(expanded, "homeassistant/light/board-a1b2c3/config") == 0, "discovery topic expands the node id");
+  haDiscoveryExpand(haDiscoveryEntries[0].payload, expanded, sizeof(expanded));
+  expect(strstr(expanded, "\"name\":\"Console-A1B2C3\"") && !strstr(expanded, "{node}"), "discovery payload expands placeholders");
+  expect(haDiscoveryExpand(haDiscoveryEntries[0].payload, expanded, 16) == 0, "discovery expansion reports overflow");
+
+  // A rename reaches the discovery device name, escaped, and changes the hash
+  uint32_t hashBefore = haDiscoveryHash();
+  expect(discoveryNamePush("Den \"TV\""), "rename queued for the network task");
+  DiscoveryNameMessage renamed;
+  expect(discoveryNamePop(renamed) && strcmp(renamed.name, "Den \"TV\"") == 0, "rename popped");
+  haDiscoverySetName(renamed.name);
+  haDiscoveryExpand(haDiscoveryEntries[0].payload, expanded, sizeof(expanded));
+  expect(strstr(expanded, "\"name\":\"Den \\\"TV\\\"\"") != nullptr, "discovery name is the escaped device name");
+  expect(haDiscoveryHash() != hashBefore, "rename changes the discovery hash");
+  haDiscoverySetName("");
+
+  // Dispatcher routes on the topic suffix and rejects unknown topics unparsed
+  static int32_t dispatchedOffset = 0;
+  static int identifyPresses = 0;
+  static const MqttCommand commands[] = {
+      {"offset/set", MqttPayload::Int, nullptr, [](const MqttMessage &msg)
+       { dispatchedOffset = msg.value; }, false},
+      {"identify", MqttPayload::None, nullptr, [](const MqttMessage &)
+       { identifyPresses++; }, false},
+  };
+  static MqttDispatcher dispatcher;
+  mqttDispatchBegin(dispatcher, haCmdPrefix(), commands, 2);
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%soffset/set", haCmdPrefix());
+  expect(mqttDispatch(dispatcher, topic, (const uint8_t *)"-120", 4) && dispatchedOffset == -120, "offset payload parsed as int");
+  expect(!mqttDispatch(dispatcher, topic, (const uint8_t *)"abc", 3), "non-numeric offset rejected");
+  snprintf(topic, sizeof(topic), "%sidentify", haCmdPrefix());
+  expect(mqttDispatch(dispatcher, topic, (const uint8_t *)"1", 1) && identifyPresses == 1, "identify dispatched");
+  expect(!mqttDispatch(dispatcher, "console/board-ffffff/identify", (const uint8_t *)"1", 1), "other device's topic rejected");
+  expect(!mqttDispatch(dispatcher, haCmdPrefix(), nullptr, 0), "bare prefix rejected");
+
+  // Commands from the network side are applied by the control loop
+  const int offsetBefore = console.thresholdOffset;
+  snprintf(topic, sizeof(topic), "%soffset/set", haCmdPrefix());
+  expect(controlCommandPush(topic, (const uint8_t *)"42", 2), "command queued for the control task");
+  runFor(LOOP_PERIOD_MS);
+  expect(console.thresholdOffset == 42, "queued offset command applied by the control loop");
+  applyOffsetCommand(offsetBefore);
+
+  // Large payloads (a full segment layout plus dashboard extras) still fit
+  static uint8_t largePayload[700];
+  memset(largePayload, ' ', sizeof(largePayload));
+  memcpy(largePayload, "{\"thresholdOffset\":43}", 22);
+  snprintf(topic, sizeof(topic), "%sset", haCmdPrefix());
+  uint32_t droppedBefore = taskQueuesDropped();
+  expect(controlCommandPush(topic, largePayload, sizeof(largePayload)) && taskQueuesDropped() == droppedBefore,
+         "payload larger than 256 bytes queued");
+  runFor(LOOP_PERIOD_MS);
+  expect(console.thresholdOffset == 43, "payload larger than 256 bytes applied whole");
+  applyOffsetCommand(offsetBefore);
+
+#if CONSOLE_CHANNELS > 1
+  // A second console on its own sense pin drives only its own zone
+  ChannelState &second = channels[1];
+  const LedSegment &zone = segmentAt(1);
+  const int secondOff = powerOffThreshold(second.threshold, second.thresholdOffset) > second.threshold
+                            ? second.threshold
+                            : second.threshold - 2 * second.thresholdOffset;
+  fakeSetAdc(CURRENT_SENSE_PINS[1], second.threshold + 2 * second.thresholdOffset);
+  runFor(1300);
+  expect(second.ledEnabled && !console.ledEnabled, "second console powers on independently");
+  expect(zone.channel == 1 && fbGet(zone.start) == rgb16FromColor(channelColor(second)), "second console lights its zone");
+  expect(fbGet(0) == rgb16FromColor(0), "first console's zone stays dark");
+
+  const int secondOffset = second.thresholdOffset;
+  snprintf(topic, sizeof(topic), "%sch1/offset/set", haCmdPrefix());
+  expect(controlCommandPush(topic, (const uint8_t *)"77", 2), "channel command queued");
+  runFor(LOOP_PERIOD_MS);
+  expect(second.thresholdOffset == 77 && console.thresholdOffset == offsetBefore, "channel command only changes its console");
+  expect(settingsGetInt("th_offset1", 0) == 77, "channel setting stored under its own key");
+  applyOffsetCommand(secondOffset, 1);
+  snprintf(topic, sizeof(topic), "%sch1/identify", haCmdPrefix());
+  expect(!mqttDispatch(dispatcher, topic, (const uint8_t *)"1", 1), "board command under a channel rejected");
+
+  expect(strcmp(haOffsetCmdTopic(1), "console/board-a1b2c3/ch1/offset/set") == 0, "channel topic");
+  haDiscoveryExpand(haDiscoveryEntries[0].topic, expanded, sizeof(expanded), 1);
+  expect(strcmp(expanded, "homeassistant/light/board-a1b2c3_ch1/config") == 0, "discovery topic expands the channel");
+
+  fakeSetAdc(CURRENT_SENSE_PINS[1], secondOff);
+  runFor(POWER_OFF_DELAY + 1400);
+  expect(!second.ledEnabled, "second console powers off");
+#endif
+
+  // State publishing is coalesced and only sends what changed
+  fakeSetWifiConnected(true);
+  statePublishAll();
+  runFor(STATE_PUBLISH_COALESCE + 50);
+  uint32_t jsonBefore = fakePublishCount();
+  uint32_t rawBefore = fakeMqttPublishCount();
+  for (int i = 0; i < 10; ++i)
+  {
+    statePublishMark();
+    runFor(20);
+  }
+  runFor(STATE_PUBLISH_COALESCE + 50);
+  expect(fakePublishCount() == jsonBefore && fakeMqttPublishCount() == rawBefore, "unchanged state isn't republished");
+
+  const int savedOffset = console.thresholdOffset;
+  for (int i = 1; i <= 20; ++i)
+  {
+    applyOffsetCommand(savedOffset + i);
+    statePublishMark();
+    runFor(20);
+  }
+  runFor(STATE_PUBLISH_COALESCE + 50);
+  uint32_t flushes = fakePublishCount() - jsonBefore;
+  expect(flushes >= 1 && flushes <= 4, "offset drag coalesces into a few state publishes");
+  expect(fakeMqttPublishCount() - rawBefore == flushes * 3, "offset drag skips the baseline topic");
+  applyOffsetCommand(savedOffset);
+
+  // Low levels between two 8-bit steps average out over dithered frames
+  fbSetBrightness(255);
+  fbDitherEnable(true);
+  fbFill({300, 0, 0}); // 1.17 output steps
+  uint32_t redSum = 0;
+  uint32_t redMin = 255;
+  uint32_t redMax = 0;
+  for (int i = 0; i < 100; ++i)
+  {
+    fbShow();
+    uint32_t red = fakePixel(0) >> 16;
+    redMin = red < redMin ? red : redMin;
+    redMax = red > redMax ? red : redMax;
+    redSum += red;
+  }
+  expect(redSum >= 115 && redSum <= 119, "dithered output averages the 16-bit level");
+  expect(redMin == 1 && redMax == 2, "dithered output alternates between neighbouring levels");
+  fbFill(rgb16FromColor(0xFFFFFF));
+  fbShow();
+  expect(!fbDithering() && fakePixel(0) == 0xFFFFFF, "full scale maps exactly, with nothing to dither");
+
+  // A lit static color at low brightness dithers, then settles rounded
+  const ColorMode ditherMode = console.colorMode;
+  const uint32_t ditherColor = console.customColor;
+  console.colorMode = ColorMode::Custom;
+  console.customColor = 0x406080;
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(1300);
+  ledSetBrightness(3);
+  runFor(LED_FRAME_INTERVAL);
+  expect(ledIdleMs(halMillis()) <= LED_FRAME_INTERVAL, "dim static color refreshes while dithering");
+  runFor(LED_DITHER_SETTLE + 100);
+  expect(!fbDitherEnabled() && ledIdleMs(halMillis()) == UINT32_MAX, "static frame stops refreshing once settled");
+  console.colorMode = ditherMode;
+  console.customColor = ditherColor;
+  ledSetBrightness(currentBrightness);
+  updateAllLEDs(false);
+  expect(fbDitherEnabled(), "a change dithers again");
+
+  // Effects redraw every frame, but the strip is only written when it changes
+  Effect effect;
+  expect(effectFromName("rainbow", effect) && effect == Effect::Rainbow, "effect looked up by name");
+  expect(!effectFromName("disco", effect), "unknown effect rejected");
+
+  const uint32_t savedCustom = console.customColor;
+  const ColorMode savedMode = console.colorMode;
+  console.customColor = 0xFF0000;
+  console.colorMode = ColorMode::Custom;
+  ledSetBrightness(255);
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(1300);
+  uint32_t staticShows = fakeShowCount();
+  runFor(500);
+  expect(fakeShowCount() == staticShows, "unchanged solid frame isn't shown again");
+
+  currentEffect = Effect::Rainbow;
+  updateAllLEDs(false); // As applyEffect() does
+  uint32_t effectShows = fakeShowCount();
+  runFor(500);
+  expect(fakeShowCount() - staticShows >= 40, "rainbow shows a new frame every frame");
+  expect(fakePixel(0) != fakePixel(NUM_PIXELS / (2 * CONSOLE_CHANNELS)), "rainbow spreads hues along the strip");
+  bool paced = true;
+  for (uint32_t f = effectShows + 1; f < fakeShowCount(); ++f)
+    paced &= fakeFrameTime(f) - fakeFrameTime(f - 1) >= LED_FRAME_INTERVAL;
+  expect(paced, "frames go out no faster than LED_FRAME_INTERVAL");
+  // A single pixel can sit on a flat stretch of the hue wheel for a frame
+  bool differ = false;
+  for (uint16_t i = 0; i < NUM_PIXELS; ++i)
+    differ |= fakeFramePixel(fakeShowCount() - 1, i) != fakeFramePixel(fakeShowCount() - 2, i);
+  expect(differ, "consecutive rainbow frames differ");
+
+  // Long strip split into segments, only the animated one is redrawn
+  currentEffect = Effect::Solid;
+  expect(segmentsConfigure(300, "0-99:rainbow,100-299"), "300 pixels in two segments accepted");
+  runFor(200);
+  uint32_t last = fakeShowCount() - 1;
+  expect(fakeFramePixel(last, 0) != fakeFramePixel(last, 50), "rainbow segment spreads hues");
+  expect(fakeFramePixel(last, 100) == 0xFF0000 && fakeFramePixel(last, 299) == 0xFF0000, "solid segment shows the color");
+  differ = false;
+  for (uint16_t i = 0; i < 100; ++i)
+    differ |= fakeFramePixel(last, i) != fakeFramePixel(last - 1, i);
+  expect(differ, "rainbow segment changes every frame");
+  paced = true;
+  for (uint32_t f = last - 4; f <= last; ++f)
+    paced &= fakeFrameTime(f) - fakeFrameTime(f - 1) >= 300 * 30 / 1000;
+  expect(paced, "frame interval covers the strip's wire time");
+  expect(!segmentsConfigure(300, "0-99,50-120"), "overlapping segments rejected");
+  expect(!segmentsConfigure(LED_MAX_PIXELS + 1, nullptr), "strip longer than the buffers rejected");
+  expect(segmentsCount() == 2 && segmentsPixelCount() == 300, "rejected layout leaves the old one");
+  expect(segmentsConfigure(NUM_PIXELS, ""), "back to the default layout");
+
+  console.customColor = savedCustom;
+  console.colorMode = savedMode;
+  ledSetBrightness(currentBrightness);
+  fakeSetAdc(CURRENT_SENSE_PIN, offLevel);
+  runFor(POWER_OFF_DELAY + 1400);
+
+  // Firmware update streamed in small reads, hashed as it's written
+  uint8_t digest[SHA256_DIGEST_LEN];
+  Sha256 sha;
+  sha256Begin(sha);
+  sha256Update(sha, (const uint8_t *)"abc", 3);
+  sha256Finish(sha, digest);
+  uint8_t abcDigest[SHA256_DIGEST_LEN];
+  sha256FromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", abcDigest);
+  expect(memcmp(digest, abcDigest, sizeof(digest)) == 0, "sha256 matches the reference vector");
+
+  static uint8_t image[5000];
+  for (size_t i = 0; i < sizeof(image); ++i)
+    image[i] = (uint8_t)(i * 31 + 7);
+  sha256Begin(sha);
+  sha256Update(sha, image, sizeof(image));
+  sha256Finish(sha, digest);
+  char imageHex[SHA256_DIGEST_LEN * 2 + 1];
+  for (size_t i = 0; i < SHA256_DIGEST_LEN; ++i)
+    snprintf(imageHex + i * 2, 3, "%02x", digest[i]);
+
+  fakeSetHttpBody(image, sizeof(image), 100);
+  const uint32_t showsBefore = fakeShowCount();
+  expect(otaUpdateStart("http://fw.local/image.bin", imageHex), "firmware download started");
+  runFor(LOOP_PERIOD_MS);
+  expect(otaUpdateState() == OtaState::Downloading, "download is spread over several loops");
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(500);
+  expect(fakeShowCount() > showsBefore, "LEDs keep updating during the download");
+  expect(fakeOtaFlashed(), "verified image flashed");
+  expect(strstr(fakeLastPayload(haFwStatusTopic()), "\"success\"") != nullptr, "success published on the status topic");
+  runFor(OTA_REBOOT_DELAY + 50);
+  expect(fakeRestartCount() == 1, "reboots after the update");
+  fakeSetAdc(CURRENT_SENSE_PIN, offLevel);
+  runFor(POWER_OFF_DELAY + 100);
+
+  image[1234] ^= 0xFF;
+  fakeSetHttpBody(image, sizeof(image), 100);
+  otaUpdateStart("http://fw.local/image.bin", imageHex);
+  runFor(500);
+  expect(!fakeOtaFlashed() && otaUpdateState() == OtaState::Failed, "corrupted image rejected");
+  expect(strstr(fakeLastPayload(haFwStatusTopic()), "sha256 mismatch") != nullptr, "mismatch published on the status topic");
+  expect(fakeRestartCount() == 1, "no reboot after a rejected image");
+  fakeSetWifiConnected(false);
+
+  // With every console off long enough sampling drops to a slow poll and the
+  // input pins are armed to wake the chip
+  runFor(ADC_STANDBY_DELAY + 1500);
+  expect(adcSamplerStandby() && fakeAdcStreamPaused(), "ADC stream paused once every console is off");
+  expect(fakeInputWakeArmed(), "input pins armed as wake sources");
+  uint32_t pollsBefore = fakeAdcStreamPolls();
+  runFor(10 * ADC_STANDBY_INTERVAL);
+  expect(fakeAdcStreamPolls() - pollsBefore == 10, "stream polls the pins every ADC_STANDBY_INTERVAL");
+  expect(controlIdleMs() > ADC_STANDBY_INTERVAL, "control task leaves the slow poll to the stream");
+  // A capture leaves standby, its time axis follows the switch from the slow
+  // polls to the stream
+  adcTraceStart(traceSink, 1000);
+  runFor(700);
+  adcTraceStop();
+  uint32_t traceEndMs = (uint64_t)(lastTraceFrame.firstIndex + lastTraceFrame.count) * 1000 / lastTraceFrame.rateHz;
+  expect(firstTraceRate == 1000 / ADC_STANDBY_INTERVAL && lastTraceFrame.rateHz == ADC_SAMPLE_RATE_HZ,
+         "capture stamped with the rate samples arrive at");
+  expect(traceEndMs >= 650 && traceEndMs <= 720, "capture keeps real time across the rate switch");
+  runFor(ADC_STANDBY_DELAY);
+  expect(adcSamplerStandby(), "standby resumes after the capture");
+  fakeTurnEncoder(1);
+  fakeTurnEncoder(-1);
+  expect(!fakeInputWakeArmed(), "first input disarms the wake");
+  runFor(LOOP_PERIOD_MS);
+  expect(adcSamplerStandby(), "encoder turn alone keeps standby");
+  halInputWakeArm(true);
+
+  fakeSetAdc(CURRENT_SENSE_PIN, onLevel);
+  runFor(50);
+  expect(console.ledEnabled, "power on from standby detected within 50 ms");
+  expect(!adcSamplerStandby() && !fakeAdcStreamPaused() && !fakeInputWakeArmed(), "power on leaves standby");
+  runFor(100);
+  expect(controlIdleMs() <= LED_FRAME_INTERVAL, "control task wakes every frame during a fade");
+  fakeSetAdc(CURRENT_SENSE_PIN, offLevel);
+  runFor(POWER_OFF_DELAY + 1400);
+
+  // Wakes posted before the wait return at once with their reason
+  schedulerWake(LoopTask::Control, WakeReason::Input);
+  expect(schedulerWait(LoopTask::Control, 0) == WakeReason::Input, "pending wake reported with its reason");
+  expect(schedulerWait(LoopTask::Control, 0) == WakeReason::Timer, "wake consumed once");
+  settingsRequestCommit();
+  expect(schedulerWait(LoopTask::Control, 0) == WakeReason::Message, "commit request wakes the control task");
+  settingsLoop();
+  expect(!settingsCommitPending(), "requested commit done on the next iteration");
+
+  // Command handling
+  JsonDocument doc;
+  deserializeJson(doc, R"({"color":-1,"customColor":"#102030","brightness":40})");
+  uint8_t result = applySetCommand(doc);
+  expect(result & CommandStateChanged, "/set reports a state change");
+  expect(console.colorMode == ColorMode::Custom && console.customColor == 0x102030, "/set applies the custom color");
+  expect(fbBrightness() == 40, "/set applies brightness");
+
+  // {"color":5} as MessagePack on the parallel topic
+  static const uint8_t msgPackSet[] = {0x81, 0xA5, 'c', 'o', 'l', 'o', 'r', 0x05};
+  expect(controlCommandPush(haSetMsgPackCmdTopic(), msgPackSet, sizeof(msgPackSet)), "MessagePack command queued");
+  commandsPoll();
+  expect(console.colorMode == ColorMode::Palette && console.colorIndex == 5, "set/msgpack applies the color");
+
+  deserializeJson(doc, R"({"encoding":"both"})");
+  applySetCommand(doc);
+  expect(stateEncoding == StateEncoding::Both, "/set switches the state encoding");
+
+  printf("\nloop iterations: %u, avg %.0f ns/iteration\n", loopCount, loopNsTotal / loopCount);
+  printf("strip shows: %u, NVS writes: %u (%u requested)\n", fakeShowCount(), fakeNvsWriteCount(),
+         settingsWritesRequested());
+
+  JsonDocument stats;
+  loopStatsToJson(stats);
+  char statsJson[512];
+  serializeJson(stats, statsJson, sizeof(statsJson));
+  printf("loop stats (us): %s\n", statsJson);
+  printf("%s\n", failures ? "FAILED" : "OK");
+
+  return failures ? 1 : 0;
+}
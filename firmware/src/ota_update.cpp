@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <ota_update.h>
+#include <sha256.h>
+#include <ha_topics.h>
+#include <settings.h>
+#include <config.h>
+#include <hal.h>
+#include <serial_mux.h>
+
+static OtaState otaState = OtaState::Idle;
+
+static Sha256 hash;
+static uint8_t expectedDigest[SHA256_DIGEST_LEN];
+static bool haveExpectedDigest = false;
+
+static uint32_t totalBytes = 0;
+static uint32_t writtenBytes = 0;
+static uint32_t lastDataMs = 0;
+static uint32_t lastProgressMs = 0;
+static uint32_t rebootAt = 0;
+
+static uint8_t chunk[OTA_CHUNK_SIZE];
+
+static void publishStatus(const char *state, const char *detail)
+{
+  unsigned progress = totalBytes ? (unsigned)((uint64_t)writtenBytes * 100 / totalBytes) : 0;
+
+  char text[192];
+  int length = snprintf(text, sizeof(text), "{\"state\":\"%s\",\"progress\":%u,\"bytes\":%u,\"total\":%u%s%s%s}",
+                        state, progress, (unsigned)writtenBytes, (unsigned)totalBytes,
+                        detail ? ",\"detail\":\"" : "", detail ? detail : "", detail ? "\"" : "");
+
+  if (length > 0 && (size_t)length < sizeof(text))
+    halMqttPublish(haFwStatusTopic(), (const uint8_t *)text, length, true);
+}
+
+static void fail(const char *reason)
+{
+  Serial.printf("OTA update failed: %s\n", reason);
+  if (otaState == OtaState::Downloading)
+  {
+    halOtaAbort();
+    halHttpEnd();
+  }
+  otaState = OtaState::Failed;
+  publishStatus("failed", reason);
+}
+
+static void finish()
+{
+  uint8_t digest[SHA256_DIGEST_LEN];
+  sha256Finish(hash, digest);
+
+  char hex[SHA256_DIGEST_LEN * 2 + 1];
+  for (size_t i = 0; i < SHA256_DIGEST_LEN; ++i)
+    snprintf(hex + i * 2, 3, "%02x", digest[i]);
+
+  if (haveExpectedDigest && memcmp(digest, expectedDigest, SHA256_DIGEST_LEN) != 0)
+  {
+    Serial.printf("OTA digest mismatch, got %s\n", hex);
+    fail("sha256 mismatch");
+    return;
+  }
+
+  if (!halOtaEnd())
+  {
+    fail("image rejected");
+    return;
+  }
+  halHttpEnd();
+
+  Serial.printf("OTA update complete (sha256 %s)! Rebooting\n", hex);
+  otaState = OtaState::Rebooting;
+  rebootAt = halMillis() + OTA_REBOOT_DELAY;
+  publishStatus("success", hex);
+}
+
+bool otaUpdateStart(const char *url, const char *sha256Hex)
+{
+  if (otaState == OtaState::Downloading || otaState == OtaState::Rebooting)
+  {
+    Serial.println("OTA update already running, ignoring request");
+    return false;
+  }
+
+  totalBytes = 0;
+  writtenBytes = 0;
+  otaState = OtaState::Idle;
+
+  haveExpectedDigest = sha256Hex && sha256Hex[0];
+  if (haveExpectedDigest && !sha256FromHex(sha256Hex, expectedDigest))
+  {
+    fail("malformed sha256");
+    return false;
+  }
+  if (!haveExpectedDigest)
+    Serial.println("No sha256 given, the image won't be verified");
+
+  // Get pending settings to flash while the download runs
+  settingsRequestCommit();
+
+  Serial.printf("Starting OTA update from: %s\n", url);
+  publishStatus("connecting", nullptr);
+
+  int32_t contentLength = 0;
+  if (!halHttpBegin(url, contentLength))
+  {
+    fail("http request failed");
+    return false;
+  }
+
+  if (contentLength <= 0)
+  {
+    halHttpEnd();
+    fail("invalid content length");
+    return false;
+  }
+
+  totalBytes = contentLength;
+  if (!halOtaBegin(totalBytes))
+  {
+    halHttpEnd();
+    fail("not enough space");
+    return false;
+  }
+
+  sha256Begin(hash);
+  otaState = OtaState::Downloading;
+  lastDataMs = halMillis();
+  lastProgressMs = lastDataMs;
+  publishStatus("downloading", nullptr);
+  return true;
+}
+
+void otaUpdateLoop()
+{
+  uint32_t now = halMillis();
+
+  if (otaState == OtaState::Rebooting)
+  {
+    // Pending settings get one more delay to reach flash
+    int32_t late = (int32_t)(now - rebootAt);
+    if (late >= 0 && (!settingsCommitPending() || late >= (int32_t)OTA_REBOOT_DELAY))
+    {
+      halRestart();
+      otaState = OtaState::Idle; // Only reached on the host fakes
+    }
+    return;
+  }
+
+  if (otaState != OtaState::Downloading)
+    return;
+
+  for (uint8_t i = 0; i < OTA_CHUNKS_PER_LOOP && writtenBytes < totalBytes; ++i)
+  {
+    size_t want = totalBytes - writtenBytes;
+    if (want > sizeof(chunk))
+      want = sizeof(chunk);
+
+    int32_t got = halHttpRead(chunk, want);
+    if (got < 0)
+    {
+      fail("connection closed");
+      return;
+    }
+    if (got == 0)
+      break;
+
+    if (!halOtaWrite(chunk, got))
+    {
+      fail("flash write failed");
+      return;
+    }
+    sha256Update(hash, chunk, got);
+    writtenBytes += got;
+    lastDataMs = now;
+  }
+
+  if (writtenBytes >= totalBytes)
+  {
+    finish();
+    return;
+  }
+
+  if (now - lastDataMs >= OTA_STALL_TIMEOUT)
+  {
+    fail("download stalled");
+    return;
+  }
+
+  if (now - lastProgressMs >= OTA_PROGRESS_INTERVAL)
+  {
+    lastProgressMs = now;
+    publishStatus("downloading", nullptr);
+  }
+}
+
+OtaState otaUpdateState() { return otaState; }
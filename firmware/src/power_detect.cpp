@@ -0,0 +1,28 @@
+#include <power_detect.h>
+
+bool powerDetectUpdate(PowerDetector &det, int adc, int threshold, int offset, uint32_t nowMs)
+{
+  const int TH_ON = threshold + offset;
+  const int TH_OFF = powerOffThreshold(threshold, offset);
+
+  const int level = det.filter.update(adc, threshold);
+  det.level = level;
+
+  if (!det.powered && level > TH_ON)
+  {
+    det.powered = true;
+  }
+  else if (det.powered && level < TH_OFF)
+  {
+    if (det.powerOffTime == 0)
+      det.powerOffTime = nowMs;
+    if (nowMs - det.powerOffTime >= POWER_OFF_DELAY)
+      det.powered = false;
+  }
+  else if (level > TH_OFF)
+  {
+    det.powerOffTime = 0;
+  }
+
+  return det.powered;
+}
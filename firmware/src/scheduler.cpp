@@ -0,0 +1,105 @@
+#include <atomic>
+
+#include <scheduler.h>
+#include <hal.h>
+
+static constexpr uint8_t NUM_TASKS = static_cast<uint8_t>(LoopTask::Count);
+static constexpr uint8_t NUM_REASONS = static_cast<uint8_t>(WakeReason::Count);
+
+static const char *const REASON_NAMES[NUM_REASONS] = {"timer", "input", "adc", "message", "network"};
+
+// Reasons posted since the task last woke, one bit each
+static std::atomic<uint32_t> pending[NUM_TASKS];
+
+// Each task only writes its own slots; the network task reads and resets
+// everything for the summary, a torn count there is harmless
+static uint32_t wakeCounts[NUM_TASKS][NUM_REASONS];
+static uint32_t asleepMs[NUM_TASKS];
+static uint32_t windowStart = 0;
+
+// Both tasks blocked: the window in which the chip can light sleep
+static std::atomic<uint8_t> awakeTasks{NUM_TASKS};
+static std::atomic<uint32_t> allAsleepSince{0};
+static std::atomic<uint32_t> allAsleepMs{0};
+
+void schedulerBegin(LoopTask task)
+{
+  halWakeRegister(static_cast<uint8_t>(task));
+}
+
+void schedulerWake(LoopTask task, WakeReason reason)
+{
+  pending[static_cast<uint8_t>(task)].fetch_or(1u << static_cast<uint8_t>(reason));
+  halWakeTask(static_cast<uint8_t>(task));
+}
+
+WakeReason schedulerWait(LoopTask task, uint32_t timeoutMs)
+{
+  uint8_t t = static_cast<uint8_t>(task);
+
+  if (pending[t].load() == 0 && timeoutMs > 0)
+  {
+    uint32_t start = halMillis();
+    if (awakeTasks.fetch_sub(1) == 1)
+      allAsleepSince.store(start);
+
+    halWaitForWake(timeoutMs);
+
+    uint32_t end = halMillis();
+    if (awakeTasks.fetch_add(1) == 0)
+      allAsleepMs.fetch_add(end - allAsleepSince.load());
+    asleepMs[t] += end - start;
+  }
+
+  uint32_t bits = pending[t].exchange(0);
+  if (bits == 0)
+  {
+    wakeCounts[t][static_cast<uint8_t>(WakeReason::Timer)]++;
+    return WakeReason::Timer;
+  }
+
+  WakeReason first = WakeReason::Count;
+  for (uint8_t r = 0; r < NUM_REASONS; ++r)
+  {
+    if (!(bits & (1u << r)))
+      continue;
+    wakeCounts[t][r]++;
+    if (first == WakeReason::Count)
+      first = static_cast<WakeReason>(r);
+  }
+  return first;
+}
+
+void schedulerToJson(JsonDocument &doc)
+{
+  uint32_t window = halMillis() - windowStart;
+  if (window == 0)
+    return;
+
+  JsonObject sleep = doc["sleep"].to<JsonObject>();
+  sleep["control_pct"] = asleepMs[static_cast<uint8_t>(LoopTask::Control)] * 100ull / window;
+  sleep["network_pct"] = asleepMs[static_cast<uint8_t>(LoopTask::Network)] * 100ull / window;
+  sleep["idle_pct"] = allAsleepMs.load() * 100ull / window;
+  sleep["light_sleep"] = halLightSleepAvailable();
+
+  JsonObject wakes = sleep["wakes"].to<JsonObject>();
+  for (uint8_t r = 0; r < NUM_REASONS; ++r)
+  {
+    uint32_t n = 0;
+    for (uint8_t t = 0; t < NUM_TASKS; ++t)
+      n += wakeCounts[t][r];
+    wakes[REASON_NAMES[r]] = n;
+  }
+}
+
+void schedulerReset()
+{
+  for (uint8_t t = 0; t < NUM_TASKS; ++t)
+  {
+    asleepMs[t] = 0;
+    for (uint8_t r = 0; r < NUM_REASONS; ++r)
+      wakeCounts[t][r] = 0;
+  }
+  allAsleepMs.store(0);
+  windowStart = halMillis();
+}
@@ -0,0 +1,259 @@
+#include <string.h>
+#include <stdio.h>
+#include <atomic>
+
+#include <settings.h>
+#include <utils.h>
+#include <config.h>
+#include <state.h>
+#include <scheduler.h>
+#include <hal.h>
+
+enum class SettingType : uint8_t
+{
+  Int,
+  UChar,
+  String
+};
+
+struct SettingEntry
+{
+  const char *key;
+  SettingType type;
+  bool dirty;
+  int32_t intValue;
+  char strValue[DEVICE_NAME_MAX_LEN + 1];
+};
+
+// Room for every channel's keys on top of the board-wide ones
+static constexpr uint8_t MAX_SETTINGS = 16 + 5 * (CONSOLE_CHANNELS - 1);
+
+static SettingEntry entries[MAX_SETTINGS];
+static uint8_t entryCount = 0;
+
+static bool anyDirty = false;
+static uint32_t firstDirtyMs = 0;
+static uint32_t lastPutMs = 0;
+
+static std::atomic<bool> commitRequested{false};
+
+static uint32_t writesRequested = 0;
+static uint32_t writesCommitted = 0;
+
+static SettingEntry *findEntry(const char *key)
+{
+  for (uint8_t i = 0; i < entryCount; ++i)
+  {
+    if (strcmp(entries[i].key, key) == 0)
+      return &entries[i];
+  }
+  return nullptr;
+}
+
+// Only touches flash when the stored value actually differs
+static void writeEntry(SettingEntry &e)
+{
+  e.dirty = false;
+
+  switch (e.type)
+  {
+  case SettingType::Int:
+    if (halNvsHasKey(e.key) && halNvsGetInt(e.key, 0) == e.intValue)
+      return;
+    halNvsPutInt(e.key, e.intValue);
+    break;
+  case SettingType::UChar:
+    if (halNvsHasKey(e.key) && halNvsGetUChar(e.key, 0) == (uint8_t)e.intValue)
+      return;
+    halNvsPutUChar(e.key, (uint8_t)e.intValue);
+    break;
+  case SettingType::String:
+  {
+    char stored[sizeof(e.strValue)];
+    if (halNvsHasKey(e.key) && halNvsGetString(e.key, stored, sizeof(stored)) > 0 &&
+        strcmp(stored, e.strValue) == 0)
+      return;
+    halNvsPutString(e.key, e.strValue);
+    break;
+  }
+  }
+  writesCommitted++;
+}
+
+static void markDirty(SettingEntry &e)
+{
+  uint32_t now = halMillis();
+  if (!anyDirty)
+    firstDirtyMs = now;
+  lastPutMs = now;
+  anyDirty = true;
+  e.dirty = true;
+}
+
+static SettingEntry *addEntry(const char *key, SettingType type)
+{
+  if (entryCount >= MAX_SETTINGS)
+    return nullptr;
+
+  SettingEntry *e = &entries[entryCount++];
+  e->key = key;
+  e->type = type;
+  e->dirty = false;
+  e->intValue = 0;
+  e->strValue[0] = '\0';
+  return e;
+}
+
+bool settingsHasKey(const char *key)
+{
+  return findEntry(key) || halNvsHasKey(key);
+}
+
+int32_t settingsGetInt(const char *key, int32_t defaultValue)
+{
+  SettingEntry *e = findEntry(key);
+  return e ? e->intValue : halNvsGetInt(key, defaultValue);
+}
+
+uint8_t settingsGetUChar(const char *key, uint8_t defaultValue)
+{
+  SettingEntry *e = findEntry(key);
+  return e ? (uint8_t)e->intValue : halNvsGetUChar(key, defaultValue);
+}
+
+size_t settingsGetString(const char *key, char *buf, size_t len)
+{
+  SettingEntry *e = findEntry(key);
+  if (!e)
+    return halNvsGetString(key, buf, len);
+
+  if (len == 0)
+    return 0;
+  snprintf(buf, len, "%s", e->strValue);
+  return strlen(buf);
+}
+
+static void putInteger(const char *key, SettingType type, int32_t value)
+{
+  writesRequested++;
+
+  SettingEntry *e = findEntry(key);
+  if (!e)
+  {
+    e = addEntry(key, type);
+    if (!e)
+    {
+      // Cache full, write through
+      if (type == SettingType::UChar)
+        halNvsPutUChar(key, (uint8_t)value);
+      else
+        halNvsPutInt(key, value);
+      writesCommitted++;
+      return;
+    }
+  }
+  else if (e->intValue == value)
+  {
+    return;
+  }
+
+  e->intValue = value;
+  markDirty(*e);
+}
+
+void settingsPutInt(const char *key, int32_t value)
+{
+  putInteger(key, SettingType::Int, value);
+}
+
+void settingsPutUChar(const char *key, uint8_t value)
+{
+  putInteger(key, SettingType::UChar, value);
+}
+
+void settingsPutString(const char *key, const char *value)
+{
+  writesRequested++;
+
+  SettingEntry *e = findEntry(key);
+  if (!e)
+  {
+    e = addEntry(key, SettingType::String);
+    if (!e)
+    {
+      halNvsPutString(key, value);
+      writesCommitted++;
+      return;
+    }
+  }
+  else if (strncmp(e->strValue, value, sizeof(e->strValue) - 1) == 0)
+  {
+    return;
+  }
+
+  snprintf(e->strValue, sizeof(e->strValue), "%s", value);
+  markDirty(*e);
+}
+
+void settingsCommit()
+{
+  if (!anyDirty)
+    return;
+
+  for (uint8_t i = 0; i < entryCount; ++i)
+  {
+    if (entries[i].dirty)
+      writeEntry(entries[i]);
+  }
+  anyDirty = false;
+}
+
+void settingsRequestCommit()
+{
+  commitRequested.store(true);
+  schedulerWake(LoopTask::Control, WakeReason::Message);
+}
+
+bool settingsCommitPending()
+{
+  return commitRequested.load();
+}
+
+void settingsLoop()
+{
+  if (commitRequested.load())
+  {
+    settingsCommit();
+    commitRequested.store(false);
+    return;
+  }
+
+  if (!anyDirty)
+    return;
+
+  uint32_t now = halMillis();
+  if (now - lastPutMs >= SETTINGS_COMMIT_DELAY || now - firstDirtyMs >= SETTINGS_COMMIT_MAX_DELAY)
+    settingsCommit();
+}
+
+uint32_t settingsIdleMs(uint32_t nowMs)
+{
+  if (commitRequested.load())
+    return 0;
+  if (!anyDirty)
+    return UINT32_MAX;
+
+  uint32_t idle = msUntil(lastPutMs + SETTINGS_COMMIT_DELAY, nowMs);
+  uint32_t cap = msUntil(firstDirtyMs + SETTINGS_COMMIT_MAX_DELAY, nowMs);
+  return idle < cap ? idle : cap;
+}
+
+uint32_t settingsWritesRequested()
+{
+  return writesRequested;
+}
+
+uint32_t settingsWritesCommitted()
+{
+  return writesCommitted;
+}
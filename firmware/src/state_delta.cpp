@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include <state_publish.h>
+
+static uint16_t changedChannelFields(const ChannelSnapshot &a, const ChannelSnapshot &b)
+{
+  uint16_t fields = 0;
+  if (a.enabled != b.enabled)
+    fields |= FieldEnabled;
+  if (a.colorMode != b.colorMode || a.colorIndex != b.colorIndex || a.customColor != b.customColor)
+    fields |= FieldColor;
+  if (a.baseline != b.baseline)
+    fields |= FieldBaseline;
+  if (a.offset != b.offset)
+    fields |= FieldOffset;
+  return fields;
+}
+
+// Board-wide fields only, see changedChannelFields()
+static uint16_t changedFields(const StateSnapshot &a, const StateSnapshot &b)
+{
+  uint16_t fields = 0;
+  if (a.brightness != b.brightness)
+    fields |= FieldBrightness;
+  if (strcmp(a.name, b.name) != 0)
+    fields |= FieldName;
+  if (a.autoCalibrate != b.autoCalibrate)
+    fields |= FieldAutoCalibrate;
+  if (a.bootTime != b.bootTime)
+    fields |= FieldBootTime;
+  if (a.effect != b.effect)
+    fields |= FieldEffect;
+  if (a.encoding != b.encoding)
+    fields |= FieldEncoding;
+  return fields;
+}
+
+StateDelta stateDelta(const StateSnapshot &latest, const StateSnapshot &published, uint16_t forced)
+{
+  StateDelta delta;
+  delta.boardFields = changedFields(latest, published) | forced;
+  delta.anyChannelFields = 0;
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    delta.channelFields[ch] = delta.boardFields | changedChannelFields(latest.channels[ch], published.channels[ch]);
+    delta.anyChannelFields |= delta.channelFields[ch];
+  }
+  return delta;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <state_json.h>
+#include <power_detect.h>
+#include <effects.h>
+#include <state.h>
+#include <utils.h>
+#include <config.h>
+
+static void channelStateToJson(JsonObject obj, const ChannelSnapshot &c, bool autoCalibrate)
+{
+  obj["enabled"] = c.enabled;
+  obj["colorMode"] = (c.colorMode == ColorMode::Palette) ? "palette" : "custom";
+  obj["colorIndex"] = c.colorIndex;
+
+  char hexColor[8];
+  snprintf(hexColor, sizeof(hexColor), "#%06X", (unsigned)c.customColor);
+  obj["customColor"] = hexColor;
+
+  JsonObject threshold = obj["threshold"].to<JsonObject>();
+  threshold["baseline"] = c.baseline;
+  threshold["offset"] = c.offset;
+  threshold["on"] = c.baseline + c.offset;
+  threshold["off"] = powerOffThreshold(c.baseline, c.offset);
+  threshold["level"] = c.level;
+  threshold["auto"] = autoCalibrate;
+}
+
+void stateToJson(const StateSnapshot &s, JsonDocument &doc)
+{
+  doc["brightness"] = s.brightness;
+  doc["bootTime"] = s.bootTime;
+  doc["name"] = s.name;
+  doc["effect"] = effectName(s.effect);
+  doc["encoding"] = stateEncodingName(s.encoding);
+
+  // Channel 0 stays at the top level; with more consoles each one is also
+  // listed under "channels"
+  channelStateToJson(doc.as<JsonObject>(), s.channels[0], s.autoCalibrate);
+  if (CONSOLE_CHANNELS > 1)
+  {
+    JsonArray list = doc["channels"].to<JsonArray>();
+    for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+      channelStateToJson(list.add<JsonObject>(), s.channels[ch], s.autoCalibrate);
+  }
+}
+
+void lightStateToJson(const StateSnapshot &s, uint8_t channel, JsonDocument &doc)
+{
+  const ChannelSnapshot &ch = s.channels[channel];
+  doc["state"] = ch.enabled ? "ON" : "OFF";
+  doc["brightness"] = (int)s.brightness;
+  doc["color_mode"] = "rgb";
+
+  uint32_t c = (ch.colorMode == ColorMode::Palette && ch.colorIndex < NUM_COLORS) ? colors[ch.colorIndex] : ch.customColor;
+  uint8_t r = 0, g = 0, b = 0;
+  rgbFrom24(c, r, g, b);
+  auto color = doc["color"].to<JsonObject>();
+  color["r"] = (int)r;
+  color["g"] = (int)g;
+  color["b"] = (int)b;
+  doc["effect"] = effectName(s.effect);
+}
+
+// Indexed by encoding - 1
+static const char *const STATE_ENCODING_NAMES[] = {"json", "msgpack", "both"};
+static_assert(sizeof(STATE_ENCODING_NAMES) / sizeof(STATE_ENCODING_NAMES[0]) == STATE_ENCODING_MAX, "one name per encoding");
+
+const char *stateEncodingName(StateEncoding encoding)
+{
+  uint8_t index = static_cast<uint8_t>(encoding) - 1;
+  return index < STATE_ENCODING_MAX ? STATE_ENCODING_NAMES[index] : STATE_ENCODING_NAMES[0];
+}
+
+bool stateEncodingFromName(const char *name, StateEncoding &encoding)
+{
+  for (uint8_t i = 0; i < STATE_ENCODING_MAX; ++i)
+  {
+    if (strcmp(name, STATE_ENCODING_NAMES[i]) == 0)
+    {
+      encoding = static_cast<StateEncoding>(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+
+#include <state_publish.h>
+#include <power_detect.h>
+#include <spsc_ring.h>
+#include <scheduler.h>
+#include <utils.h>
+#include <ha_topics.h>
+#include <state.h>
+#include <config.h>
+#include <hal.h>
+
+static SpscRing<StateSnapshot, 4> snapshots;
+
+// Control task side
+static StateSnapshot snapshotStage;
+static uint16_t markedForced = 0;
+static bool marked = false;
+static uint32_t markedSince = 0;
+
+// Network task side
+static StateSnapshot latest;
+static StateSnapshot published;
+static uint16_t pendingForced = 0;
+static bool havePending = false;
+static bool haveLatest = false;
+static uint32_t publishCount = 0;
+
+static void takeSnapshot(StateSnapshot &s)
+{
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    const ChannelState &channel = channels[ch];
+    ChannelSnapshot &c = s.channels[ch];
+    c.enabled = channel.ledEnabled;
+    c.colorMode = channel.colorMode;
+    c.colorIndex = channel.colorIndex;
+    c.customColor = channel.customColor;
+    c.baseline = channel.threshold;
+    c.offset = channel.thresholdOffset;
+    c.level = channel.adcLevel;
+  }
+  s.brightness = currentBrightness;
+  s.effect = currentEffect;
+  snprintf(s.name, sizeof(s.name), "%s", deviceName);
+  s.autoCalibrate = autoCalibrate;
+  s.encoding = stateEncoding;
+  s.bootTime = 0;
+}
+
+static void publishInt(const char *topic, int value)
+{
+  char text[12];
+  int length = snprintf(text, sizeof(text), "%d", value);
+  halMqttPublish(topic, (const uint8_t *)text, length, true);
+  publishCount++;
+}
+
+void statePublishMark(uint16_t forceFields)
+{
+  markedForced |= forceFields;
+  if (marked)
+    return;
+
+  marked = true;
+  markedSince = halMillis();
+}
+
+void statePublishLoop()
+{
+  if (!marked || halMillis() - markedSince < STATE_PUBLISH_COALESCE)
+    return;
+
+  takeSnapshot(snapshotStage);
+  snapshotStage.forced = markedForced;
+
+  // Queue full: try again next iteration with a fresher snapshot
+  if (!snapshots.push(snapshotStage))
+    return;
+
+  markedForced = 0;
+  marked = false;
+  schedulerWake(LoopTask::Network, WakeReason::Message);
+}
+
+uint32_t statePublishIdleMs(uint32_t nowMs)
+{
+  return marked ? msUntil(markedSince + STATE_PUBLISH_COALESCE, nowMs) : UINT32_MAX;
+}
+
+void statePublishAll()
+{
+  pendingForced = FieldAll;
+  havePending = haveLatest;
+}
+
+void statePublishDrain()
+{
+  StateSnapshot incoming;
+  while (snapshots.pop(incoming))
+  {
+    latest = incoming;
+    pendingForced |= incoming.forced;
+    havePending = true;
+    haveLatest = true;
+  }
+
+  // Boot time arrives from NTP on this side
+  if (haveLatest && bootTime != published.bootTime)
+    havePending = true;
+
+  // Keep it pending until there is a connection to send it on
+  if (!havePending || !halMqttConnected())
+    return;
+
+  latest.bootTime = bootTime; // Owned by the network task
+  StateDelta delta = stateDelta(latest, published, pendingForced);
+
+  published = latest;
+  pendingForced = 0;
+  havePending = false;
+
+  if (delta.anyChannelFields & DEVICE_STATE_FIELDS)
+  {
+    publishState(latest, delta.boardFields & FieldEncoding);
+    publishCount++;
+  }
+
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    const ChannelSnapshot &c = latest.channels[ch];
+    uint16_t fields = delta.channelFields[ch];
+
+    if (fields & LIGHT_STATE_FIELDS)
+    {
+      publishHALightState(latest, ch);
+      publishCount++;
+    }
+
+    if (fields & FieldOffset)
+      publishInt(haOffsetStateTopic(ch), c.offset);
+    if (fields & FieldBaseline)
+      publishInt(haBaseStateTopic(ch), c.baseline);
+    if (fields & THRESHOLD_FIELDS)
+    {
+      publishInt(haThOnStateTopic(ch), c.baseline + c.offset);
+      publishInt(haThOffStateTopic(ch), powerOffThreshold(c.baseline, c.offset));
+    }
+  }
+}
+
+uint32_t statePublishCount()
+{
+  return publishCount;
+}
@@ -0,0 +1,93 @@
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+#include <task_queues.h>
+#include <spsc_ring.h>
+#include <scheduler.h>
+
+static SpscRing<ControlCommand, 4> controlCommands;
+static SpscRing<TraceFrameMessage, 8> traceFrames;
+static SpscRing<DiscoveryNameMessage, 2> discoveryNames;
+// Both tasks drop into it
+static std::atomic<uint32_t> dropped{0};
+
+// Staging buffers, each only touched by the queue's producer
+static ControlCommand commandStage;
+static TraceFrameMessage frameStage;
+static DiscoveryNameMessage nameStage;
+
+bool controlCommandPush(const char *topic, const uint8_t *payload, size_t length)
+{
+  if (strlen(topic) >= sizeof(commandStage.topic) || length > sizeof(commandStage.payload))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  strcpy(commandStage.topic, topic);
+  commandStage.length = (uint16_t)length;
+  if (length)
+    memcpy(commandStage.payload, payload, length);
+
+  if (!controlCommands.push(commandStage))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  schedulerWake(LoopTask::Control, WakeReason::Message);
+  return true;
+}
+
+bool controlCommandPop(ControlCommand &out)
+{
+  return controlCommands.pop(out);
+}
+
+bool traceFramePush(const uint8_t *frame, size_t length)
+{
+  if (length > sizeof(frameStage.data))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  frameStage.length = (uint16_t)length;
+  memcpy(frameStage.data, frame, length);
+
+  if (!traceFrames.push(frameStage))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  schedulerWake(LoopTask::Network, WakeReason::Message);
+  return true;
+}
+
+bool traceFramePop(TraceFrameMessage &out)
+{
+  return traceFrames.pop(out);
+}
+
+bool discoveryNamePush(const char *name)
+{
+  snprintf(nameStage.name, sizeof(nameStage.name), "%s", name);
+
+  if (!discoveryNames.push(nameStage))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  schedulerWake(LoopTask::Network, WakeReason::Message);
+  return true;
+}
+
+bool discoveryNamePop(DiscoveryNameMessage &out)
+{
+  return discoveryNames.pop(out);
+}
+
+uint32_t taskQueuesDropped()
+{
+  return dropped.load(std::memory_order_relaxed);
+}
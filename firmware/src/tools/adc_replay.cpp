@@ -0,0 +1,211 @@
+// Offline replay of captured ADC traces through the firmware's power
+// detector (power_detect.cpp with the configured POWER_FILTER).
+//
+//   adc_replay <trace.bin> [--baseline N] [--offset N] [--sweep FROM:TO:STEP]
+//              [--expect ON_MS:OFF_MS ...] [--tolerance MS]
+//
+// The trace is any byte stream holding capture frames: a raw serial log or
+// concatenated MQTT payloads (mosquitto_sub -N). Without --baseline the
+// median of the first second is used. --expect lists the real power
+// intervals; detected edges are matched to them to report latency, and edges
+// without a match count as false toggles.
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <adc_trace.h>
+#include <power_detect.h>
+#include <config.h>
+
+struct Interval
+{
+  uint32_t onMs;
+  uint32_t offMs;
+};
+
+struct Edge
+{
+  uint32_t ms;
+  bool on;
+};
+
+struct ReplayResult
+{
+  std::vector<Edge> edges;
+  uint32_t matched = 0;
+  uint32_t falseToggles = 0;
+  uint32_t missed = 0;
+  uint32_t latencySum = 0;
+  uint32_t latencyMax = 0;
+};
+
+static bool loadTrace(const char *path, std::vector<uint16_t> &samples, std::vector<uint32_t> &timesMs, uint16_t &rateHz)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+
+  AdcTraceFrame frame;
+  size_t pos = 0;
+  size_t consumed = 0;
+  rateHz = 0;
+  while (pos < data.size() && adcTraceDecode(data.data() + pos, data.size() - pos, frame, consumed))
+  {
+    pos += consumed;
+    if (frame.rateHz == 0)
+      continue;
+    rateHz = frame.rateHz;
+    for (uint8_t i = 0; i < frame.count; ++i)
+    {
+      samples.push_back(frame.samples[i]);
+      timesMs.push_back((uint32_t)(((uint64_t)frame.firstIndex + i) * 1000 / frame.rateHz));
+    }
+  }
+
+  return !samples.empty();
+}
+
+static ReplayResult replay(const std::vector<uint16_t> &samples, const std::vector<uint32_t> &timesMs,
+                           int baseline, int offset, const std::vector<Interval> &expected, uint32_t toleranceMs)
+{
+  ReplayResult result;
+  PowerDetector det;
+
+  for (size_t i = 0; i < samples.size(); ++i)
+  {
+    bool wasPowered = det.powered;
+    // Offset by one so t = 0 isn't mistaken for "no pending power off"
+    powerDetectUpdate(det, samples[i], baseline, offset, timesMs[i] + 1);
+    if (det.powered != wasPowered)
+      result.edges.push_back({timesMs[i], det.powered});
+  }
+
+  std::vector<bool> used(expected.size() * 2, false);
+  for (const Edge &e : result.edges)
+  {
+    bool found = false;
+    for (size_t k = 0; k < expected.size() && !found; ++k)
+    {
+      uint32_t truth = e.on ? expected[k].onMs : expected[k].offMs;
+      size_t slot = k * 2 + (e.on ? 0 : 1);
+      if (!used[slot] && e.ms >= truth && e.ms - truth <= toleranceMs)
+      {
+        used[slot] = true;
+        uint32_t latency = e.ms - truth;
+        result.latencySum += latency;
+        result.latencyMax = std::max(result.latencyMax, latency);
+        result.matched++;
+        found = true;
+      }
+    }
+    if (!found)
+      result.falseToggles++;
+  }
+
+  for (size_t k = 0; k < expected.size(); ++k)
+  {
+    if (!used[k * 2])
+      result.missed++;
+    if (!used[k * 2 + 1] && expected[k].offMs != UINT32_MAX)
+      result.missed++;
+  }
+  return result;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: adc_replay <trace.bin> [--baseline N] [--offset N] [--sweep FROM:TO:STEP]\n"
+                  "                  [--expect ON_MS:OFF_MS ...] [--tolerance MS]\n");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    usage();
+    return 2;
+  }
+
+  const char *path = argv[1];
+  int baseline = -1;
+  int offset = CURRENT_THRESHOLD_OFFSET;
+  int sweepFrom = 0, sweepTo = -1, sweepStep = 1;
+  uint32_t toleranceMs = 2000;
+  std::vector<Interval> expected;
+
+  for (int i = 2; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+      baseline = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--offset") && i + 1 < argc)
+      offset = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+      toleranceMs = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--sweep") && i + 1 < argc)
+      sscanf(argv[++i], "%d:%d:%d", &sweepFrom, &sweepTo, &sweepStep);
+    else if (!strcmp(argv[i], "--expect") && i + 1 < argc)
+    {
+      Interval iv = {0, UINT32_MAX};
+      sscanf(argv[++i], "%u:%u", &iv.onMs, &iv.offMs);
+      expected.push_back(iv);
+    }
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  std::vector<uint16_t> samples;
+  std::vector<uint32_t> timesMs;
+  uint16_t rateHz = 0;
+  if (!loadTrace(path, samples, timesMs, rateHz))
+  {
+    fprintf(stderr, "no trace frames found in %s\n", path);
+    return 1;
+  }
+
+  if (baseline < 0)
+  {
+    // Median of the first second, whatever rate(s) it was sampled at
+    size_t n = std::max<size_t>(1, std::lower_bound(timesMs.begin(), timesMs.end(), 1000u) - timesMs.begin());
+    std::vector<uint16_t> head(samples.begin(), samples.begin() + n);
+    std::nth_element(head.begin(), head.begin() + n / 2, head.end());
+    baseline = head[n / 2];
+  }
+
+  printf("trace: %zu samples @ %u Hz, %.1f s\n", samples.size(), rateHz, timesMs.back() / 1000.0);
+  printf("baseline: %d, power off delay: %lu ms\n\n", baseline, (unsigned long)POWER_OFF_DELAY);
+
+  if (sweepTo < sweepFrom || sweepStep <= 0)
+  {
+    sweepFrom = sweepTo = offset;
+    sweepStep = 1;
+  }
+
+  printf("%8s %8s %8s %8s %8s %10s %10s\n", "offset", "edges", "matched", "false", "missed", "lat_avg", "lat_max");
+  for (int o = sweepFrom; o <= sweepTo; o += sweepStep)
+  {
+    ReplayResult r = replay(samples, timesMs, baseline, o, expected, toleranceMs);
+    printf("%8d %8zu %8u %8u %8u %10u %10u\n", o, r.edges.size(), r.matched, r.falseToggles, r.missed,
+           r.matched ? r.latencySum / r.matched : 0, r.latencyMax);
+
+    if (sweepFrom == sweepTo)
+    {
+      printf("\n");
+      for (const Edge &e : r.edges)
+        printf("%10.3f s  %s\n", e.ms / 1000.0, e.on ? "ON" : "OFF");
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,385 @@
+// Microbenchmarks of the firmware's hot paths, built for the host against the
+// native fakes.
+//
+//   bench [--json] [--filter TEXT] [--time MS] [--compare PREVIOUS.json]
+//
+// Each benchmark runs for about --time ms after a warm-up. It reports time
+// per op, heap bytes and allocations per op, and the peak heap in use above
+// where it started. The heap is counted by wrapping glibc's malloc family.
+// --json prints one object per line so runs can be saved and compared between
+// commits. --compare reads such a file and prints the change next to each
+// result. Payloads and state are fixed fixtures, so runs are repeatable.
+#include <chrono>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <ArduinoJson.h>
+
+#include <control.h>
+#include <commands.h>
+#include <effects.h>
+#include <framebuffer.h>
+#include <ha_discovery.h>
+#include <ha_topics.h>
+#include <input_events.h>
+#include <state_json.h>
+#include <state_publish.h>
+#include <task_queues.h>
+#include <state.h>
+#include <hal.h>
+#include <config.h>
+
+#include "../native/hal_fake.h"
+
+// Heap accounting
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static bool heapCounting = false;
+static uint64_t heapAllocs = 0;
+static uint64_t heapBytes = 0;
+static int64_t heapLive = 0;
+static int64_t heapPeak = 0;
+
+static void heapAdd(void *ptr)
+{
+  if (!heapCounting || !ptr)
+    return;
+  size_t size = malloc_usable_size(ptr);
+  heapAllocs++;
+  heapBytes += size;
+  heapLive += size;
+  if (heapLive > heapPeak)
+    heapPeak = heapLive;
+}
+
+static void heapRemove(void *ptr)
+{
+  if (heapCounting && ptr)
+    heapLive -= malloc_usable_size(ptr);
+}
+
+extern "C" void *malloc(size_t size)
+{
+  void *ptr = __libc_malloc(size);
+  heapAdd(ptr);
+  return ptr;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  void *ptr = __libc_calloc(count, size);
+  heapAdd(ptr);
+  return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  heapRemove(ptr);
+  void *moved = __libc_realloc(ptr, size);
+  heapAdd(moved);
+  return moved;
+}
+
+extern "C" void free(void *ptr)
+{
+  heapRemove(ptr);
+  __libc_free(ptr);
+}
+#else
+#warning "heap accounting needs glibc, bytes and peak heap will read 0"
+static bool heapCounting = false;
+static uint64_t heapAllocs = 0;
+static uint64_t heapBytes = 0;
+static int64_t heapLive = 0;
+static int64_t heapPeak = 0;
+#endif
+
+// Fixtures: payloads as the dashboard and Home Assistant send them
+struct CommandFixture
+{
+  const char *name;
+  const char *suffix; // After console/<node>/
+  const char *payload;
+};
+
+static const CommandFixture COMMANDS[] = {
+    {"set_color", "set", R"({"color":3})"},
+    {"set_msgpack", "set/msgpack", "\x81\xA5" "color" "\x03"}, // {"color":3}, no NUL bytes
+    {"set_custom", "set", R"({"color":-1,"customColor":"#1A2B3C"})"},
+    {"set_brightness", "set", R"({"brightness":128})"},
+    {"set_dashboard", "set", R"({"color":2,"brightness":200,"effect":"solid","thresholdOffset":150,"ui":{"tab":"colors","history":[1,2,3]}})"},
+    {"ha_set", "ha/set", R"({"state":"ON","brightness":180,"color":{"r":255,"g":128,"b":0},"effect":"solid"})"},
+    {"offset", "offset/set", "150"},
+    {"unknown_topic", "does/not/exist", R"({"color":1})"},
+};
+
+static void stateFixture(StateSnapshot &s)
+{
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+    s.channels[ch] = {ch == 0, ch == 0 ? ColorMode::Palette : ColorMode::Custom, 6, 0x1A2B3C, 1850 + ch, 150, 2210};
+  s.brightness = 200;
+  s.effect = Effect::Breathing;
+  snprintf(s.name, sizeof(s.name), "Console-A1B2C3");
+  s.autoCalibrate = true;
+  s.bootTime = 1767225600;
+  s.forced = 0;
+}
+
+struct BenchResult
+{
+  std::string name;
+  uint64_t ops;
+  double nsPerOp;
+  double bytesPerOp;
+  double allocsPerOp;
+  int64_t peakHeap;
+};
+
+static uint32_t benchTimeMs = 300;
+static const char *benchFilter = nullptr;
+static std::vector<BenchResult> results;
+
+static double nowNs()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Op>
+static void bench(const char *name, Op op)
+{
+  if (benchFilter && !strstr(name, benchFilter))
+    return;
+
+  // Warm up, then grow the batch until it fills the time budget
+  for (int i = 0; i < 100; ++i)
+    op();
+
+  uint64_t ops = 1;
+  double elapsed = 0;
+  for (;;)
+  {
+    heapAllocs = heapBytes = 0;
+    heapLive = heapPeak = 0;
+    heapCounting = true;
+    double start = nowNs();
+    for (uint64_t i = 0; i < ops; ++i)
+      op();
+    elapsed = nowNs() - start;
+    heapCounting = false;
+
+    if (elapsed >= benchTimeMs * 1e6 || ops >= (1ull << 32))
+      break;
+    ops = elapsed < 1e6 ? ops * 10 : (uint64_t)(ops * benchTimeMs * 1e6 / elapsed) + 1;
+  }
+
+  results.push_back({name, ops, elapsed / ops, (double)heapBytes / ops, (double)heapAllocs / ops, heapPeak});
+}
+
+// Benchmarks
+static char payloadBuffer[1024];
+static volatile uint16_t sink; // Keeps pure results from being optimised away
+
+static void benchTopics()
+{
+  bench("topics_build", []
+        { haTopicsBegin("A1B2C3"); });
+}
+
+static void benchStateJson()
+{
+  static StateSnapshot s;
+  stateFixture(s);
+
+  // publishState() and publishHALightState() without the socket, in both
+  // state encodings
+  bench("state_json", []
+        {
+    JsonDocument doc;
+    stateToJson(s, doc);
+    serializeJson(doc, payloadBuffer, sizeof(payloadBuffer)); });
+
+  bench("state_msgpack", []
+        {
+    JsonDocument doc;
+    stateToJson(s, doc);
+    serializeMsgPack(doc, payloadBuffer, sizeof(payloadBuffer)); });
+
+  bench("light_state_json", []
+        {
+    JsonDocument doc;
+    lightStateToJson(s, 0, doc);
+    serializeJson(doc, payloadBuffer, sizeof(payloadBuffer)); });
+}
+
+static void benchDiscovery()
+{
+  // Every message publishHADiscovery() builds
+  bench("discovery_build", []
+        {
+    char topic[96];
+    for (uint8_t i = 0; i < HA_DISCOVERY_COUNT; ++i)
+    {
+      const HaDiscoveryEntry &entry = haDiscoveryEntries[i];
+      uint8_t copies = entry.perChannel ? CONSOLE_CHANNELS : 1;
+      for (uint8_t ch = 0; ch < copies; ++ch)
+      {
+        haDiscoveryExpand(entry.payload, payloadBuffer, sizeof(payloadBuffer), ch);
+        haDiscoveryExpand(entry.topic, topic, sizeof(topic), ch);
+      }
+    } });
+}
+
+static void benchCommands()
+{
+  // What mqttCallback() hands the control task: queued, then parsed and
+  // applied by commandsPoll()
+  for (const CommandFixture &fixture : COMMANDS)
+  {
+    static char topic[CONTROL_COMMAND_TOPIC_MAX];
+    static const CommandFixture *current;
+    snprintf(topic, sizeof(topic), "%s%s", haCmdPrefix(), fixture.suffix);
+    current = &fixture;
+
+    std::string name = std::string("mqtt_command/") + fixture.name;
+    bench(name.c_str(), []
+          {
+      controlCommandPush(topic, (const uint8_t *)current->payload, strlen(current->payload));
+      commandsPoll(); });
+  }
+}
+
+static void benchFade()
+{
+  bench("rgb16_lerp", []
+        {
+    static uint16_t frac = 0;
+    sink = rgb16Lerp({1000, 20000, 65535}, {65535, 300, 0}, frac += 997).r; });
+
+  // One LED frame of a running fade: keyframe step, render and dithered show
+  bench("fade_frame", []
+        {
+    static bool toWhite = false;
+    if (!ledAnimating())
+    {
+      toWhite = !toWhite;
+      fadeToColor(0, toWhite ? 0xFFFFFF : 0x15B886);
+    }
+    fakeAdvanceMillis(LED_FRAME_INTERVAL);
+    ledTick(); });
+}
+
+// Previous --json output, name to ns/op
+static bool loadBaseline(const char *path, std::vector<std::pair<std::string, double>> &baseline)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  char line[512];
+  while (fgets(line, sizeof(line), f))
+  {
+    char name[128];
+    double ns;
+    const char *at = strstr(line, "\"ns_per_op\":");
+    if (sscanf(line, "{\"bench\":\"%127[^\"]\"", name) == 1 && at && sscanf(at, "\"ns_per_op\":%lf", &ns) == 1)
+      baseline.emplace_back(name, ns);
+  }
+  fclose(f);
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bench [--json] [--filter TEXT] [--time MS] [--compare PREVIOUS.json]\n");
+}
+
+int main(int argc, char **argv)
+{
+  bool json = false;
+  std::vector<std::pair<std::string, double>> baseline;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--json"))
+      json = true;
+    else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+      benchFilter = argv[++i];
+    else if (!strcmp(argv[i], "--time") && i + 1 < argc)
+      benchTimeMs = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--compare") && i + 1 < argc)
+    {
+      const char *path = argv[++i];
+      if (!loadBaseline(path, baseline))
+      {
+        fprintf(stderr, "can't read %s\n", path);
+        return 1;
+      }
+    }
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  // The firmware logs to stdout; keep it out of the results and the timing
+  FILE *out = fdopen(dup(fileno(stdout)), "w");
+  if (!out || !freopen("/dev/null", "w", stdout))
+    return 1;
+
+  halBegin();
+  inputBegin();
+  haTopicsBegin("A1B2C3");
+  controlSetup();
+  halAdcStreamPause(true); // Nothing is sensed, the clock only drives the LEDs
+  fakeRecordFrames(false);
+
+  benchTopics();
+  benchStateJson();
+  benchDiscovery();
+  benchCommands();
+  benchFade();
+
+  if (!json)
+    fprintf(out, "%-28s %12s %12s %10s %10s %10s\n", "bench", "ops", "ns/op", "B/op", "allocs/op", "peak_B");
+
+  for (const BenchResult &r : results)
+  {
+    const double *previous = nullptr;
+    for (const auto &prev : baseline)
+    {
+      if (prev.first == r.name && prev.second > 0)
+        previous = &prev.second;
+    }
+    double change = previous ? (r.nsPerOp - *previous) * 100.0 / *previous : 0;
+
+    if (json)
+    {
+      fprintf(out, "{\"bench\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.1f,\"bytes_per_op\":%.1f,\"allocs_per_op\":%.2f,\"peak_heap\":%lld",
+              r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp, r.bytesPerOp, r.allocsPerOp, (long long)r.peakHeap);
+      if (previous)
+        fprintf(out, ",\"ns_per_op_change_pct\":%.1f", change);
+      fprintf(out, "}\n");
+    }
+    else
+    {
+      fprintf(out, "%-28s %12llu %12.1f %10.1f %10.2f %10lld", r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp,
+              r.bytesPerOp, r.allocsPerOp, (long long)r.peakHeap);
+      if (previous)
+        fprintf(out, "  %+6.1f%%", change);
+      fprintf(out, "\n");
+    }
+  }
+
+  fclose(out);
+  return 0;
+}
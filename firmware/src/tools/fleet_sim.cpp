@@ -0,0 +1,1231 @@
+// Fleet simulator: N virtual boards on a real MQTT broker, for load testing
+// the broker and the dashboard without the hardware.
+//
+//   fleet_sim [--host H] [--port P] [--user U] [--pass P] [--boards N[,N...]]
+//             [--seconds S] [--cycle ON_MS:OFF_MS] [--script FILE]
+//             [--commands PER_S] [--encoding json|msgpack|both]
+//             [--no-discovery] [--seed N]
+//
+// Each board talks like the firmware's network task: it connects with its
+// node id and availability topic as last will, subscribes to the same command
+// topics, then publishes availability, discovery and the retained state. It
+// handles set, ha/set, offset/set, identify and calibrate and republishes what
+// they changed after STATE_PUBLISH_COALESCE. Topics, discovery payloads and
+// command parsing come from the firmware sources, and so do the state
+// payloads. --encoding starts every board on that state encoding; /set
+// probes then go to set/msgpack whenever it includes MessagePack.
+//
+// Console power is scripted. --cycle switches every board on and off with a
+// random phase. --script reads "<ms> <board|*> on|off [channel]" lines.
+// A monitor connection subscribed to console/# times every message from
+// publish to delivery. With --commands it also sends /set commands to random
+// boards and times the round trip to the resulting state. That round trip
+// includes the board's coalescing delay.
+// Each board count in --boards is run in turn and reported on one line.
+// Boards are dropped without DISCONNECT at the end of a run, so the broker
+// sends their last will.
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <ArduinoJson.h>
+
+#include <ha_topics.h>
+#include <ha_discovery.h>
+#include <commands.h>
+#include <mqtt_dispatch.h>
+#include <state_publish.h>
+#include <state_json.h>
+#include <power_detect.h>
+#include <effects.h>
+#include <serial_mux.h>
+#include <utils.h>
+#include <state.h>
+#include <config.h>
+#include <hal.h>
+
+// The shared modules only need a clock and a console; there is no strip here
+SerialMirror DebugSerial;
+
+static uint64_t nowUs()
+{
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint32_t nowMs() { return (uint32_t)(nowUs() / 1000); }
+
+uint32_t halCycles() { return (uint32_t)(nowUs() * 1000); }
+uint32_t halCyclesPerMicro() { return 1000; }
+void halPixelsSet(uint16_t, uint32_t) {}
+void halPixelsShow() {}
+
+static constexpr uint16_t KEEPALIVE_S = 15; // PubSubClient's default
+static constexpr size_t PAYLOAD_MAX = 1024; // MQTT_MAX_PACKET_SIZE on the board
+
+// MQTT 3.1.1, QoS 0 only, over non-blocking sockets
+enum MqttPacket : uint8_t
+{
+  PacketConnect = 1,
+  PacketConnack = 2,
+  PacketPublish = 3,
+  PacketSubscribe = 8,
+  PacketSuback = 9,
+  PacketPingreq = 12,
+  PacketPingresp = 13
+};
+
+struct MqttLink
+{
+  int fd = -1;
+  bool open = false;      // TCP is up
+  bool connected = false; // CONNACK accepted
+  bool failed = false;
+  std::string out;
+  std::vector<uint8_t> in;
+  uint64_t lastSendUs = 0;
+  uint16_t packetId = 0;
+  uint64_t bytesOut = 0;
+};
+
+static void putLength(std::string &out, size_t n)
+{
+  do
+  {
+    uint8_t b = n % 128;
+    n /= 128;
+    out += (char)(n ? b | 0x80 : b);
+  } while (n);
+}
+
+static void putString(std::string &out, const char *s, size_t length)
+{
+  out += (char)(length >> 8);
+  out += (char)(length & 0xFF);
+  out.append(s, length);
+}
+
+static void putString(std::string &out, const char *s) { putString(out, s, strlen(s)); }
+
+static void linkSend(MqttLink &link, uint8_t header, const std::string &body)
+{
+  link.out += (char)header;
+  putLength(link.out, body.size());
+  link.out += body;
+  link.lastSendUs = nowUs();
+}
+
+static bool linkOpen(MqttLink &link, const sockaddr_storage &addr, socklen_t addrLen)
+{
+  link.fd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (link.fd < 0)
+    return false;
+
+  int one = 1;
+  setsockopt(link.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(link.fd, F_SETFL, fcntl(link.fd, F_GETFL, 0) | O_NONBLOCK);
+  if (connect(link.fd, (const sockaddr *)&addr, addrLen) < 0 && errno != EINPROGRESS)
+  {
+    close(link.fd);
+    link.fd = -1;
+    return false;
+  }
+  return true;
+}
+
+static void linkClose(MqttLink &link)
+{
+  if (link.fd >= 0)
+    close(link.fd);
+  link.fd = -1;
+  link.open = false;
+  link.connected = false;
+}
+
+static void linkConnect(MqttLink &link, const char *clientId, const char *user, const char *pass,
+                        const char *willTopic, const char *willPayload)
+{
+  std::string body;
+  putString(body, "MQTT");
+  body += (char)4; // Protocol level 3.1.1
+
+  uint8_t flags = 0x02; // Clean session
+  if (willTopic)
+    flags |= 0x04 | 0x20; // Will, retained, QoS 0
+  if (user && *user)
+    flags |= 0x80;
+  if (pass && *pass)
+    flags |= 0x40;
+  body += (char)flags;
+  body += (char)(KEEPALIVE_S >> 8);
+  body += (char)(KEEPALIVE_S & 0xFF);
+
+  putString(body, clientId);
+  if (willTopic)
+  {
+    putString(body, willTopic);
+    putString(body, willPayload);
+  }
+  if (flags & 0x80)
+    putString(body, user);
+  if (flags & 0x40)
+    putString(body, pass);
+
+  linkSend(link, PacketConnect << 4, body);
+}
+
+static void linkPublish(MqttLink &link, const char *topic, const char *payload, size_t length, bool retain)
+{
+  std::string body;
+  putString(body, topic);
+  body.append(payload, length);
+  linkSend(link, (PacketPublish << 4) | (retain ? 1 : 0), body);
+}
+
+static void linkSubscribe(MqttLink &link, const char *topic)
+{
+  std::string body;
+  link.packetId = link.packetId == 0xFFFF ? 1 : link.packetId + 1;
+  body += (char)(link.packetId >> 8);
+  body += (char)(link.packetId & 0xFF);
+  putString(body, topic);
+  body += (char)0; // QoS 0
+  linkSend(link, (PacketSubscribe << 4) | 0x02, body);
+}
+
+static void linkKeepAlive(MqttLink &link)
+{
+  if (link.connected && nowUs() - link.lastSendUs >= KEEPALIVE_S * 1000000ull)
+    linkSend(link, PacketPingreq << 4, std::string());
+}
+
+// Writes what the socket takes, false once the link is gone
+static bool linkFlush(MqttLink &link)
+{
+  while (!link.out.empty())
+  {
+    ssize_t n = send(link.fd, link.out.data(), link.out.size(), MSG_NOSIGNAL);
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    link.out.erase(0, n);
+    link.bytesOut += n;
+  }
+  return true;
+}
+
+struct MqttIncoming
+{
+  uint8_t type;
+  uint8_t flags;
+  const uint8_t *body;
+  size_t length;
+};
+
+// Reads what arrived and hands over every complete packet, false once the
+// link is gone
+template <typename Handler>
+static bool linkRead(MqttLink &link, Handler handler)
+{
+  uint8_t chunk[4096];
+  for (;;)
+  {
+    ssize_t n = recv(link.fd, chunk, sizeof(chunk), 0);
+    if (n == 0)
+      return false;
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return false;
+    }
+    link.in.insert(link.in.end(), chunk, chunk + n);
+  }
+
+  size_t pos = 0;
+  while (link.in.size() - pos >= 2)
+  {
+    size_t length = 0;
+    size_t header = 1;
+    uint32_t scale = 1;
+    bool complete = false;
+    while (pos + header < link.in.size() && header <= 4)
+    {
+      uint8_t b = link.in[pos + header++];
+      length += (b & 0x7F) * scale;
+      scale *= 128;
+      if (!(b & 0x80))
+      {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete)
+    {
+      if (header > 4)
+        return false;
+      break;
+    }
+    if (link.in.size() - pos - header < length)
+      break;
+
+    const uint8_t first = link.in[pos];
+    handler(MqttIncoming{(uint8_t)(first >> 4), (uint8_t)(first & 0x0F), link.in.data() + pos + header, length});
+    pos += header + length;
+  }
+  link.in.erase(link.in.begin(), link.in.begin() + pos);
+  return true;
+}
+
+// Topic and payload of a QoS 0 PUBLISH
+static bool parsePublish(const MqttIncoming &p, std::string &topic, const uint8_t *&payload, size_t &length)
+{
+  if (p.length < 2)
+    return false;
+  size_t topicLen = (p.body[0] << 8) | p.body[1];
+  size_t skip = 2 + topicLen + ((p.flags & 0x06) ? 2 : 0);
+  if (skip > p.length)
+    return false;
+  topic.assign((const char *)p.body + 2, topicLen);
+  payload = p.body + skip;
+  length = p.length - skip;
+  return true;
+}
+
+// Monitor: times every message it sees against the moment it was published
+struct Monitor
+{
+  MqttLink link;
+  std::unordered_map<std::string, std::deque<uint64_t>> inFlight;
+  std::unordered_map<std::string, size_t> stateTopics; // Device state topics, both encodings, to board
+  std::vector<uint32_t> latencyUs;
+  std::vector<uint32_t> commandUs;
+  uint64_t received = 0;
+  bool subscribed = false;
+};
+
+static Monitor monitor;
+
+struct CommandProbe
+{
+  bool pending = false;
+  int brightness = 0;
+  uint64_t sentUs = 0;
+};
+
+// What the board's sensing would see, its reported state is in SimBoard::state
+struct SimChannel
+{
+  int idleLevel;
+  bool powered = false;       // Console drawing current
+  uint32_t powerOffDueMs = 0; // Reported off POWER_OFF_DELAY after the drop
+  bool calibrating = false;
+  uint32_t calibrationDoneMs = 0;
+  uint32_t nextToggleMs = 0; // --cycle
+};
+
+struct SimBoard
+{
+  char suffix[7];
+  std::string prefix;
+  std::string clientId;
+  std::string availTopic;
+  std::string stateTopic;
+  std::string stateMsgPackTopic;
+  std::string lightTopics[CONSOLE_CHANNELS];
+  std::string offsetTopics[CONSOLE_CHANNELS];
+  std::string baseTopics[CONSOLE_CHANNELS];
+  std::string thOnTopics[CONSOLE_CHANNELS];
+  std::string thOffTopics[CONSOLE_CHANNELS];
+  std::vector<std::string> subscriptions;
+  std::vector<std::pair<std::string, std::string>> discovery;
+
+  MqttDispatcher dispatcher;
+  MqttLink link;
+  uint64_t connectStartUs = 0;
+  uint64_t connectedUs = 0;
+
+  StateSnapshot state;
+  SimChannel channels[CONSOLE_CHANNELS];
+
+  // Coalesced like statePublishMark() and diffed like statePublishDrain()
+  StateSnapshot sent = {};
+  uint16_t forced = 0;
+  bool marked = false;
+  uint32_t markedSinceMs = 0;
+
+  CommandProbe probe;
+  uint32_t published = 0;
+  uint32_t identifies = 0;
+};
+
+// Set while one board's command is dispatched
+static SimBoard *current = nullptr;
+
+static void mark(SimBoard &b, uint16_t forceFields = 0)
+{
+  b.forced |= forceFields;
+  if (b.marked)
+    return;
+  b.marked = true;
+  b.markedSinceMs = nowMs();
+}
+
+static void boardPublish(SimBoard &b, const std::string &topic, const char *payload, size_t length, bool retain = true)
+{
+  linkPublish(b.link, topic.c_str(), payload, length, retain);
+  b.published++;
+  if (topic.compare(0, 8, "console/") == 0 && monitor.subscribed)
+    monitor.inFlight[topic].push_back(nowUs());
+}
+
+static void boardPublishJson(SimBoard &b, const std::string &topic, const JsonDocument &doc)
+{
+  char payload[PAYLOAD_MAX];
+  size_t length = serializeJson(doc, payload, sizeof(payload));
+  boardPublish(b, topic, payload, length);
+}
+
+static void boardPublishMsgPack(SimBoard &b, const std::string &topic, const JsonDocument &doc)
+{
+  char payload[PAYLOAD_MAX];
+  size_t length = serializeMsgPack(doc, payload, sizeof(payload));
+  boardPublish(b, topic, payload, length);
+}
+
+static void boardPublishInt(SimBoard &b, const std::string &topic, int value)
+{
+  char text[12];
+  int length = snprintf(text, sizeof(text), "%d", value);
+  boardPublish(b, topic, text, length);
+}
+
+// publishState(), clearing the retained topic of an encoding no longer used
+static void publishDeviceState(SimBoard &b, bool clearUnused)
+{
+  JsonDocument doc;
+  stateToJson(b.state, doc);
+  if (stateEncodingHas(b.state.encoding, StateEncoding::Json))
+    boardPublishJson(b, b.stateTopic, doc);
+  else if (clearUnused)
+    boardPublish(b, b.stateTopic, "", 0);
+  if (stateEncodingHas(b.state.encoding, StateEncoding::MsgPack))
+    boardPublishMsgPack(b, b.stateMsgPackTopic, doc);
+  else if (clearUnused)
+    boardPublish(b, b.stateMsgPackTopic, "", 0);
+}
+
+static void publishLightState(SimBoard &b, uint8_t channel)
+{
+  JsonDocument doc;
+  lightStateToJson(b.state, channel, doc);
+  boardPublishJson(b, b.lightTopics[channel], doc);
+}
+
+// statePublishDrain() for what changed since the last flush
+static void flushState(SimBoard &b)
+{
+  StateDelta delta = stateDelta(b.state, b.sent, b.forced);
+  b.sent = b.state;
+  b.forced = 0;
+  b.marked = false;
+
+  if (delta.anyChannelFields & DEVICE_STATE_FIELDS)
+    publishDeviceState(b, delta.boardFields & FieldEncoding);
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    const ChannelSnapshot &c = b.state.channels[ch];
+    uint16_t fields = delta.channelFields[ch];
+    if (fields & LIGHT_STATE_FIELDS)
+      publishLightState(b, ch);
+    if (fields & FieldOffset)
+      boardPublishInt(b, b.offsetTopics[ch], c.offset);
+    if (fields & FieldBaseline)
+      boardPublishInt(b, b.baseTopics[ch], c.baseline);
+    if (fields & THRESHOLD_FIELDS)
+    {
+      boardPublishInt(b, b.thOnTopics[ch], c.baseline + c.offset);
+      boardPublishInt(b, b.thOffTopics[ch], powerOffThreshold(c.baseline, c.offset));
+    }
+  }
+}
+
+static void publishDiscovery(SimBoard &b)
+{
+  for (const auto &entry : b.discovery)
+    boardPublish(b, entry.first, entry.second.data(), entry.second.size());
+}
+
+// Command handlers, applying what commands.cpp applies
+static void applyBrightness(int value)
+{
+  int brightness = clampInt(value, 0, 255);
+  if (brightness == current->state.brightness)
+    return;
+  current->state.brightness = brightness;
+  mark(*current);
+}
+
+static void applyEffectName(const char *name)
+{
+  Effect effect;
+  if (!effectFromName(name, effect) || effect == current->state.effect)
+    return;
+  current->state.effect = effect;
+  mark(*current);
+}
+
+static void applyOffset(int offset, uint8_t channel)
+{
+  ChannelSnapshot &c = current->state.channels[channel];
+  if (offset == c.offset)
+    return;
+  c.offset = offset;
+  mark(*current);
+}
+
+static void applyCustom(const char *hex, uint8_t channel)
+{
+  ChannelSnapshot &c = current->state.channels[channel];
+  if (hex[0] == '#')
+    hex++;
+  c.colorMode = ColorMode::Custom;
+  c.customColor = (uint32_t)strtoul(hex, nullptr, 16) & 0xFFFFFF;
+  mark(*current);
+}
+
+static void onSet(const MqttMessage &msg)
+{
+  JsonVariantConst doc = msg.json;
+  ChannelSnapshot &c = current->state.channels[msg.channel];
+
+  if (doc["color"].is<int>())
+  {
+    int index = doc["color"];
+    if (index >= 0 && index < NUM_COLORS)
+    {
+      c.colorMode = ColorMode::Palette;
+      c.colorIndex = index;
+      mark(*current);
+    }
+    else if (index == -1 && doc["customColor"].is<const char *>())
+    {
+      applyCustom(doc["customColor"].as<const char *>(), msg.channel);
+    }
+  }
+  if (doc["brightness"].is<int>())
+    applyBrightness(doc["brightness"].as<int>());
+  if (doc["effect"].is<const char *>())
+    applyEffectName(doc["effect"].as<const char *>());
+  if (doc["name"].is<const char *>())
+  {
+    snprintf(current->state.name, sizeof(current->state.name), "%s", doc["name"].as<const char *>());
+    mark(*current);
+  }
+  if (doc["autoCalibrate"].is<bool>())
+  {
+    current->state.autoCalibrate = doc["autoCalibrate"].as<bool>();
+    mark(*current);
+  }
+  if (doc["thresholdOffset"].is<int>())
+    applyOffset(doc["thresholdOffset"].as<int>(), msg.channel);
+  if (doc["encoding"].is<const char *>() && stateEncodingFromName(doc["encoding"].as<const char *>(), current->state.encoding))
+    mark(*current);
+}
+
+static void onLight(const MqttMessage &msg)
+{
+  JsonVariantConst doc = msg.json;
+
+  // Power is console driven, the board only snaps HA back
+  if (doc["state"].is<const char *>())
+    mark(*current, FieldEnabled);
+  if (doc["brightness"].is<int>())
+    applyBrightness(doc["brightness"].as<int>());
+  if (doc["color"].is<JsonObjectConst>())
+  {
+    auto rgb = doc["color"].as<JsonObjectConst>();
+    if (rgb["r"].is<int>() && rgb["g"].is<int>() && rgb["b"].is<int>())
+    {
+      char hex[7];
+      snprintf(hex, sizeof(hex), "%02X%02X%02X", clampInt(rgb["r"], 0, 255), clampInt(rgb["g"], 0, 255),
+               clampInt(rgb["b"], 0, 255));
+      applyCustom(hex, msg.channel);
+    }
+  }
+  if (doc["effect"].is<const char *>())
+    applyEffectName(doc["effect"].as<const char *>());
+}
+
+static void onOffset(const MqttMessage &msg)
+{
+  applyOffset(msg.value, msg.channel);
+}
+
+static void onIdentify(const MqttMessage &)
+{
+  current->identifies++;
+}
+
+static void onCalibrate(const MqttMessage &msg)
+{
+  SimChannel &ch = current->channels[msg.channel];
+  ch.calibrating = true;
+  ch.calibrationDoneMs = nowMs() + CALIBRATION_SAMPLES * 1000 / ADC_SAMPLE_RATE_HZ;
+}
+
+static const MqttCommand SIM_COMMANDS[] = {
+    {"ha/set", MqttPayload::Json, R"({"state":true,"brightness":true,"color":true,"effect":true})", onLight, true},
+    {"offset/set", MqttPayload::Int, nullptr, onOffset, true},
+    {"set", MqttPayload::Json, SET_COMMAND_FILTER, onSet, true},
+    {"set/msgpack", MqttPayload::MsgPack, SET_COMMAND_FILTER, onSet, true},
+    {"identify", MqttPayload::None, nullptr, onIdentify, true},
+    {"calibrate", MqttPayload::None, nullptr, onCalibrate, true},
+};
+
+static std::unique_ptr<SimBoard> makeBoard(uint32_t id, StateEncoding encoding, std::mt19937 &rng)
+{
+  std::unique_ptr<SimBoard> b(new SimBoard());
+  snprintf(b->suffix, sizeof(b->suffix), "%06X", (unsigned)(0xF00000 + id));
+
+  // Topics are interned per device, so build this board's and copy them out
+  haTopicsBegin(b->suffix);
+  b->prefix = haCmdPrefix();
+  b->clientId = haNodeId();
+  b->availTopic = haAvailTopic();
+  b->stateTopic = haDeviceStateTopic();
+  b->stateMsgPackTopic = haDeviceStateMsgPackTopic();
+  snprintf(b->state.name, sizeof(b->state.name), "Console-%s", b->suffix);
+  b->state.brightness = 255;
+  b->state.effect = Effect::Solid;
+  b->state.autoCalibrate = AUTO_CALIBRATE_DEFAULT;
+  b->state.encoding = encoding;
+  b->state.bootTime = 0;
+
+  std::uniform_int_distribution<int> jitter(-20, 20);
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    b->lightTopics[ch] = haStateTopic(ch);
+    b->offsetTopics[ch] = haOffsetStateTopic(ch);
+    b->baseTopics[ch] = haBaseStateTopic(ch);
+    b->thOnTopics[ch] = haThOnStateTopic(ch);
+    b->thOffTopics[ch] = haThOffStateTopic(ch);
+
+    SimChannel &c = b->channels[ch];
+    c.idleLevel = CURRENT_THRESHOLD + jitter(rng);
+    b->state.channels[ch] = {false, ColorMode::Palette, (uint8_t)(id % NUM_COLORS), 0xFFFFFF, CURRENT_THRESHOLD,
+                             CURRENT_THRESHOLD_OFFSET, c.idleLevel};
+  }
+
+  // Same subscriptions as the board, see mqttSubscriptions()
+  const char *boardTopics[] = {haSetCmdTopic(), haSetMsgPackCmdTopic(), haIdentifyCmdTopic(), haRebootCmdTopic(), haFwUpdateCmdTopic(),
+                               haCalibrateCmdTopic(), haCaptureCmdTopic(), haCmdTopic(), haOffsetCmdTopic(),
+                               HA_STATUS_TOPIC};
+  for (const char *topic : boardTopics)
+    b->subscriptions.push_back(topic);
+  for (uint8_t ch = 1; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    for (const char *topic : {haSetCmdTopic(ch), haSetMsgPackCmdTopic(ch), haIdentifyCmdTopic(ch), haCalibrateCmdTopic(ch), haCmdTopic(ch),
+                              haOffsetCmdTopic(ch)})
+      b->subscriptions.push_back(topic);
+  }
+
+  char topic[96];
+  static char payload[PAYLOAD_MAX];
+  for (uint8_t i = 0; i < HA_DISCOVERY_COUNT; ++i)
+  {
+    const HaDiscoveryEntry &entry = haDiscoveryEntries[i];
+    uint8_t copies = entry.perChannel ? CONSOLE_CHANNELS : 1;
+    for (uint8_t ch = 0; ch < copies; ++ch)
+    {
+      size_t length = haDiscoveryExpand(entry.payload, payload, sizeof(payload), ch);
+      if (haDiscoveryExpand(entry.topic, topic, sizeof(topic), ch) && length)
+        b->discovery.emplace_back(topic, std::string(payload, length));
+    }
+  }
+
+  mqttDispatchBegin(b->dispatcher, b->prefix.c_str(), SIM_COMMANDS, sizeof(SIM_COMMANDS) / sizeof(SIM_COMMANDS[0]));
+  return b;
+}
+
+static void onBoardConnected(SimBoard &b, bool discovery)
+{
+  b.connectedUs = nowUs();
+  for (const std::string &topic : b.subscriptions)
+    linkSubscribe(b.link, topic.c_str());
+
+  boardPublish(b, b.availTopic, "1", 1);
+  if (discovery)
+    publishDiscovery(b);
+
+  // statePublishAll(): everything, without waiting for the coalesce window
+  b.forced = FieldAll;
+  flushState(b);
+}
+
+static void onBoardPacket(SimBoard &b, const MqttIncoming &p, bool discovery)
+{
+  if (p.type == PacketConnack)
+  {
+    if (p.length < 2 || p.body[1] != 0)
+    {
+      fprintf(stderr, "%s: connection refused (rc=%d)\n", b.clientId.c_str(), p.length < 2 ? -1 : p.body[1]);
+      b.link.failed = true;
+      return;
+    }
+    b.link.connected = true;
+    onBoardConnected(b, discovery);
+    return;
+  }
+
+  if (p.type != PacketPublish)
+    return;
+
+  std::string topic;
+  const uint8_t *payload;
+  size_t length;
+  if (!parsePublish(p, topic, payload, length))
+    return;
+
+  // Home Assistant restarted and may have lost its retained discovery
+  if (topic == HA_STATUS_TOPIC)
+  {
+    if (length == 6 && memcmp(payload, "online", 6) == 0)
+      publishDiscovery(b);
+    return;
+  }
+
+  current = &b;
+  mqttDispatch(b.dispatcher, topic.c_str(), payload, length);
+  current = nullptr;
+}
+
+// Console current rises or drops; the board reports on at once and off
+// POWER_OFF_DELAY later, as the detector does
+static void setPower(SimBoard &b, uint8_t channel, bool on, uint32_t now)
+{
+  SimChannel &c = b.channels[channel];
+  ChannelSnapshot &state = b.state.channels[channel];
+  if (c.powered == on)
+    return;
+  c.powered = on;
+  state.level = c.idleLevel + (on ? 2 * state.offset : 0);
+
+  if (on && !state.enabled)
+  {
+    state.enabled = true;
+    mark(b);
+  }
+  c.powerOffDueMs = now + POWER_OFF_DELAY;
+}
+
+static void tickBoard(SimBoard &b, uint32_t now)
+{
+  for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+  {
+    SimChannel &c = b.channels[ch];
+    ChannelSnapshot &state = b.state.channels[ch];
+    if (!c.powered && state.enabled && (int32_t)(now - c.powerOffDueMs) >= 0)
+    {
+      state.enabled = false;
+      mark(b);
+    }
+    if (c.calibrating && (int32_t)(now - c.calibrationDoneMs) >= 0)
+    {
+      c.calibrating = false;
+      if (state.baseline != state.level)
+      {
+        state.baseline = state.level;
+        mark(b);
+      }
+    }
+  }
+
+  if (b.marked && now - b.markedSinceMs >= STATE_PUBLISH_COALESCE && b.link.connected)
+    flushState(b);
+
+  linkKeepAlive(b.link);
+}
+
+struct ScriptEvent
+{
+  uint32_t ms;
+  int board; // -1 for every board
+  uint8_t channel;
+  bool on;
+};
+
+static bool loadScript(const char *path, std::vector<ScriptEvent> &events)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  char line[128];
+  while (fgets(line, sizeof(line), f))
+  {
+    char who[16], what[8];
+    unsigned ms, channel = 0;
+    int fields = sscanf(line, "%u %15s %7s %u", &ms, who, what, &channel);
+    if (fields < 3 || line[0] == '#' || channel >= CONSOLE_CHANNELS)
+      continue;
+    events.push_back({ms, strcmp(who, "*") == 0 ? -1 : atoi(who), (uint8_t)channel, strcmp(what, "on") == 0});
+  }
+  fclose(f);
+
+  std::stable_sort(events.begin(), events.end(), [](const ScriptEvent &a, const ScriptEvent &b)
+                   { return a.ms < b.ms; });
+  return true;
+}
+
+static void onMonitorPacket(const MqttIncoming &p, const std::vector<std::unique_ptr<SimBoard>> &boards)
+{
+  if (p.type == PacketConnack)
+  {
+    monitor.link.connected = p.length >= 2 && p.body[1] == 0;
+    monitor.link.failed = !monitor.link.connected;
+    if (monitor.link.connected)
+      linkSubscribe(monitor.link, "console/#");
+    return;
+  }
+  if (p.type == PacketSuback)
+  {
+    monitor.subscribed = true;
+    return;
+  }
+  if (p.type != PacketPublish)
+    return;
+
+  std::string topic;
+  const uint8_t *payload;
+  size_t length;
+  if (!parsePublish(p, topic, payload, length))
+    return;
+
+  uint64_t now = nowUs();
+  monitor.received++;
+
+  // Retained leftovers and last wills were never timed
+  auto flight = monitor.inFlight.find(topic);
+  if (flight == monitor.inFlight.end() || flight->second.empty())
+    return;
+  monitor.latencyUs.push_back((uint32_t)(now - flight->second.front()));
+  flight->second.pop_front();
+
+  auto board = monitor.stateTopics.find(topic);
+  if (board == monitor.stateTopics.end())
+    return;
+  CommandProbe &probe = boards[board->second]->probe;
+  if (!probe.pending)
+    return;
+
+  JsonDocument filter;
+  filter["brightness"] = true;
+  JsonDocument doc;
+  DeserializationError err = topic == boards[board->second]->stateMsgPackTopic
+                                 ? deserializeMsgPack(doc, payload, length, DeserializationOption::Filter(filter))
+                                 : deserializeJson(doc, payload, length, DeserializationOption::Filter(filter));
+  if (err || doc["brightness"].as<int>() != probe.brightness)
+    return;
+  monitor.commandUs.push_back((uint32_t)(now - probe.sentUs));
+  probe.pending = false;
+}
+
+static void sendCommand(SimBoard &b)
+{
+  if (!b.link.connected || b.probe.pending)
+    return;
+
+  // Always a change, so the board has something to republish
+  b.probe.brightness = b.state.brightness == 128 ? 129 : 128;
+  b.probe.sentUs = nowUs();
+  b.probe.pending = true;
+
+  JsonDocument doc;
+  doc["brightness"] = b.probe.brightness;
+  char payload[32];
+  if (stateEncodingHas(b.state.encoding, StateEncoding::MsgPack))
+  {
+    size_t length = serializeMsgPack(doc, payload, sizeof(payload));
+    linkPublish(monitor.link, (b.prefix + "set/msgpack").c_str(), payload, length, false);
+  }
+  else
+  {
+    size_t length = serializeJson(doc, payload, sizeof(payload));
+    linkPublish(monitor.link, (b.prefix + "set").c_str(), payload, length, false);
+  }
+}
+
+struct Options
+{
+  const char *host = "127.0.0.1";
+  const char *port = "1883";
+  const char *user = getenv("MQTT_USERNAME");
+  const char *pass = getenv("MQTT_PASSWORD");
+  std::vector<uint32_t> boardCounts = {10};
+  uint32_t seconds = 30;
+  uint32_t cycleOnMs = 5000;
+  uint32_t cycleOffMs = 5000;
+  bool cycle = true;
+  std::vector<ScriptEvent> script;
+  double commandsPerS = 0;
+  bool discovery = true;
+  StateEncoding encoding = StateEncoding::Json;
+  uint32_t seed = 1;
+};
+
+struct RoundResult
+{
+  uint32_t boards = 0;
+  uint32_t connected = 0;
+  uint32_t connectMaxMs = 0;
+  uint64_t published = 0;
+  uint64_t received = 0;
+  uint64_t bytes = 0;
+  std::vector<uint32_t> latencyUs;
+  std::vector<uint32_t> commandUs;
+  uint64_t lost = 0;
+  uint32_t identifies = 0;
+  double seconds = 0;
+};
+
+static uint32_t percentile(std::vector<uint32_t> &v, double p)
+{
+  if (v.empty())
+    return 0;
+  size_t k = std::min(v.size() - 1, (size_t)(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+// After a run the boards go quiet for this long before they are dropped, so
+// what is still on its way isn't counted as lost
+static constexpr uint64_t DRAIN_US = 1000000;
+
+static bool runRound(const Options &opt, uint32_t count, const sockaddr_storage &addr, socklen_t addrLen,
+                     RoundResult &result)
+{
+  std::mt19937 rng(opt.seed);
+  std::vector<std::unique_ptr<SimBoard>> boards;
+  monitor = Monitor();
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    boards.push_back(makeBoard(i, opt.encoding, rng));
+    monitor.stateTopics[boards.back()->stateTopic] = i;
+    monitor.stateTopics[boards.back()->stateMsgPackTopic] = i;
+  }
+
+  // The monitor subscribes first and lets retained messages drain, so every
+  // timed message is a fresh one
+  char monitorId[32];
+  snprintf(monitorId, sizeof(monitorId), "fleet-sim-%u", (unsigned)getpid());
+  if (!linkOpen(monitor.link, addr, addrLen))
+    return false;
+
+  uint64_t settleUs = 0;
+  uint64_t roundStartUs = 0;
+  uint64_t roundEndUs = UINT64_MAX - DRAIN_US;
+  uint64_t nextCommandUs = 0;
+  size_t scriptPos = 0;
+  std::vector<pollfd> fds;
+  std::vector<int> owner; // Board per poll slot, -1 for the monitor
+
+  for (;;)
+  {
+    uint64_t now = nowUs();
+    if (now >= roundEndUs + DRAIN_US)
+      break;
+    bool running = roundStartUs && now < roundEndUs;
+
+    // Boards start half a second after the monitor is subscribed
+    if (monitor.subscribed && settleUs == 0)
+      settleUs = now + 500000;
+    if (settleUs && !roundStartUs && now >= settleUs)
+    {
+      roundStartUs = now;
+      roundEndUs = now + opt.seconds * 1000000ull;
+      monitor.received = 0; // Retained leftovers from earlier runs
+      uint32_t startMs = (uint32_t)(now / 1000);
+      std::uniform_int_distribution<uint32_t> phase(0, opt.cycleOnMs + opt.cycleOffMs);
+      for (auto &b : boards)
+      {
+        for (SimChannel &c : b->channels)
+          c.nextToggleMs = startMs + phase(rng);
+        b->connectStartUs = now;
+        if (!linkOpen(b->link, addr, addrLen))
+          b->link.failed = true;
+      }
+    }
+
+    fds.clear();
+    owner.clear();
+    if (monitor.link.fd >= 0)
+    {
+      fds.push_back({monitor.link.fd, (short)(POLLIN | (!monitor.link.open || !monitor.link.out.empty() ? POLLOUT : 0)), 0});
+      owner.push_back(-1);
+    }
+    for (size_t i = 0; i < boards.size(); ++i)
+    {
+      MqttLink &link = boards[i]->link;
+      if (link.fd < 0 || link.failed)
+        continue;
+      fds.push_back({link.fd, (short)(POLLIN | (!link.open || !link.out.empty() ? POLLOUT : 0)), 0});
+      owner.push_back((int)i);
+    }
+
+    poll(fds.data(), fds.size(), 2);
+
+    for (size_t k = 0; k < fds.size(); ++k)
+    {
+      if (!fds[k].revents)
+        continue;
+
+      bool isMonitor = owner[k] < 0;
+      SimBoard *b = isMonitor ? nullptr : boards[owner[k]].get();
+      MqttLink &link = isMonitor ? monitor.link : b->link;
+
+      if (!link.open && (fds[k].revents & (POLLOUT | POLLERR | POLLHUP)))
+      {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(link.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err)
+        {
+          link.failed = true;
+          continue;
+        }
+        link.open = true;
+        if (isMonitor)
+          linkConnect(link, monitorId, opt.user, opt.pass, nullptr, nullptr);
+        else
+          linkConnect(link, b->clientId.c_str(), opt.user, opt.pass, b->availTopic.c_str(), "0");
+      }
+
+      if (fds[k].revents & POLLIN)
+      {
+        bool alive = isMonitor ? linkRead(link, [&](const MqttIncoming &p)
+                                          { onMonitorPacket(p, boards); })
+                               : linkRead(link, [&](const MqttIncoming &p)
+                                          { onBoardPacket(*b, p, opt.discovery); });
+        if (!alive)
+          link.failed = true;
+      }
+    }
+
+    if (monitor.link.failed)
+    {
+      fprintf(stderr, "monitor connection to the broker failed\n");
+      return false;
+    }
+
+    if (running)
+    {
+      uint32_t nowMsValue = nowMs();
+      uint32_t elapsedMs = (uint32_t)((now - roundStartUs) / 1000);
+
+      for (; scriptPos < opt.script.size() && opt.script[scriptPos].ms <= elapsedMs; ++scriptPos)
+      {
+        const ScriptEvent &e = opt.script[scriptPos];
+        for (uint32_t i = 0; i < count; ++i)
+        {
+          if (e.board < 0 || (uint32_t)e.board == i)
+            setPower(*boards[i], e.channel, e.on, nowMsValue);
+        }
+      }
+
+      for (auto &b : boards)
+      {
+        if (!b->link.connected)
+          continue;
+        if (opt.cycle)
+        {
+          for (uint8_t ch = 0; ch < CONSOLE_CHANNELS; ++ch)
+          {
+            SimChannel &c = b->channels[ch];
+            if ((int32_t)(nowMsValue - c.nextToggleMs) < 0)
+              continue;
+            setPower(*b, ch, !c.powered, nowMsValue);
+            c.nextToggleMs += c.powered ? opt.cycleOnMs : opt.cycleOffMs;
+          }
+        }
+        tickBoard(*b, nowMsValue);
+      }
+
+      if (opt.commandsPerS > 0 && now >= nextCommandUs)
+      {
+        std::uniform_int_distribution<size_t> pick(0, boards.size() - 1);
+        sendCommand(*boards[pick(rng)]);
+        nextCommandUs = now + (uint64_t)(1000000.0 / opt.commandsPerS);
+      }
+    }
+    linkKeepAlive(monitor.link);
+
+    if (monitor.link.open && !linkFlush(monitor.link))
+      monitor.link.failed = true;
+    for (auto &b : boards)
+    {
+      if (b->link.open && !b->link.failed && !linkFlush(b->link))
+        b->link.failed = true;
+    }
+  }
+
+  result.boards = count;
+  result.seconds = opt.seconds;
+  for (auto &b : boards)
+  {
+    if (b->connectedUs)
+    {
+      result.connected++;
+      result.connectMaxMs = std::max(result.connectMaxMs, (uint32_t)((b->connectedUs - b->connectStartUs) / 1000));
+    }
+    result.published += b->published;
+    result.bytes += b->link.bytesOut;
+    result.identifies += b->identifies;
+    linkClose(b->link);
+  }
+  for (const auto &flight : monitor.inFlight)
+    result.lost += flight.second.size();
+  result.received = monitor.received;
+  result.latencyUs = std::move(monitor.latencyUs);
+  result.commandUs = std::move(monitor.commandUs);
+  linkClose(monitor.link);
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: fleet_sim [--host H] [--port P] [--user U] [--pass P] [--boards N[,N...]]\n"
+                  "                 [--seconds S] [--cycle ON_MS:OFF_MS] [--script FILE]\n"
+                  "                 [--commands PER_S] [--encoding json|msgpack|both]\n"
+                  "                 [--no-discovery] [--seed N]\n");
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  bool cycleGiven = false;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--host") && i + 1 < argc)
+      opt.host = argv[++i];
+    else if (!strcmp(argv[i], "--port") && i + 1 < argc)
+      opt.port = argv[++i];
+    else if (!strcmp(argv[i], "--user") && i + 1 < argc)
+      opt.user = argv[++i];
+    else if (!strcmp(argv[i], "--pass") && i + 1 < argc)
+      opt.pass = argv[++i];
+    else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+      opt.seconds = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--commands") && i + 1 < argc)
+      opt.commandsPerS = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      opt.seed = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--encoding") && i + 1 < argc)
+    {
+      if (!stateEncodingFromName(argv[++i], opt.encoding))
+      {
+        usage();
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--no-discovery"))
+      opt.discovery = false;
+    else if (!strcmp(argv[i], "--cycle") && i + 1 < argc)
+    {
+      cycleGiven = sscanf(argv[++i], "%u:%u", &opt.cycleOnMs, &opt.cycleOffMs) == 2;
+      if (!cycleGiven)
+      {
+        usage();
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+    {
+      const char *path = argv[++i];
+      if (!loadScript(path, opt.script))
+      {
+        fprintf(stderr, "can't read %s\n", path);
+        return 1;
+      }
+    }
+    else if (!strcmp(argv[i], "--boards") && i + 1 < argc)
+    {
+      opt.boardCounts.clear();
+      for (char *s = strtok(argv[++i], ","); s; s = strtok(nullptr, ","))
+      {
+        if (atoi(s) > 0)
+          opt.boardCounts.push_back((uint32_t)atoi(s));
+      }
+    }
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  // A script replaces the default power cycle unless both are asked for
+  opt.cycle = cycleGiven || opt.script.empty();
+  if (opt.boardCounts.empty() || opt.seconds == 0 || (opt.cycle && opt.cycleOnMs + opt.cycleOffMs == 0))
+  {
+    usage();
+    return 2;
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *info = nullptr;
+  if (getaddrinfo(opt.host, opt.port, &hints, &info) != 0 || !info)
+  {
+    fprintf(stderr, "can't resolve %s:%s\n", opt.host, opt.port);
+    return 1;
+  }
+  sockaddr_storage addr = {};
+  memcpy(&addr, info->ai_addr, info->ai_addrlen);
+  socklen_t addrLen = info->ai_addrlen;
+  freeaddrinfo(info);
+
+  printf("broker %s:%s, %u s per run, %u channel(s) per board, %s state", opt.host, opt.port, opt.seconds,
+         CONSOLE_CHANNELS, stateEncodingName(opt.encoding));
+  if (opt.cycle)
+    printf(", power cycle %u/%u ms", opt.cycleOnMs, opt.cycleOffMs);
+  if (!opt.script.empty())
+    printf(", %zu scripted events", opt.script.size());
+  printf("\nlatency in ms, cmd includes the %lu ms state coalescing\n\n", (unsigned long)STATE_PUBLISH_COALESCE);
+
+  printf("%7s %9s %10s %9s %9s %9s %8s %8s %8s %8s %8s %6s\n", "boards", "connected", "connect_ms", "sent/s",
+         "recv/s", "kB/s", "lat_p50", "lat_p99", "lat_max", "cmd_p50", "cmd_p99", "lost");
+  for (uint32_t count : opt.boardCounts)
+  {
+    RoundResult r;
+    if (!runRound(opt, count, addr, addrLen, r))
+      return 1;
+
+    uint32_t latMax = r.latencyUs.empty() ? 0 : *std::max_element(r.latencyUs.begin(), r.latencyUs.end());
+    printf("%7u %9u %10u %9.0f %9.0f %9.1f %8.2f %8.2f %8.2f %8.1f %8.1f %6llu\n", r.boards, r.connected,
+           r.connectMaxMs, r.published / r.seconds, r.received / r.seconds, r.bytes / r.seconds / 1000.0,
+           percentile(r.latencyUs, 0.50) / 1000.0, percentile(r.latencyUs, 0.99) / 1000.0, latMax / 1000.0,
+           percentile(r.commandUs, 0.50) / 1000.0, percentile(r.commandUs, 0.99) / 1000.0,
+           (unsigned long long)r.lost);
+    fflush(stdout);
+  }
+
+  return 0;
+}
@@ -1,9 +1,8 @@
-#include <Arduino.h>
-
 #include <utils.h>
 #include <state.h>
 #include <serial_mux.h>
 
+#ifdef ARDUINO
 String getMacSuffix()
 {
   uint64_t chipId = ESP.getEfuseMac();
@@ -27,18 +26,12 @@ time_t getSyncedUnixTime(uint32_t timeoutMs)
   }
 }
 
-// Read ADC average over multiple samples
-int readAdcAverage(uint8_t pin, int samples)
+String toLower(String s)
 {
-  long sum = 0;
-  for (int i = 0; i < samples; ++i)
-  {
-    sum += analogRead(pin);
-    delayMicroseconds(1000);
-  }
-
-  return (int)(sum / samples);
+  s.toLowerCase();
+  return s;
 }
+#endif
 
 // Convert color mode enum to string
 const char *colorModeToString(ColorMode mode)
@@ -54,12 +47,6 @@ const char *colorModeToString(ColorMode mode)
   }
 }
 
-// Linearly interpolate between two color components
-uint8_t lerpColorComponent(uint8_t from, uint8_t to, uint8_t step, uint8_t maxStep)
-{
-  return from + ((to - from) * step) / maxStep;
-}
-
 // Convert 24-bit RGB color to separate R, G, B components
 void rgbFrom24(uint32_t color, uint8_t &r, uint8_t &g, uint8_t &b)
 {
@@ -68,8 +55,14 @@ void rgbFrom24(uint32_t color, uint8_t &r, uint8_t &g, uint8_t &b)
   b = (uint8_t)(color & 0xFF);
 }
 
-String toLower(String s)
+// Clamp an integer into [lo, hi]
+int clampInt(int value, int lo, int hi)
 {
-  s.toLowerCase();
-  return s;
-}
\ No newline at end of file
+  return value < lo ? lo : (value > hi ? hi : value);
+}
+
+uint32_t msUntil(uint32_t dueMs, uint32_t nowMs)
+{
+  int32_t left = (int32_t)(dueMs - nowMs);
+  return left > 0 ? (uint32_t)left : 0;
+}
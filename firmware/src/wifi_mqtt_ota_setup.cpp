@@ -4,17 +4,38 @@
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include <ArduinoOTA.h>
-#include <HTTPClient.h>
-#include <Update.h>
 #include <Arduino.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <lwip/dns.h>
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
 
 #include <state.h>
+#include <hal.h>
+#include <commands.h>
+#include <loop_stats.h>
+#include <scheduler.h>
+#include <power_detect.h>
+#include <adc_sampler.h>
+#include <input_events.h>
+#include <control.h>
+#include <settings.h>
+#include <mqtt_dispatch.h>
+#include <state_publish.h>
+#include <state_json.h>
+#include <task_queues.h>
 #include <utils.h>
 #include <serial_mux.h>
 #include <pins.h>
 #include <config.h>
 #include <wifi_mqtt_ota_setup.h>
 #include <ha_topics.h>
+#include <ha_discovery.h>
+#include <ota_update.h>
+#include <effects.h>
+#include <led_segments.h>
 
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
@@ -40,14 +61,44 @@ static WiFiManagerParameter *g_pMqttPort = nullptr;
 static WiFiManagerParameter *g_pMqttUser = nullptr;
 static WiFiManagerParameter *g_pMqttPass = nullptr;
 
-static void connectToMqtt();
+static void mqttConnectStep();
+static void mqttConnectStatsToJson(JsonObject obj);
 static void saveMqttPrefs(Preferences &prefs);
 static void loadMqttPrefs(Preferences &prefs);
 
 bool wifiIsConnected() { return wifiConnected; }
 
-static void publishHADiscovery();
+// MQTT side of hal.h
+bool halMqttConnected() { return mqttClient.connected(); }
 
+bool halMqttPublish(const char *topic, const uint8_t *payload, size_t length, bool retain)
+{
+  return mqttClient.publish(topic, payload, length, retain);
+}
+
+// Shared serialization buffer, sized to the PubSubClient packet limit
+static char payloadBuffer[MQTT_MAX_PACKET_SIZE];
+
+// Whatever PubSubClient delivers must fit a control command slot
+static_assert(CONTROL_COMMAND_PAYLOAD_MAX >= MQTT_MAX_PACKET_SIZE, "control command slot smaller than an MQTT packet");
+
+static bool publishJson(const char *topic, const JsonDocument &doc, bool retain = true)
+{
+  size_t length = serializeJson(doc, payloadBuffer, sizeof(payloadBuffer));
+  return mqttClient.publish(topic, (const uint8_t *)payloadBuffer, length, retain);
+}
+
+static bool publishMsgPack(const char *topic, const JsonDocument &doc, bool retain = true)
+{
+  size_t length = serializeMsgPack(doc, payloadBuffer, sizeof(payloadBuffer));
+  return mqttClient.publish(topic, (const uint8_t *)payloadBuffer, length, retain);
+}
+
+static void publishHADiscovery(bool force);
+static void flushSettings();
+static MqttDispatcher networkDispatcher;
+
+static void mqttCommandsBegin();
 void mqttCallback(char *topic, byte *payload, unsigned int length);
 
 void wifiKickoff(const String &apName, Preferences &prefs)
@@ -69,7 +120,8 @@ void wifiKickoff(const String &apName, Preferences &prefs)
           break;
         default:
           break;
-      } });
+      }
+      schedulerWake(LoopTask::Network, WakeReason::Network); });
     eventsHooked = true;
   }
 
@@ -210,10 +262,12 @@ void maybeInitNetServices(Preferences &prefs)
   {
     if (mqttConfigValid)
     {
+      mqttCommandsBegin();
       mqttClient.setServer(mqtt_server.c_str(), mqtt_port);
+      mqttClient.setSocketTimeout(MQTT_CONNACK_TIMEOUT_S);
       mqttClient.setCallback([](char *topic, byte *payload, unsigned int len)
                              { mqttCallback(topic, payload, len); });
-      connectToMqtt();
+      mqttConnectStep();
     }
     else
     {
@@ -222,7 +276,9 @@ void maybeInitNetServices(Preferences &prefs)
 
     ArduinoOTA
         .onStart([]()
-                 { Serial.println("OTA update starting"); })
+                 {
+                   flushSettings();
+                   Serial.println("OTA update starting"); })
         .onEnd([]()
                { Serial.println("\nOTA complete"); })
         .onProgress([](unsigned int p, unsigned int t)
@@ -230,572 +286,541 @@ void maybeInitNetServices(Preferences &prefs)
         .onError([](ota_error_t e)
                  { Serial.printf("OTA Error [%u]\n", e); });
 
-    String host = "Console-LED-" + getMacSuffix();
-    ArduinoOTA.setHostname(host.c_str());
+    char host[24];
+    snprintf(host, sizeof(host), "Console-LED-%s", haMacSuffix());
+    ArduinoOTA.setHostname(host);
     ArduinoOTA.begin();
 
     Serial.println();
-    Serial.printf("OTA Ready. Hostname: %s.local\n", host.c_str());
+    Serial.printf("OTA Ready. Hostname: %s.local\n", host);
 
     didInit = true;
   }
 }
 
-void publishState()
+void publishState(const StateSnapshot &s, bool clearUnused)
 {
   if (!mqttClient.connected())
     return;
 
   JsonDocument doc;
-  doc["enabled"] = ledEnabled;
-  doc["brightness"] = currentBrightness;
-  doc["bootTime"] = bootTime;
-  doc["name"] = deviceName;
-  doc["colorMode"] = (colorMode == ColorMode::Palette) ? "palette" : "custom";
-  doc["colorIndex"] = currentColorIndex;
-
-  JsonObject threshold = doc["threshold"].to<JsonObject>();
-  threshold["baseline"] = currentThreshold;
-  threshold["offset"] = currentThresholdOffset;
-  threshold["on"] = currentThreshold + currentThresholdOffset;
-  threshold["off"] = currentThreshold - currentThresholdOffset;
-
-  char hexColor[8];
-  snprintf(hexColor, sizeof(hexColor), "%06X", customColor);
-  doc["customColor"] = String("#") + hexColor;
-
-  String payload;
-  serializeJson(doc, payload);
-
-  String topic = "console/board-" + toLower(getMacSuffix()) + "/state";
-  mqttClient.publish(topic.c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
+  stateToJson(s, doc);
+
+  // An empty retained message removes the old one from the broker
+  if (stateEncodingHas(s.encoding, StateEncoding::Json))
+    publishJson(haDeviceStateTopic(), doc);
+  else if (clearUnused)
+    mqttClient.publish(haDeviceStateTopic(), (const uint8_t *)"", 0, true);
+
+  if (stateEncodingHas(s.encoding, StateEncoding::MsgPack))
+    publishMsgPack(haDeviceStateMsgPackTopic(), doc);
+  else if (clearUnused)
+    mqttClient.publish(haDeviceStateMsgPackTopic(), (const uint8_t *)"", 0, true);
 }
 
-static void publishHADiscovery()
+// Discovery payloads are generated at build time. They are only resent when
+// the set changed since the last successful publish, when forced, or when
+// Home Assistant comes back online.
+static void publishHADiscovery(bool force)
 {
   if (!mqttClient.connected())
+    return;
+
+  uint32_t hash = haDiscoveryHash();
+  if (!force && prefs.isKey("ha_hash") && prefs.getUInt("ha_hash", 0) == hash)
   {
+    Serial.println("HA discovery unchanged, skipping");
     return;
   }
 
+  char topic[96];
+  unsigned sent = 0;
+  for (uint8_t i = 0; i < HA_DISCOVERY_COUNT; ++i)
   {
-    JsonDocument config;
-    config["name"] = "Console LED Strip";
-    config["uniq_id"] = haNodeId();
-    config["cmd_t"] = haCmdTopic();
-    config["stat_t"] = haStateTopic();
-    config["avty_t"] = haAvailTopic();
-    config["pl_avail"] = "1";
-    config["pl_not_avail"] = "0";
-    config["schema"] = "json";
-    config["color_mode"] = true;
-    config["optimistic"] = false;
-    config["icon"] = "mdi:led-strip";
-
-    JsonArray modes = config["supported_color_modes"].to<JsonArray>();
-    modes.add("rgb");
-
-    JsonObject device = config["device"].to<JsonObject>();
-    device["ids"].add("console_" + haNodeId());
-    device["name"] = "Console-" + getMacSuffix();
-    device["mf"] = HA_DEVICE_MANUFACTURER;
-    device["mdl"] = HA_DEVICE_MODEL;
-    device["sw"] = HA_DEVICE_FW_VERSION;
-
-    String payload;
-    serializeJson(config, payload);
-    mqttClient.publish(haConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-
-    // Identify Button
-    {
-      JsonDocument config;
-      config["name"] = "Identify";
-      config["uniq_id"] = haNodeId() + "_identify";
-      config["cmd_t"] = haIdentifyCmdTopic();
-      config["payload_press"] = "1";
-      config["icon"] = "mdi:magnify";
-
-      JsonObject device = config["device"].to<JsonObject>();
-      device["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haIdentifyConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-    }
-
-    // Reboot Button
-    {
-      JsonDocument config;
-      config["name"] = "Reboot";
-      config["uniq_id"] = haNodeId() + "_reboot";
-      config["cmd_t"] = haRebootCmdTopic();
-      config["payload_press"] = "1";
-      config["icon"] = "mdi:reload";
-
-      JsonObject device = config["device"].to<JsonObject>();
-      device["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haRebootConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-    }
-
-    // Calibrate
+    const HaDiscoveryEntry &entry = haDiscoveryEntries[i];
+    uint8_t copies = entry.perChannel ? CONSOLE_CHANNELS : 1;
+    for (uint8_t ch = 0; ch < copies; ++ch)
     {
-      JsonDocument config;
-      config["name"] = "Start Calibration";
-      config["uniq_id"] = haNodeId() + "_calibrate";
-      config["cmd_t"] = haCalibrateCmdTopic();
-      config["payload_press"] = "1";
-      config["icon"] = "mdi:lightning-bolt";
-
-      JsonObject device = config["device"].to<JsonObject>();
-      device["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haCalibrateConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
+      size_t length = haDiscoveryExpand(entry.payload, payloadBuffer, sizeof(payloadBuffer), ch);
+      if (!haDiscoveryExpand(entry.topic, topic, sizeof(topic), ch) || !length ||
+          !mqttClient.publish(topic, (const uint8_t *)payloadBuffer, length, true))
+      {
+        Serial.printf("HA discovery publish failed: %s\n", entry.topic);
+        return;
+      }
+      sent++;
     }
+  }
 
-    // Offset
+  for (uint8_t i = 0; i < HA_DISCOVERY_RETIRED_COUNT; ++i)
+  {
+    if (!haDiscoveryExpand(haDiscoveryRetired[i], topic, sizeof(topic)) ||
+        !mqttClient.publish(topic, (const uint8_t *)"", 0, true))
     {
-      JsonDocument config;
-      config["name"] = "Threshold offset";
-      config["uniq_id"] = haNodeId() + "_offset";
-      config["cmd_t"] = haOffsetCmdTopic();
-      config["stat_t"] = haOffsetStateTopic();
-      config["mode"] = "box";
-      config["min"] = 0;
-      config["max"] = 5000;
-      config["step"] = 1;
-      config["entity_category"] = "config";
-      config["icon"] = "mdi:arrow-expand-horizontal";
-
-      JsonObject dev = config["device"].to<JsonObject>();
-      dev["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haNumberOffsetConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
+      Serial.printf("HA discovery clear failed: %s\n", haDiscoveryRetired[i]);
+      return;
     }
+  }
 
-    // Baseline
-    {
-      JsonDocument config;
-      config["name"] = "Baseline";
-      config["uniq_id"] = haNodeId() + "_threshold";
-      config["stat_t"] = haBaseStateTopic();
-      config["entity_category"] = "diagnostic";
-
-      JsonObject dev = config["device"].to<JsonObject>();
-      dev["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haSensorBaselineConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-    }
+  prefs.putUInt("ha_hash", hash);
+  Serial.printf("HA discovery published (%u messages)\n", sent);
+}
 
-    // Threshold (On)
-    {
-      JsonDocument config;
-      config["name"] = "Threshold (on)";
-      config["uniq_id"] = haNodeId() + "_th_on";
-      config["stat_t"] = haThOnStateTopic();
-      config["entity_category"] = "diagnostic";
-
-      JsonObject dev = config["device"].to<JsonObject>();
-      dev["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haSensorOnConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-    }
+// ADC trace frames queued by the control task
+static void publishAdcTraceFrames()
+{
+  static TraceFrameMessage frame;
+  while (traceFramePop(frame))
+    mqttClient.publish(haDiagAdcTopic(), frame.data, frame.length, false);
+}
 
-    // Threshold (Off)
-    {
-      JsonDocument config;
-      config["name"] = "Threshold (off)";
-      config["uniq_id"] = haNodeId() + "_th_off";
-      config["stat_t"] = haThOffStateTopic();
-      config["entity_category"] = "diagnostic";
-
-      JsonObject dev = config["device"].to<JsonObject>();
-      dev["ids"].add("console_" + haNodeId());
-
-      String payload;
-      serializeJson(config, payload);
-      mqttClient.publish(haSensorOffConfigTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-    }
+// A rename from the control task: HA shows the device under its name
+static void publishRenamedDiscovery()
+{
+  static DiscoveryNameMessage message;
+  bool renamed = false;
+  while (discoveryNamePop(message))
+  {
+    haDiscoverySetName(message.name);
+    renamed = true;
   }
+
+  if (renamed)
+    publishHADiscovery(true);
 }
 
-void publishHAState()
+static void publishLoopDiagnostics()
 {
   if (!mqttClient.connected())
     return;
 
-  JsonDocument state;
-  state["state"] = ledEnabled ? "ON" : "OFF";
-  state["brightness"] = (int)currentBrightness;
-  state["color_mode"] = "rgb";
-
-  uint32_t c = (colorMode == ColorMode::Palette && currentColorIndex < NUM_COLORS) ? colors[currentColorIndex] : customColor;
-  uint8_t r = 0, g = 0, b = 0;
-  rgbFrom24(c, r, g, b);
-  auto color = state["color"].to<JsonObject>();
-  color["r"] = (int)r;
-  color["g"] = (int)g;
-  color["b"] = (int)b;
-
-  String payload;
-  serializeJson(state, payload);
-  mqttClient.publish(haStateTopic().c_str(), (const uint8_t *)payload.c_str(), payload.length(), true);
-
-  // Calibration Threshold/Offset
-  mqttClient.publish(haOffsetStateTopic().c_str(), String(currentThresholdOffset).c_str(), true);
-  mqttClient.publish(haBaseStateTopic().c_str(), String(currentThreshold).c_str(), true);
-  mqttClient.publish(haThOnStateTopic().c_str(), String(currentThreshold + currentThresholdOffset).c_str(), true);
-  mqttClient.publish(haThOffStateTopic().c_str(), String(currentThreshold - currentThresholdOffset).c_str(), true);
+  JsonDocument doc;
+  loopStatsToJson(doc);
+  schedulerToJson(doc);
+  doc["adc_dropped"] = adcSamplerDropped();
+  doc["nvs_requested"] = settingsWritesRequested();
+  doc["nvs_written"] = settingsWritesCommitted();
+  doc["state_published"] = statePublishCount();
+  doc["queue_dropped"] = taskQueuesDropped();
+  doc["input_dropped"] = inputDropped();
+
+  JsonObject cmd = doc["cmd"].to<JsonObject>();
+  mqttDispatchStatsToJson(networkDispatcher, cmd);
+  commandsStatsToJson(cmd);
+
+  mqttConnectStatsToJson(doc["mqtt_connect"].to<JsonObject>());
+  JsonObject frame = doc["frame"].to<JsonObject>();
+  effectFrameStatsToJson(frame);
+  segmentsToJson(frame);
+
+  publishJson(haDiagLoopTopic(), doc);
 }
 
-void connectToMqtt()
+void publishHALightState(const StateSnapshot &s, uint8_t channel)
 {
-  Serial.println();
-  Serial.println("Connecting to MQTT");
-
-  String clientId = haNodeId();
-  String willTopic = haAvailTopic();
-  int willQos = 0;
-  bool willRetain = true;
-  const char *willPayload = "0";
-
-  if (mqttClient.connect(clientId.c_str(), mqtt_user.c_str(), mqtt_pass.c_str(), willTopic.c_str(), willQos, willRetain, willPayload))
-  {
-    Serial.println("MQTT connected");
-
-    String prefix = "console/" + clientId;
-    mqttClient.subscribe((prefix + "/set").c_str());
-    mqttClient.subscribe((prefix + "/identify").c_str());
-    mqttClient.subscribe((prefix + "/reboot").c_str());
-    mqttClient.subscribe((prefix + "/fw-update").c_str());
-    mqttClient.subscribe((prefix + "/calibrate").c_str());
+  if (!mqttClient.connected())
+    return;
 
-    mqttClient.subscribe(haCmdTopic().c_str());
-    mqttClient.subscribe(haOffsetCmdTopic().c_str());
+  JsonDocument state;
+  lightStateToJson(s, channel, state);
+  publishJson(haStateTopic(channel), state);
+}
 
-    mqttClient.publish(haAvailTopic().c_str(), "1", willRetain);
+// MQTT connection state machine
+// Each handleMqttLoop() advances it by one non-blocking step: async DNS in
+// the lwIP thread, a non-blocking TCP connect polled with select(), then
+// CONNECT/CONNACK and one subscription per step. Only the CONNACK wait still
+// blocks, bounded by MQTT_CONNACK_TIMEOUT_S.
+enum class MqttPhase : uint8_t
+{
+  Idle = 0,
+  Resolving,
+  Connecting,
+  Handshake,
+  Subscribing,
+  Connected
+};
+
+static const char *const MQTT_PHASE_NAMES[] = {"idle", "dns", "tcp", "connack", "subscribe", "connected"};
+
+static MqttPhase mqttPhase = MqttPhase::Idle;
+static unsigned long phaseStart = 0;
+static uint32_t phaseMs[static_cast<uint8_t>(MqttPhase::Connected)];
+static uint32_t connectAttempts = 0;
+static uint32_t connectFailures = 0;
+static MqttPhase lastFailedPhase = MqttPhase::Idle;
+
+static int mqttSocket = -1;
+static ip4_addr_t brokerAddr;
+static uint8_t subscribeIndex = 0;
+
+// Written from the lwIP thread
+static volatile bool dnsDone = false;
+static volatile bool dnsOk = false;
+static volatile uint32_t dnsGeneration = 0;
+
+static void enterPhase(MqttPhase phase)
+{
+  unsigned long now = millis();
+  phaseMs[static_cast<uint8_t>(mqttPhase)] = now - phaseStart;
+  mqttPhase = phase;
+  phaseStart = now;
+}
 
-    publishState();
-    publishHADiscovery();
-    publishHAState();
+static void failPhase(const char *reason)
+{
+  Serial.printf("MQTT %s failed: %s, retrying in %lu s\n", MQTT_PHASE_NAMES[static_cast<uint8_t>(mqttPhase)],
+                reason, MQTT_RETRY_INTERVAL / 1000);
 
-    lastReconnectAttempt = millis();
-  }
-  else
+  if (mqttSocket >= 0)
   {
-    Serial.print("MQTT failed, rc=");
-    Serial.print(mqttClient.state());
-    Serial.println(" try again in 5 seconds");
-    lastReconnectAttempt = millis();
+    close(mqttSocket);
+    mqttSocket = -1;
   }
+  dnsGeneration++; // Ignore a late DNS answer
+  connectFailures++;
+  lastFailedPhase = mqttPhase;
+  mqttPhase = MqttPhase::Idle;
+  lastReconnectAttempt = millis();
 }
 
-void handleMqttLoop()
+static void dnsFound(const char *, const ip_addr_t *addr, void *arg)
 {
-  if (!mqttConfigValid)
+  if ((uint32_t)(uintptr_t)arg != dnsGeneration)
     return;
 
-  if (!mqttClient.connected())
+  if (addr && IP_IS_V4(addr))
   {
-    unsigned long now = millis();
-    if (now - lastReconnectAttempt > 5000)
-    {
-      lastReconnectAttempt = now;
-      connectToMqtt();
-    }
-  }
-  else
-  {
-    mqttClient.loop();
+    brokerAddr = *ip_2_ip4(addr);
+    dnsOk = true;
   }
+  dnsDone = true;
 }
 
-void performOTAUpdate(const String &url)
+// Runs in the lwIP thread, dns_gethostbyname isn't safe anywhere else
+static void dnsStart(void *arg)
 {
-  WiFiClient client;
-  HTTPClient http;
-
-  Serial.printf("Starting OTA update from: %s\n", url.c_str());
-  http.begin(client, url);
-
-  int httpCode = http.GET();
-  if (httpCode != HTTP_CODE_OK)
-  {
-    Serial.printf("HTTP GET failed: %d\n", httpCode);
-    http.end();
-    return;
-  }
+  ip_addr_t addr;
+  err_t err = dns_gethostbyname(mqtt_server.c_str(), &addr, dnsFound, arg);
+  if (err == ERR_OK)
+    dnsFound(nullptr, &addr, arg);
+  else if (err != ERR_INPROGRESS)
+    dnsDone = true;
+}
 
-  int contentLength = http.getSize();
-  if (contentLength <= 0)
-  {
-    Serial.println("Invalid content length");
-    http.end();
-    return;
-  }
+static bool tcpStart()
+{
+  mqttSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (mqttSocket < 0)
+    return false;
 
-  bool canBegin = Update.begin(contentLength);
-  if (!canBegin)
-  {
-    Serial.println("Not enough space for OTA");
-    http.end();
-    return;
-  }
+  fcntl(mqttSocket, F_SETFL, fcntl(mqttSocket, F_GETFL, 0) | O_NONBLOCK);
 
-  WiFiClient *stream = http.getStreamPtr();
-  size_t written = Update.writeStream(*stream);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(mqtt_port);
+  addr.sin_addr.s_addr = brokerAddr.addr;
 
-  if (written != (size_t)contentLength)
-  {
-    Serial.printf("Only wrote %u of %d bytes\n", (unsigned)written, contentLength);
-    http.end();
-    return;
-  }
+  int res = connect(mqttSocket, (struct sockaddr *)&addr, sizeof(addr));
+  return res == 0 || errno == EINPROGRESS;
+}
 
-  if (!Update.end())
-  {
-    Serial.printf("Update failed. Error: %s\n", Update.errorString());
-    http.end();
-    return;
-  }
+// 1 connected, 0 still in progress, -1 failed
+static int tcpPoll()
+{
+  fd_set writable;
+  FD_ZERO(&writable);
+  FD_SET(mqttSocket, &writable);
+  struct timeval zero = {0, 0};
+
+  int ready = select(mqttSocket + 1, nullptr, &writable, nullptr, &zero);
+  if (ready == 0)
+    return 0;
+  if (ready < 0)
+    return -1;
+
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(mqttSocket, SOL_SOCKET, SO_ERROR, &err, &len);
+  return err == 0 ? 1 : -1;
+}
 
-  if (!Update.isFinished())
+static const char *const *mqttSubscriptions()
+{
+  // Board topics, then the commands of every extra channel
+  static const char *topics[10 + 6 * (CONSOLE_CHANNELS - 1) + 1];
+  size_t n = 0;
+  topics[n++] = haSetCmdTopic();
+  topics[n++] = haSetMsgPackCmdTopic();
+  topics[n++] = haIdentifyCmdTopic();
+  topics[n++] = haRebootCmdTopic();
+  topics[n++] = haFwUpdateCmdTopic();
+  topics[n++] = haCalibrateCmdTopic();
+  topics[n++] = haCaptureCmdTopic();
+  topics[n++] = haCmdTopic();
+  topics[n++] = haOffsetCmdTopic();
+  topics[n++] = HA_STATUS_TOPIC;
+  for (uint8_t ch = 1; ch < CONSOLE_CHANNELS; ++ch)
   {
-    Serial.println("Update not complete");
-    http.end();
-    return;
+    topics[n++] = haSetCmdTopic(ch);
+    topics[n++] = haSetMsgPackCmdTopic(ch);
+    topics[n++] = haIdentifyCmdTopic(ch);
+    topics[n++] = haCalibrateCmdTopic(ch);
+    topics[n++] = haCmdTopic(ch);
+    topics[n++] = haOffsetCmdTopic(ch);
   }
+  topics[n] = nullptr;
+  return topics;
+}
 
-  Serial.println("OTA update complete! Rebooting");
-  http.end();
-  delay(1000);
-  ESP.restart();
+static void mqttConnectStatsToJson(JsonObject obj)
+{
+  obj["attempts"] = connectAttempts;
+  obj["failures"] = connectFailures;
+  obj["phase"] = MQTT_PHASE_NAMES[static_cast<uint8_t>(mqttPhase)];
+  if (connectFailures > 0)
+    obj["last_failed"] = MQTT_PHASE_NAMES[static_cast<uint8_t>(lastFailedPhase)];
+  obj["dns_ms"] = phaseMs[static_cast<uint8_t>(MqttPhase::Resolving)];
+  obj["tcp_ms"] = phaseMs[static_cast<uint8_t>(MqttPhase::Connecting)];
+  obj["connack_ms"] = phaseMs[static_cast<uint8_t>(MqttPhase::Handshake)];
+  obj["subscribe_ms"] = phaseMs[static_cast<uint8_t>(MqttPhase::Subscribing)];
 }
 
-void mqttCallback(char *topic, byte *payload, unsigned int length)
+static void mqttConnectStep()
 {
-  String topicStr(topic);
-  String msg((const char *)payload, length);
+  unsigned long now = millis();
 
-  JsonDocument doc;
-  auto err = deserializeJson(doc, msg);
-  if (err)
+  switch (mqttPhase)
   {
-    Serial.printf("JSON parse failed: %s\n", err.c_str());
-    return;
-  }
+  case MqttPhase::Idle:
+  case MqttPhase::Connected:
+    if (now - lastReconnectAttempt < MQTT_RETRY_INTERVAL && connectAttempts > 0)
+      return;
 
-  if (topicStr == haOffsetCmdTopic())
-  {
-    int newOffset = msg.toInt();
-    Serial.printf("[MQTT] HA requested offset: %d\n", newOffset);
+    Serial.println();
+    Serial.println("Connecting to MQTT");
+    connectAttempts++;
+    mqttPhase = MqttPhase::Idle;
+    enterPhase(MqttPhase::Resolving);
 
-    if (newOffset != currentThresholdOffset)
+    // IP literals need no lookup
+    if (ip4addr_aton(mqtt_server.c_str(), &brokerAddr))
     {
-      currentThresholdOffset = newOffset;
-      prefs.putInt("th_offset", currentThresholdOffset);
-      publishState();
-      publishHAState();
+      dnsOk = true;
+      dnsDone = true;
+      return;
     }
 
+    dnsDone = false;
+    dnsOk = false;
+    tcpip_callback(dnsStart, (void *)(uintptr_t)dnsGeneration);
     return;
-  }
-
-  if (topicStr == haCmdTopic())
-  {
-    bool stateChanged = false;
 
-    if (doc["state"].is<const char *>())
+  case MqttPhase::Resolving:
+    if (!dnsDone)
     {
-      Serial.println("HA sent state ON/OFF — ignoring (device power is console-driven).");
-      // Immediately republish real state so HA UI snaps back
-      publishHAState();
+      if (now - phaseStart >= MQTT_DNS_TIMEOUT)
+        failPhase("timeout");
+      return;
     }
-
-    if (doc["brightness"].is<int>())
+    if (!dnsOk)
     {
-      int b = constrain(doc["brightness"].as<int>(), 0, 255);
-      if (b != currentBrightness)
-      {
-        currentBrightness = b;
-        strip.setBrightness(currentBrightness);
-        updateLED(false);
-        prefs.putUChar("brightness", currentBrightness);
-        stateChanged = true;
-      }
+      failPhase("host not found");
+      return;
     }
 
-    if (doc["color"].is<JsonObject>())
+    enterPhase(MqttPhase::Connecting);
+    if (!tcpStart())
+      failPhase("socket");
+    return;
+
+  case MqttPhase::Connecting:
+  {
+    int state = tcpPoll();
+    if (state == 0)
     {
-      auto cobj = doc["color"].as<JsonObject>();
-      if (cobj["r"].is<int>() && cobj["g"].is<int>() && cobj["b"].is<int>())
-      {
-        uint8_t r = constrain(cobj["r"].as<int>(), 0, 255);
-        uint8_t g = constrain(cobj["g"].as<int>(), 0, 255);
-        uint8_t b = constrain(cobj["b"].as<int>(), 0, 255);
-
-        customColor = ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
-        colorMode = ColorMode::Custom;
-        prefs.putUChar("color_mode", static_cast<uint8_t>(colorMode));
-        char hex[7];
-        snprintf(hex, sizeof(hex), "%02X%02X%02X", r, g, b);
-        prefs.putString("custom_color", hex);
-
-        updateLED(true);
-        stateChanged = true;
-      }
+      if (now - phaseStart >= MQTT_TCP_TIMEOUT)
+        failPhase("timeout");
+      return;
     }
-
-    if (stateChanged)
+    if (state < 0)
     {
-      publishState();
-      publishHAState();
+      failPhase("refused");
+      return;
     }
+
+    // Hand the socket to WiFiClient in blocking mode, as its own connect() would
+    fcntl(mqttSocket, F_SETFL, fcntl(mqttSocket, F_GETFL, 0) & ~O_NONBLOCK);
+    espClient = WiFiClient(mqttSocket);
+    mqttSocket = -1;
+    enterPhase(MqttPhase::Handshake);
     return;
   }
 
-  if (topicStr.endsWith("/set"))
-  {
-    Serial.println("Received set command");
-    bool stateChanged = false;
-
-    if (doc["color"].is<int>())
+  case MqttPhase::Handshake:
+    // The TCP link is up, so this only sends CONNECT and waits for CONNACK
+    if (!mqttClient.connect(haNodeId(), mqtt_user.c_str(), mqtt_pass.c_str(), haAvailTopic(), 0, true, "0"))
     {
-      int colorIndex = doc["color"];
-      if (colorIndex >= 0 && colorIndex < NUM_COLORS)
-      {
-        stateChanged = true;
-        colorMode = ColorMode::Palette;
-        currentColorIndex = colorIndex;
-        prefs.putUChar("color_mode", (uint8_t)colorMode);
-        prefs.putUChar("color_index", currentColorIndex);
-        updateLED(true);
-
-        Serial.print("[MQTT] Received color index: ");
-        Serial.println(colorIndex);
-      }
-      else if (colorIndex == -1 && doc["customColor"].is<const char *>())
-      {
-        colorMode = ColorMode::Custom;
-        String hex = doc["customColor"].as<const char *>();
-        if (hex.startsWith("#"))
-          hex = hex.substring(1);
-        customColor = (uint32_t)strtoul(hex.c_str(), nullptr, 16);
-        prefs.putUChar("color_mode", (uint8_t)colorMode);
-        prefs.putString("custom_color", hex);
-        updateLED(true);
-
-        Serial.print("[MQTT] Received custom color: #");
-        Serial.println(hex);
-
-        stateChanged = true;
-      }
+      char reason[16];
+      snprintf(reason, sizeof(reason), "rc=%d", mqttClient.state());
+      failPhase(reason);
+      return;
     }
 
-    if (doc["brightness"].is<int>())
+    subscribeIndex = 0;
+    enterPhase(MqttPhase::Subscribing);
+    return;
+
+  case MqttPhase::Subscribing:
+  {
+    const char *topic = mqttSubscriptions()[subscribeIndex];
+    if (topic)
     {
-      int brightness = constrain((int)doc["brightness"], 0, 255);
-      currentBrightness = brightness;
-      prefs.putUChar("brightness", currentBrightness);
-      strip.setBrightness(currentBrightness);
-      updateLED(false);
+      mqttClient.subscribe(topic);
+      subscribeIndex++;
+      return;
+    }
 
-      Serial.print("[MQTT] Received brightness: ");
-      Serial.println(brightness);
+    enterPhase(MqttPhase::Connected);
+    lastReconnectAttempt = now;
+    Serial.printf("MQTT connected (dns %lu ms, tcp %lu ms, connack %lu ms)\n",
+                  (unsigned long)phaseMs[static_cast<uint8_t>(MqttPhase::Resolving)],
+                  (unsigned long)phaseMs[static_cast<uint8_t>(MqttPhase::Connecting)],
+                  (unsigned long)phaseMs[static_cast<uint8_t>(MqttPhase::Handshake)]);
 
-      stateChanged = true;
-    }
+    mqttClient.publish(haAvailTopic(), "1", true);
+    publishHADiscovery(false);
+    statePublishAll();
+    return;
+  }
+  }
+}
 
-    if (doc["name"].is<const char *>())
-    {
-      deviceName = doc["name"].as<String>();
-      prefs.putString("name", deviceName);
+// Deeper modem sleep while the sensing is in standby, the broker only sees
+// a little more latency on its keepalives
+static void updateModemSleep()
+{
+  static bool deepSleep = false;
+  bool standby = adcSamplerStandby();
+  if (standby == deepSleep)
+    return;
 
-      publishHADiscovery();
+  deepSleep = standby;
+  WiFi.setSleep(standby ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+}
 
-      Serial.print("[MQTT] Received device name: ");
-      Serial.println(deviceName);
+uint32_t networkIdleMs()
+{
+  if (portalActive)
+    return NETWORK_ACTIVE_PERIOD;
 
-      stateChanged = true;
-    }
+  OtaState ota = otaUpdateState();
+  if (ota == OtaState::Downloading || ota == OtaState::Rebooting)
+    return NETWORK_ACTIVE_PERIOD;
 
-    if (doc["thresholdOffset"].is<int>())
-    {
-      int offset = doc["thresholdOffset"];
-      Serial.print("[MQTT] Received threshold offset: ");
-      Serial.println(offset);
+  if (wifiConnected && mqttConfigValid && mqttPhase != MqttPhase::Connected)
+    return NETWORK_ACTIVE_PERIOD;
 
-      currentThresholdOffset = offset;
-      prefs.putInt("th_offset", currentThresholdOffset);
-      stateChanged = true;
-    }
+  return NETWORK_IDLE_PERIOD;
+}
 
-    if (stateChanged)
-    {
-      publishState();
-      publishHAState();
-    }
-  }
-  else if (topicStr.endsWith("/fw-update"))
-  {
-    if (doc["url"].is<const char *>())
-    {
-      Serial.println();
-      Serial.print("[MQTT] Received firmware update URL: ");
-      Serial.println(doc["url"].as<const char *>());
+void handleMqttLoop()
+{
+  if (!mqttConfigValid)
+    return;
 
-      performOTAUpdate(doc["url"].as<String>());
-    }
+  // The client reports connected from CONNACK on, while the subscriptions
+  // are still going out, so the phase says when setup is done. The client
+  // says when the link dropped afterwards, and the step then reconnects.
+  if (mqttPhase != MqttPhase::Connected || !mqttClient.connected())
+  {
+    mqttConnectStep();
   }
-  else if (topicStr.endsWith("/identify"))
+  else
   {
-    Serial.println();
-    Serial.println("[MQTT] Received identify command");
+    mqttClient.loop();
+    updateModemSleep();
+
+    statePublishDrain();
+    publishAdcTraceFrames();
+    publishRenamedDiscovery();
 
-    uint32_t originalColor = (colorMode == ColorMode::Palette && currentColorIndex < NUM_COLORS) ? colors[currentColorIndex] : customColor;
-    for (int i = 0; i < 3; ++i)
+    // Publish loop timing and start a new window
+    static unsigned long lastDiagPublish = 0;
+    unsigned long now = millis();
+    if (now - lastDiagPublish >= LOOP_DIAG_INTERVAL)
     {
-      fadeToColor(strip.Color(255, 255, 255), 10, 15);
-      delay(100);
-      fadeToColor(originalColor, 10, 15);
+      lastDiagPublish = now;
+      publishLoopDiagnostics();
+      loopStatsReset();
+      schedulerReset();
     }
   }
-  else if (topicStr.endsWith("/reboot"))
-  {
-    Serial.println();
-    Serial.println("[MQTT] Received reboot request");
+}
 
-    delay(500);
-    ESP.restart();
-  }
-  else if (topicStr.endsWith("/calibrate"))
-  {
-    Serial.println();
-    Serial.println("[MQTT] Received calibration request");
+// Settings belong to the control task; ask it to commit and give it a moment
+static void flushSettings()
+{
+  settingsRequestCommit();
+  unsigned long start = millis();
+  while (settingsCommitPending() && millis() - start < 500)
+    delay(5);
+}
+
+// Commands that stay on the network task; everything else is queued for the
+// control task (see commands.cpp)
 
-    int baseline = readAdcAverage(CURRENT_SENSE_PIN, 64);
-    currentThreshold = baseline;
-    prefs.putInt("th_base", currentThreshold);
-    blinkConfirm(strip.Color(255, 255, 255), 2);
+static void onFwUpdateCommand(const MqttMessage &msg)
+{
+  const char *url = msg.json["url"];
+  if (!url)
+    return;
+
+  Serial.println();
+  Serial.print("[MQTT] Received firmware update URL: ");
+  Serial.println(url);
+
+  // Downloaded and flashed from the loop by otaUpdateLoop()
+  otaUpdateStart(url, msg.json["sha256"].as<const char *>());
+}
+
+static void onRebootCommand(const MqttMessage &)
+{
+  Serial.println();
+  Serial.println("[MQTT] Received reboot request");
+
+  flushSettings();
+  ESP.restart();
+}
+
+static const MqttCommand NETWORK_COMMANDS[] = {
+    {"fw-update", MqttPayload::Json, R"({"url":true,"sha256":true})", onFwUpdateCommand, false},
+    {"reboot", MqttPayload::None, nullptr, onRebootCommand, false},
+};
 
-    publishState();
-    publishHAState();
+static void mqttCommandsBegin()
+{
+  mqttDispatchBegin(networkDispatcher, haCmdPrefix(), NETWORK_COMMANDS, sizeof(NETWORK_COMMANDS) / sizeof(NETWORK_COMMANDS[0]));
+}
+
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  // Home Assistant restarted and may have lost its retained discovery
+  if (strcmp(topic, HA_STATUS_TOPIC) == 0)
+  {
+    if (length == 6 && memcmp(payload, "online", 6) == 0)
+      publishHADiscovery(true);
+    return;
   }
-  else
+
+  if (mqttDispatchHandles(networkDispatcher, topic))
   {
-    Serial.println();
-    Serial.printf("Unknown topic: %s\n", topicStr.c_str());
+    mqttDispatch(networkDispatcher, topic, payload, length);
+    return;
   }
+
+  if (!controlCommandPush(topic, payload, length))
+    Serial.printf("Command dropped, control queue full or too large: %s\n", topic);
 }
 
 static void loadMqttPrefs(Preferences &prefs)